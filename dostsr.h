@@ -76,6 +76,21 @@ static __segment allocate_umb(unsigned size)
 	return new_segment;
 }
 
+/** Allocates a memory block that will be owned by the program whose PSP is owner_psp
+ *  (e.g. an already installed TSR), so that it is not freed when we exit. */
+static __segment allocate_owned_block(unsigned paragraphs, segment_t owner_psp)
+{
+	segment_t segment = dos_alloc(paragraphs);
+
+	if (segment) {
+		// The MCB is always 1 segment before; its owner field is at offset 1.
+		uint16_t __far *mcb_owner = (uint16_t __far *) MK_FP(segment - 1, 1);
+		*mcb_owner = owner_psp;
+	}
+
+	return segment;
+}
+
 static __segment reallocate_to_umb(segment_t cur_seg, unsigned segment_size)
 {
 	segment_t old_segment_psp = cur_seg - (DOS_PSP_SIZE/16);
@@ -0,0 +1,50 @@
+/*
+ * VBSF - host test harness, Open Watcom extensions for other compilers
+ * Copyright (C) 2022 Javier S. Pedro
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef HOSTDEFS_H
+#define HOSTDEFS_H
+
+// This file is included before every source file of the host harness (-include).
+
+#include <stdint.h>
+#include <string.h>
+
+// A flat address space has no near/far distinction.
+#define __far
+#define far
+#define __near
+#define __interrupt
+#define __loadds
+#define __declspec(x)
+
+#define __segment uint16_t
+
+// The DOS structures are not packed here and far pointers are 8 bytes long,
+// so the size checks written for the real target do not apply.
+#define _Packed
+#define STATIC_ASSERT(expr)  struct host_static_assert_ignored
+
+#define _fmemcpy  memcpy
+#define _fmemset  memset
+#define _fmemchr  memchr
+#define _fmemcmp  memcmp
+#define _fstrcpy  strcpy
+#define _fstrlen  strlen
+
+#endif // HOSTDEFS_H
@@ -0,0 +1,836 @@
+/*
+ * VBSF - host test harness, fake VirtualBox shared folders service
+ * Copyright (C) 2022 Javier S. Pedro
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <i86.h>
+
+#include "../vboxdev.h"
+#include "hostshfl.h"
+
+#ifndef MIN
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+#endif
+
+/** The only root we hand out. */
+#define HOST_ROOT 0
+
+/** Client id returned on connection. */
+#define HOST_CLIENT_ID 1
+
+/** Maximum number of simultaneously open handles. */
+#define MAX_HANDLES 256
+
+/** IPRT's RTFS_DOS_* attributes, stored in the high word of fMode. */
+#define RTFS_DOS_SHIFT     16
+#define RTFS_DOS_READONLY  (0x01UL << RTFS_DOS_SHIFT)
+#define RTFS_DOS_HIDDEN    (0x02UL << RTFS_DOS_SHIFT)
+#define RTFS_DOS_DIRECTORY (0x10UL << RTFS_DOS_SHIFT)
+#define RTFS_DOS_NT_NORMAL (0x80UL << RTFS_DOS_SHIFT)
+
+typedef struct {
+	bool used;
+	/** Open file descriptor, or -1 for directories. */
+	int fd;
+	/** Open directory stream, for directories being listed. */
+	DIR *dir;
+	/** Host path of the object. */
+	char path[PATH_MAX];
+	/** Whether the listing pattern has been set by the first list call. */
+	bool filtered;
+	char pattern[SHFL_MAX_LEN + 1];
+} HOSTHANDLE;
+
+uint32_t host_hgcm_latency_us;
+uint32_t host_transfer_us_per_kib;
+uint64_t host_sim_time_ns;
+uint32_t host_hgcm_calls;
+
+static char share_dir[PATH_MAX];
+static const char *share_name;
+static HOSTHANDLE handles[MAX_HANDLES];
+
+/** Bytes transferred by the call being processed, for the latency model. */
+static uint32_t transferred;
+
+bool host_shfl_init(const char *dir)
+{
+	struct stat st;
+
+	if (!realpath(dir, share_dir) || stat(share_dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+		return false;
+	}
+
+	share_name = strrchr(share_dir, '/') + 1;
+	if (!*share_name) share_name = "root";
+
+	return true;
+}
+
+const char *host_shfl_share_name(void)
+{
+	return share_name;
+}
+
+unsigned host_shfl_open_handles(void)
+{
+	unsigned i, count = 0;
+
+	for (i = 0; i < MAX_HANDLES; i++) {
+		if (handles[i].used) count++;
+	}
+
+	return count;
+}
+
+static int32_t errno_to_vbox(int err)
+{
+	switch (err) {
+	case ENOENT:
+		return VERR_FILE_NOT_FOUND;
+	case ENOTDIR:
+		return VERR_PATH_NOT_FOUND;
+	case EEXIST:
+		return VERR_ALREADY_EXISTS;
+	case EACCES:
+	case EPERM:
+		return VERR_ACCESS_DENIED;
+	case ENOTEMPTY:
+		return VERR_DIR_NOT_EMPTY;
+	case EISDIR:
+		return VERR_IS_A_DIRECTORY;
+	case EMFILE:
+	case ENFILE:
+		return VERR_TOO_MANY_OPEN_FILES;
+	case EROFS:
+		return VERR_WRITE_PROTECT;
+	default:
+		return VERR_FILE_IO_ERROR;
+	}
+}
+
+/** Matches a name against a Windows style pattern (* and ?, case insensitive). */
+static bool matches_pattern(const char *pattern, const char *name)
+{
+	for (; *pattern; pattern++, name++) {
+		if (*pattern == '*') {
+			while (pattern[1] == '*') pattern++;
+			if (!pattern[1]) return true;
+			for (; *name; name++) {
+				if (matches_pattern(pattern + 1, name)) return true;
+			}
+			return false;
+		} else if (!*name) {
+			return false;
+		} else if (*pattern != '?' && tolower((unsigned char)*pattern) != tolower((unsigned char)*name)) {
+			return false;
+		}
+	}
+
+	return !*name;
+}
+
+/** Converts a guest path (relative to the share, with '\' separators) into
+ *  a host path. Components which do not exist with the same case are looked
+ *  up case insensitively, like VirtualBox does for case insensitive guests.
+ *  @returns VERR_PATH_NOT_FOUND if a parent directory does not exist,
+ *  in which case the host path is still filled. */
+static int32_t resolve_path(const SHFLSTRING *str, char *path)
+{
+	const char *s = str->ach, *end = str->ach + str->u16Length;
+	size_t len = strlen(share_dir);
+	bool missing = false;
+
+	memcpy(path, share_dir, len + 1);
+
+	while (s < end) {
+		const char *e = s;
+		char comp[NAME_MAX + 1];
+		struct stat st;
+		size_t clen;
+
+		while (e < end && *e != '\\' && *e != '/') e++;
+		clen = e - s;
+
+		if (clen == 0 || (clen == 1 && s[0] == '.')) {
+			s = e + 1;
+			continue;
+		}
+		if (clen > NAME_MAX || len + 1 + clen >= PATH_MAX) {
+			return VERR_FILENAME_TOO_LONG;
+		}
+
+		memcpy(comp, s, clen);
+		comp[clen] = '\0';
+
+		if (missing) {
+			return VERR_PATH_NOT_FOUND;
+		}
+
+		path[len] = '/';
+		strcpy(&path[len + 1], comp);
+
+		if (lstat(path, &st) != 0) {
+			DIR *dir;
+			struct dirent *ent;
+
+			path[len] = '\0';
+			dir = opendir(len ? path : "/");
+			if (dir) {
+				while ((ent = readdir(dir))) {
+					if (strcasecmp(ent->d_name, comp) == 0) {
+						strcpy(comp, ent->d_name);
+						break;
+					}
+				}
+				closedir(dir);
+			}
+			path[len] = '/';
+			strcpy(&path[len + 1], comp);
+
+			if (lstat(path, &st) != 0) {
+				// Only the last component may be missing
+				missing = true;
+			}
+		} else if (e < end && !S_ISDIR(st.st_mode)) {
+			missing = true;
+		}
+
+		len += 1 + clen;
+		s = e + 1;
+	}
+
+	return VINF_SUCCESS;
+}
+
+static void fill_objinfo(SHFLFSOBJINFO *info, const struct stat *st, const char *name)
+{
+	uint32_t mode = st->st_mode & 0xFFFF;
+
+	memset(info, 0, sizeof(*info));
+
+	info->cbObject = st->st_size;
+	info->cbAllocated = st->st_blocks * 512ULL;
+	info->AccessTime = st->st_atim.tv_sec * 1000000000LL + st->st_atim.tv_nsec;
+	info->ModificationTime = st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+	info->ChangeTime = st->st_ctim.tv_sec * 1000000000LL + st->st_ctim.tv_nsec;
+	info->BirthTime = info->ChangeTime;
+
+	// Derive the DOS attributes from the UNIX ones, like IPRT does
+	if (S_ISDIR(st->st_mode)) mode |= RTFS_DOS_DIRECTORY;
+	if (!(st->st_mode & (S_IWUSR | S_IWGRP | S_IWOTH))) mode |= RTFS_DOS_READONLY;
+	if (name[0] == '.' && strcmp(name, ".") != 0 && strcmp(name, "..") != 0) mode |= RTFS_DOS_HIDDEN;
+	if (!(mode & ~0xFFFFUL)) mode |= RTFS_DOS_NT_NORMAL;
+
+	info->Attr.fMode = mode;
+	info->Attr.enmAdditional = SHFLFSOBJATTRADD_UNIX;
+	info->Attr.u.Unix.uid = st->st_uid;
+	info->Attr.u.Unix.gid = st->st_gid;
+	info->Attr.u.Unix.cHardlinks = st->st_nlink;
+	info->Attr.u.Unix.INodeIdDevice = st->st_dev;
+	info->Attr.u.Unix.INodeId = st->st_ino;
+}
+
+static const char *basename_of(const char *path)
+{
+	return strrchr(path, '/') + 1;
+}
+
+static HOSTHANDLE *get_handle(SHFLROOT root, SHFLHANDLE handle)
+{
+	if (root != HOST_ROOT || handle == SHFL_HANDLE_ROOT || handle > MAX_HANDLES) {
+		return NULL;
+	}
+	if (!handles[handle - 1].used) {
+		return NULL;
+	}
+	return &handles[handle - 1];
+}
+
+static SHFLHANDLE new_handle(const char *path, int fd)
+{
+	unsigned i;
+
+	for (i = 0; i < MAX_HANDLES; i++) {
+		if (!handles[i].used) {
+			memset(&handles[i], 0, sizeof(HOSTHANDLE));
+			handles[i].used = true;
+			handles[i].fd = fd;
+			strcpy(handles[i].path, path);
+			return i + 1;
+		}
+	}
+
+	return SHFL_HANDLE_NIL;
+}
+
+static void free_handle(HOSTHANDLE *h)
+{
+	if (h->fd >= 0) close(h->fd);
+	if (h->dir) closedir(h->dir);
+	h->used = false;
+}
+
+static int32_t shfl_create(SHFLROOT root, const SHFLSTRING *name, SHFLCREATEPARMS *parms)
+{
+	uint32_t flags = parms->CreateFlags;
+	char path[PATH_MAX];
+	struct stat st;
+	bool exists, is_dir;
+	int32_t err;
+	int oflags, fd = -1;
+
+	if (root != HOST_ROOT) return VERR_INVALID_PARAMETER;
+
+	parms->Handle = SHFL_HANDLE_NIL;
+
+	err = resolve_path(name, path);
+	if (err == VERR_PATH_NOT_FOUND) {
+		parms->Result = SHFL_PATH_NOT_FOUND;
+		return VINF_SUCCESS;
+	} else if (err) {
+		return err;
+	}
+
+	exists = lstat(path, &st) == 0;
+	is_dir = exists && S_ISDIR(st.st_mode);
+
+	if (flags & SHFL_CF_LOOKUP) {
+		if (exists) {
+			parms->Result = SHFL_FILE_EXISTS;
+			fill_objinfo(&parms->Info, &st, basename_of(path));
+		} else {
+			parms->Result = SHFL_FILE_NOT_FOUND;
+		}
+		return VINF_SUCCESS;
+	}
+
+	// Existing directories are always opened as such
+	if (is_dir) flags |= SHFL_CF_DIRECTORY;
+
+	if (exists) {
+		if (!is_dir && (flags & SHFL_CF_DIRECTORY)) {
+			return VERR_NOT_A_DIRECTORY;
+		}
+
+		switch (flags & SHFL_CF_ACT_MASK_IF_EXISTS) {
+		case SHFL_CF_ACT_FAIL_IF_EXISTS:
+			parms->Result = SHFL_FILE_EXISTS;
+			fill_objinfo(&parms->Info, &st, basename_of(path));
+			return VINF_SUCCESS;
+		case SHFL_CF_ACT_OPEN_IF_EXISTS:
+			parms->Result = SHFL_FILE_EXISTS;
+			oflags = 0;
+			break;
+		default:
+			if (is_dir) return VERR_IS_A_DIRECTORY;
+			parms->Result = SHFL_FILE_REPLACED;
+			oflags = O_TRUNC;
+			break;
+		}
+	} else {
+		if ((flags & SHFL_CF_ACT_MASK_IF_NEW) == SHFL_CF_ACT_FAIL_IF_NEW) {
+			parms->Result = SHFL_FILE_NOT_FOUND;
+			return VINF_SUCCESS;
+		}
+
+		parms->Result = SHFL_FILE_CREATED;
+		oflags = O_CREAT | O_EXCL;
+
+		if (flags & SHFL_CF_DIRECTORY) {
+			if (mkdir(path, 0777) != 0) return errno_to_vbox(errno);
+		}
+	}
+
+	if (!(flags & SHFL_CF_DIRECTORY)) {
+		switch (flags & SHFL_CF_ACCESS_MASK_RW) {
+		case SHFL_CF_ACCESS_READWRITE:
+			oflags |= O_RDWR;
+			break;
+		case SHFL_CF_ACCESS_WRITE:
+			oflags |= O_WRONLY;
+			break;
+		default:
+			oflags |= O_RDONLY;
+			break;
+		}
+		if (flags & SHFL_CF_ACCESS_APPEND) oflags |= O_APPEND;
+
+		fd = open(path, oflags, 0666);
+		if (fd < 0) return errno_to_vbox(errno);
+	}
+
+	if (stat(path, &st) != 0) {
+		err = errno_to_vbox(errno);
+		if (fd >= 0) close(fd);
+		return err;
+	}
+
+	fill_objinfo(&parms->Info, &st, basename_of(path));
+
+	parms->Handle = new_handle(path, fd);
+	if (parms->Handle == SHFL_HANDLE_NIL) {
+		if (fd >= 0) close(fd);
+		return VERR_TOO_MANY_OPEN_FILES;
+	}
+
+	return VINF_SUCCESS;
+}
+
+static int32_t shfl_close(SHFLROOT root, SHFLHANDLE handle)
+{
+	HOSTHANDLE *h = get_handle(root, handle);
+	if (!h) return VERR_INVALID_HANDLE;
+
+	free_handle(h);
+
+	return VINF_SUCCESS;
+}
+
+static int32_t shfl_read_write(bool write, SHFLROOT root, SHFLHANDLE handle, uint64_t offset,
+                               uint32_t *size, void *buffer)
+{
+	HOSTHANDLE *h = get_handle(root, handle);
+	ssize_t bytes;
+
+	if (!h) return VERR_INVALID_HANDLE;
+	if (h->fd < 0) return VERR_IS_A_DIRECTORY;
+
+	if (write) {
+		bytes = pwrite(h->fd, buffer, *size, offset);
+	} else {
+		bytes = pread(h->fd, buffer, *size, offset);
+	}
+	if (bytes < 0) {
+		*size = 0;
+		return errno_to_vbox(errno);
+	}
+
+	*size = bytes;
+	transferred += bytes;
+
+	return VINF_SUCCESS;
+}
+
+static int32_t shfl_list(SHFLROOT root, SHFLHANDLE handle, uint32_t flags, uint32_t *size,
+                         const SHFLSTRING *path, SHFLDIRINFO *dirinfo, uint32_t *resume, uint32_t *count)
+{
+	HOSTHANDLE *h = get_handle(root, handle);
+	struct dirent *ent;
+
+	*count = 0;
+
+	if (!h) return VERR_INVALID_HANDLE;
+	if (h->fd >= 0) return VERR_NOT_A_DIRECTORY;
+
+	if (!h->filtered) {
+		// Like VirtualBox, only the first call decides the pattern,
+		// which is the last component of the path.
+		h->filtered = true;
+		strcpy(h->pattern, "*");
+
+		if (path) {
+			const char *s = path->ach, *end = path->ach + path->u16Length;
+			const char *last = s;
+
+			for (; s < end; s++) {
+				if (*s == '\\' || *s == '/') last = s + 1;
+			}
+			if (last < end && end - last <= SHFL_MAX_LEN) {
+				memcpy(h->pattern, last, end - last);
+				h->pattern[end - last] = '\0';
+			}
+			if (strcmp(h->pattern, "*.*") == 0) strcpy(h->pattern, "*");
+		}
+	}
+
+	if (!h->dir) {
+		h->dir = opendir(h->path);
+		if (!h->dir) return errno_to_vbox(errno);
+	}
+
+	while ((ent = readdir(h->dir))) {
+		char entpath[PATH_MAX];
+		size_t len = strlen(ent->d_name);
+		struct stat st;
+
+		if (!matches_pattern(h->pattern, ent->d_name)) continue;
+		if (snprintf(entpath, sizeof(entpath), "%s/%s", h->path, ent->d_name) >= (int) sizeof(entpath)) continue;
+		if (lstat(entpath, &st) != 0) continue;
+
+		if (offsetof(SHFLDIRINFO, name.ach) + len + 1 > *size) {
+			return VERR_BUFFER_OVERFLOW;
+		}
+
+		fill_objinfo(&dirinfo->Info, &st, ent->d_name);
+		dirinfo->cucShortName = 0;
+		memset(dirinfo->uszShortName, 0, sizeof(dirinfo->uszShortName));
+		dirinfo->name.u16Size = len + 1;
+		dirinfo->name.u16Length = len;
+		memcpy(dirinfo->name.ach, ent->d_name, len + 1);
+
+		*size = offsetof(SHFLDIRINFO, name.ach) + len + 1;
+		*count = 1;
+		(*resume)++;
+
+		// We always return a single entry, as if SHFL_LIST_RETURN_ONE was set
+		(void) flags;
+		return VINF_SUCCESS;
+	}
+
+	*size = 0;
+
+	return VERR_NO_MORE_FILES;
+}
+
+static int32_t shfl_information(SHFLROOT root, SHFLHANDLE handle, uint32_t flags, uint32_t *size, void *buffer)
+{
+	HOSTHANDLE *h;
+	struct stat st;
+
+	if (root != HOST_ROOT) return VERR_INVALID_PARAMETER;
+
+	if (flags & SHFL_INFO_VOLUME) {
+		SHFLVOLINFO *info = buffer;
+		struct statvfs vfs;
+
+		if (*size < sizeof(SHFLVOLINFO)) return VERR_BUFFER_OVERFLOW;
+		if (statvfs(share_dir, &vfs) != 0) return errno_to_vbox(errno);
+
+		memset(info, 0, sizeof(*info));
+		info->ullTotalAllocationBytes = (uint64_t) vfs.f_blocks * vfs.f_frsize;
+		info->ullAvailableAllocationBytes = (uint64_t) vfs.f_bavail * vfs.f_frsize;
+		info->ulBytesPerAllocationUnit = vfs.f_bsize;
+		info->ulBytesPerSector = 512;
+		info->fsProperties.cbMaxComponent = NAME_MAX;
+		info->fsProperties.fCaseSensitive = true;
+		info->fsProperties.fSupportsUnicode = true;
+		*size = sizeof(SHFLVOLINFO);
+		return VINF_SUCCESS;
+	}
+
+	h = get_handle(root, handle);
+	if (!h) return VERR_INVALID_HANDLE;
+
+	if (flags & SHFL_INFO_SIZE) {
+		SHFLFSOBJINFO *info = buffer;
+
+		if (*size < sizeof(SHFLFSOBJINFO)) return VERR_BUFFER_OVERFLOW;
+		if (h->fd < 0) return VERR_IS_A_DIRECTORY;
+		if ((flags & SHFL_INFO_MODE_MASK) == SHFL_INFO_SET
+		        && ftruncate(h->fd, info->cbObject) != 0) {
+			return errno_to_vbox(errno);
+		}
+	} else if (flags & SHFL_INFO_FILE) {
+		SHFLFSOBJINFO *info = buffer;
+
+		if (*size < sizeof(SHFLFSOBJINFO)) return VERR_BUFFER_OVERFLOW;
+
+		if ((flags & SHFL_INFO_MODE_MASK) == SHFL_INFO_SET && info->ModificationTime) {
+			struct timespec times[2];
+
+			times[0].tv_sec = 0;
+			times[0].tv_nsec = UTIME_OMIT;
+			times[1].tv_sec = info->ModificationTime / 1000000000LL;
+			times[1].tv_nsec = info->ModificationTime % 1000000000LL;
+			if (utimensat(AT_FDCWD, h->path, times, 0) != 0) {
+				return errno_to_vbox(errno);
+			}
+		}
+	} else {
+		return VERR_INVALID_PARAMETER;
+	}
+
+	// Both get and set return the current information
+	if (stat(h->path, &st) != 0) return errno_to_vbox(errno);
+	fill_objinfo(buffer, &st, basename_of(h->path));
+	*size = sizeof(SHFLFSOBJINFO);
+
+	return VINF_SUCCESS;
+}
+
+static int32_t shfl_remove(SHFLROOT root, const SHFLSTRING *name, uint32_t flags)
+{
+	char path[PATH_MAX];
+	struct stat st;
+	int32_t err;
+
+	if (root != HOST_ROOT) return VERR_INVALID_PARAMETER;
+
+	err = resolve_path(name, path);
+	if (err) return err;
+
+	if (lstat(path, &st) != 0) return VERR_FILE_NOT_FOUND;
+
+	if (S_ISDIR(st.st_mode)) {
+		if (!(flags & SHFL_REMOVE_DIR)) return VERR_IS_A_DIRECTORY;
+		if (rmdir(path) != 0) return errno_to_vbox(errno);
+	} else {
+		if (!(flags & SHFL_REMOVE_FILE)) return VERR_NOT_A_DIRECTORY;
+		if (unlink(path) != 0) return errno_to_vbox(errno);
+	}
+
+	return VINF_SUCCESS;
+}
+
+static int32_t shfl_rename(SHFLROOT root, const SHFLSTRING *src, const SHFLSTRING *dst, uint32_t flags)
+{
+	char srcpath[PATH_MAX], dstpath[PATH_MAX];
+	struct stat srcst, dstst;
+	int32_t err;
+
+	if (root != HOST_ROOT) return VERR_INVALID_PARAMETER;
+
+	err = resolve_path(src, srcpath);
+	if (err) return err;
+	if (lstat(srcpath, &srcst) != 0) return VERR_FILE_NOT_FOUND;
+
+	err = resolve_path(dst, dstpath);
+	if (err) return err;
+
+	if (lstat(dstpath, &dstst) == 0) {
+		if (dstst.st_dev == srcst.st_dev && dstst.st_ino == srcst.st_ino) {
+			// Only changing the case of the name; use the new name as given
+			const char *name = dst->ach + dst->u16Length;
+			while (name > dst->ach && name[-1] != '\\' && name[-1] != '/') name--;
+			strcpy(strrchr(dstpath, '/') + 1, name);
+		} else if (!(flags & SHFL_RENAME_REPLACE_IF_EXISTS)) {
+			return VERR_ALREADY_EXISTS;
+		}
+	}
+
+	if (S_ISDIR(srcst.st_mode) ? !(flags & SHFL_RENAME_DIR) : !(flags & SHFL_RENAME_FILE)) {
+		return VERR_INVALID_PARAMETER;
+	}
+
+	if (rename(srcpath, dstpath) != 0) return errno_to_vbox(errno);
+
+	return VINF_SUCCESS;
+}
+
+static int32_t shfl_set_file_size(SHFLROOT root, SHFLHANDLE handle, uint64_t size)
+{
+	HOSTHANDLE *h = get_handle(root, handle);
+
+	if (!h) return VERR_INVALID_HANDLE;
+	if (h->fd < 0) return VERR_IS_A_DIRECTORY;
+	if (ftruncate(h->fd, size) != 0) return errno_to_vbox(errno);
+
+	return VINF_SUCCESS;
+}
+
+static int32_t set_shflstring(SHFLSTRING *str, uint32_t bufsize, const char *s)
+{
+	size_t len = strlen(s);
+
+	if (bufsize < sizeof(SHFLSTRING) || str->u16Size < len + 1
+	        || bufsize < sizeof(SHFLSTRING) + len + 1) {
+		return VERR_BUFFER_OVERFLOW;
+	}
+
+	memcpy(str->ach, s, len + 1);
+	str->u16Length = len;
+
+	return VINF_SUCCESS;
+}
+
+static uint32_t parm_u32(const VMMDevHGCMCall *req, unsigned arg)
+{
+	return req->aParms[arg].u.value32;
+}
+
+static uint64_t parm_u64(const VMMDevHGCMCall *req, unsigned arg)
+{
+	return req->aParms[arg].u.value64;
+}
+
+static uint32_t parm_size(const VMMDevHGCMCall *req, unsigned arg)
+{
+	return req->aParms[arg].u.LinAddr.cb;
+}
+
+static void *parm_ptr(const VMMDevHGCMCall *req, unsigned arg)
+{
+	if (!req->aParms[arg].u.LinAddr.cb) return NULL;
+	return host_linear_ptr(req->aParms[arg].u.LinAddr.uAddr);
+}
+
+/** Executes an HGCM call to the shared folders service.
+ *  @returns the result of the call (not of the request). */
+static int32_t shfl_call(VMMDevHGCMCall *req)
+{
+	uint32_t u32, u32b;
+	int32_t err;
+
+	switch (req->u32Function) {
+	case SHFL_FN_QUERY_MAPPINGS:
+		if (req->cParms != 3) return VERR_INVALID_PARAMETER;
+		if (parm_u32(req, 1) >= 1 && parm_size(req, 2) >= sizeof(SHFLMAPPING)) {
+			SHFLMAPPING *map = parm_ptr(req, 2);
+			map->u32Status = SHFL_MS_NEW;
+			map->root = HOST_ROOT;
+		}
+		req->aParms[1].u.value32 = 1;
+		return VINF_SUCCESS;
+
+	case SHFL_FN_QUERY_MAP_NAME:
+		if (req->cParms != 2) return VERR_INVALID_PARAMETER;
+		if (parm_u32(req, 0) != HOST_ROOT) return VERR_INVALID_PARAMETER;
+		return set_shflstring(parm_ptr(req, 1), parm_size(req, 1), share_name);
+
+	case SHFL_FN_MAP_FOLDER:
+		if (req->cParms != 4) return VERR_INVALID_PARAMETER;
+		{
+			const SHFLSTRING *name = parm_ptr(req, 0);
+			if (!name || name->u16Length != strlen(share_name)
+			        || strncasecmp(name->ach, share_name, name->u16Length) != 0) {
+				return VERR_FILE_NOT_FOUND;
+			}
+		}
+		req->aParms[1].u.value32 = HOST_ROOT;
+		return VINF_SUCCESS;
+
+	case SHFL_FN_UNMAP_FOLDER:
+	case SHFL_FN_SET_UTF8:
+		return VINF_SUCCESS;
+
+	case SHFL_FN_CREATE:
+		if (req->cParms != 3 || parm_size(req, 2) < sizeof(SHFLCREATEPARMS)) return VERR_INVALID_PARAMETER;
+		return shfl_create(parm_u32(req, 0), parm_ptr(req, 1), parm_ptr(req, 2));
+
+	case SHFL_FN_CLOSE:
+		if (req->cParms != 2) return VERR_INVALID_PARAMETER;
+		return shfl_close(parm_u32(req, 0), parm_u64(req, 1));
+
+	case SHFL_FN_READ:
+	case SHFL_FN_WRITE:
+		if (req->cParms != 5) return VERR_INVALID_PARAMETER;
+		u32 = MIN(parm_u32(req, 3), parm_size(req, 4));
+		err = shfl_read_write(req->u32Function == SHFL_FN_WRITE, parm_u32(req, 0), parm_u64(req, 1),
+		                      parm_u64(req, 2), &u32, parm_ptr(req, 4));
+		req->aParms[3].u.value32 = u32;
+		return err;
+
+	case SHFL_FN_LIST:
+		if (req->cParms != 8) return VERR_INVALID_PARAMETER;
+		u32 = MIN(parm_u32(req, 3), parm_size(req, 5));
+		u32b = parm_u32(req, 6);
+		err = shfl_list(parm_u32(req, 0), parm_u64(req, 1), parm_u32(req, 2), &u32,
+		                parm_ptr(req, 4), parm_ptr(req, 5), &u32b, &req->aParms[7].u.value32);
+		req->aParms[3].u.value32 = u32;
+		req->aParms[6].u.value32 = u32b;
+		return err;
+
+	case SHFL_FN_INFORMATION:
+		if (req->cParms != 5) return VERR_INVALID_PARAMETER;
+		u32 = MIN(parm_u32(req, 3), parm_size(req, 4));
+		err = shfl_information(parm_u32(req, 0), parm_u64(req, 1), parm_u32(req, 2), &u32, parm_ptr(req, 4));
+		req->aParms[3].u.value32 = u32;
+		return err;
+
+	case SHFL_FN_REMOVE:
+		if (req->cParms != 3) return VERR_INVALID_PARAMETER;
+		return shfl_remove(parm_u32(req, 0), parm_ptr(req, 1), parm_u32(req, 2));
+
+	case SHFL_FN_RENAME:
+		if (req->cParms != 4) return VERR_INVALID_PARAMETER;
+		return shfl_rename(parm_u32(req, 0), parm_ptr(req, 1), parm_ptr(req, 2), parm_u32(req, 3));
+
+	case SHFL_FN_FLUSH:
+		if (req->cParms != 2) return VERR_INVALID_PARAMETER;
+		return get_handle(parm_u32(req, 0), parm_u64(req, 1)) ? VINF_SUCCESS : VERR_INVALID_HANDLE;
+
+	case SHFL_FN_LOCK:
+		if (req->cParms != 5) return VERR_INVALID_PARAMETER;
+		return get_handle(parm_u32(req, 0), parm_u64(req, 1)) ? VINF_SUCCESS : VERR_INVALID_HANDLE;
+
+	case SHFL_FN_SET_FILE_SIZE:
+		if (req->cParms != 3) return VERR_INVALID_PARAMETER;
+		return shfl_set_file_size(parm_u32(req, 0), parm_u64(req, 1), parm_u64(req, 2));
+
+	default:
+		return VERR_NOT_IMPLEMENTED;
+	}
+}
+
+void host_vmmdev_request(uint32_t addr)
+{
+	VMMDevRequestHeader *hdr = host_linear_ptr(addr);
+
+	switch (hdr->requestType) {
+	case VMMDevReq_HGCMConnect:
+		{
+			VMMDevHGCMConnect *req = (VMMDevHGCMConnect *) hdr;
+			if (strcmp(req->loc.u.host.achName, "VBoxSharedFolders") == 0) {
+				req->u32ClientID = HOST_CLIENT_ID;
+				req->header.result = VINF_SUCCESS;
+			} else {
+				req->header.result = VERR_HGCM_SERVICE_NOT_FOUND;
+			}
+			req->header.fu32Flags |= VBOX_HGCM_REQ_DONE;
+			hdr->rc = VINF_SUCCESS;
+		}
+		break;
+
+	case VMMDevReq_HGCMDisconnect:
+		{
+			VMMDevHGCMDisconnect *req = (VMMDevHGCMDisconnect *) hdr;
+			req->header.result = VINF_SUCCESS;
+			req->header.fu32Flags |= VBOX_HGCM_REQ_DONE;
+			hdr->rc = VINF_SUCCESS;
+		}
+		break;
+
+	case VMMDevReq_HGCMCall32:
+		{
+			VMMDevHGCMCall *req = (VMMDevHGCMCall *) hdr;
+
+			transferred = 0;
+
+			if (req->u32ClientID != HOST_CLIENT_ID) {
+				req->header.result = VERR_HGCM_INVALID_CLIENT_ID;
+			} else {
+				req->header.result = shfl_call(req);
+			}
+			req->header.fu32Flags |= VBOX_HGCM_REQ_DONE;
+			hdr->rc = VINF_SUCCESS;
+
+			host_hgcm_calls++;
+			host_sim_time_ns += host_hgcm_latency_us * 1000ULL
+			                  + (uint64_t) transferred * host_transfer_us_per_kib * 1000ULL / 1024;
+		}
+		break;
+
+	default:
+		hdr->rc = VERR_NOT_IMPLEMENTED;
+		break;
+	}
+}
@@ -0,0 +1,50 @@
+/*
+ * VBSF - host test harness, fake VirtualBox shared folders service
+ * Copyright (C) 2022 Javier S. Pedro
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef HOSTSHFL_H
+#define HOSTSHFL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Simulated cost of each HGCM call, in microseconds. */
+extern uint32_t host_hgcm_latency_us;
+/** Simulated cost of transferring data to or from the host, in microseconds per KiB. */
+extern uint32_t host_transfer_us_per_kib;
+
+/** Simulated time spent in the host so far, in nanoseconds. */
+extern uint64_t host_sim_time_ns;
+/** Number of HGCM calls received so far. */
+extern uint32_t host_hgcm_calls;
+
+/** Shares the given local directory as the only mapping, named after it.
+ *  @returns false if it is not an accessible directory. */
+extern bool host_shfl_init(const char *dir);
+
+/** Name of the shared folder, as reported to the guest. */
+extern const char *host_shfl_share_name(void);
+
+/** Number of file and directory handles currently open in the fake host. */
+extern unsigned host_shfl_open_handles(void);
+
+/** Processes the VMMDev request at the given linear address, like writing
+ *  its address to the VMMDev request port does with VirtualBox. */
+extern void host_vmmdev_request(uint32_t addr);
+
+#endif // HOSTSHFL_H
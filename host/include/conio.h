@@ -0,0 +1,27 @@
+/*
+ * VBSF - host test harness, stand-in for Open Watcom's <conio.h>
+ * Copyright (C) 2022 Javier S. Pedro
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef HOST_CONIO_H
+#define HOST_CONIO_H
+
+// There are no IO ports on the host; only dlog.h uses these.
+static inline unsigned inp(unsigned port) { (void) port; return 0; }
+static inline unsigned outp(unsigned port, unsigned value) { (void) port; return value; }
+
+#endif // HOST_CONIO_H
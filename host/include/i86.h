@@ -0,0 +1,91 @@
+/*
+ * VBSF - host test harness, stand-in for Open Watcom's <i86.h>
+ * Copyright (C) 2022 Javier S. Pedro
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef HOST_I86_H
+#define HOST_I86_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/** Register frame of an interrupt handler, same layout as Open Watcom's. */
+union INTPACK {
+	struct {
+		uint16_t gs, fs, es, ds, di, si, bp, sp, bx, dx, cx, ax, ip, cs, flags;
+	} w;
+	struct {
+		uint16_t pad[8];
+		uint8_t bl, bh, dl, dh, cl, ch, al, ah;
+	} h;
+};
+
+#define INTR_CF 0x0001
+
+/** Size of the simulated real mode address space, including the HMA. */
+#define HOST_DOS_MEM_SIZE 0x110000UL
+
+/** The simulated real mode memory, where the harness puts the SDA, SFTs, etc.
+ *  The harness only places objects at segments which are multiples of 0x1000,
+ *  so that FP_OFF() of a pointer into it is the offset within its segment. */
+extern uint8_t host_dos_mem[HOST_DOS_MEM_SIZE];
+
+#define MK_FP(seg, off) ((void *) &host_dos_mem[((uint32_t)(seg) << 4) + (uint16_t)(off)])
+
+/** Returns the "linear address" of a pointer, as used in HGCM parameters.
+ *  Pointers into the simulated memory get their real mode linear address;
+ *  any other pointer (e.g. the resident data) is used as is, which requires
+ *  the harness to be linked below 4 GiB and above HOST_DOS_MEM_SIZE (-no-pie). */
+static inline uint32_t host_linear_addr(const volatile void *ptr)
+{
+	uintptr_t addr = (uintptr_t) ptr;
+
+	if (addr - (uintptr_t) host_dos_mem < HOST_DOS_MEM_SIZE) {
+		return addr - (uintptr_t) host_dos_mem;
+	} else if (addr < HOST_DOS_MEM_SIZE || addr > UINT32_MAX) {
+		abort();
+	}
+
+	return addr;
+}
+
+/** Inverse of host_linear_addr(). */
+static inline void *host_linear_ptr(uint32_t addr)
+{
+	if (addr < HOST_DOS_MEM_SIZE) {
+		return &host_dos_mem[addr];
+	} else {
+		return (void *) (uintptr_t) addr;
+	}
+}
+
+static inline uint32_t host_fp_seg(const volatile void *ptr)
+{
+	uint32_t addr = host_linear_addr(ptr);
+	return addr < HOST_DOS_MEM_SIZE ? (addr & ~0xFFFFUL) >> 4 : addr >> 4;
+}
+
+static inline uint16_t host_fp_off(const volatile void *ptr)
+{
+	uint32_t addr = host_linear_addr(ptr);
+	return addr < HOST_DOS_MEM_SIZE ? addr & 0xFFFF : addr & 0xF;
+}
+
+#define FP_SEG(p) host_fp_seg(p)
+#define FP_OFF(p) host_fp_off(p)
+
+#endif // HOST_I86_H
@@ -0,0 +1,1370 @@
+/*
+ * VBSF - host test harness, runs the resident part against a fake host
+ * Copyright (C) 2022 Javier S. Pedro
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// The resident part is built as part of this file, so that its static
+// functions and data can be reached from here.
+#include "../sftsr.c"
+
+#include "hostshfl.h"
+
+/** Drive letter the shared folder is mounted as. */
+#define DRIVE_LETTER 'X'
+
+/** Name of the scratch directory created in the drive being measured. */
+#define WORK_DIR "VBSFHOST.TMP"
+
+/** Size of the file used for the sequential and random tests. */
+#define TEST_FILE_SIZE (1024UL * 1024UL)
+
+/** Number of files in the generated directory for the find tests. */
+#define NUM_FIND_FILES 100
+
+/** Number of files with long names generated for the mangled names test. */
+#define NUM_MANGLED_FILES 20
+
+/** Number of iterations for the open/close, getattr and random read tests. */
+#define NUM_ITERATIONS 200
+
+/** Duration of a BIOS timer tick, in nanoseconds. */
+#define NS_PER_TICK 54925439ULL
+
+// Where each of the DOS structures lives in the simulated memory.
+#define SDA_SEG    0x1000
+#define CDS_SEG    0x2000
+#define SFT_SEG    0x3000
+#define IOBUF_SEG  0x4000
+#define NLS_SEG    0x5000
+#define TRACE_SEG  0x6000
+
+/** Number of SFTs available to the tests, and distance between them. */
+#define NUM_SFTS   16
+#define SFT_STRIDE 0x40
+
+/** Size of the capture buffer; the same limit as in the real driver. */
+#define TRACE_SIZE 0xFFF0U
+
+/** DOS buffer sizes for the sequential tests. 65535 is the largest a DOS call accepts. */
+static const unsigned seq_sizes[] = { 1, 16, 128, 512, 4096, 16384, 32768, 65535 };
+
+/** Characters which terminate a filename, as in the MS-DOS file char table. */
+static const char illegal_chars[] = ".\"/\\[]:|<>+=;,";
+
+/** What a find_t has for DOS: a copy of the SDB and the found entry. */
+typedef struct {
+	DOSSDB sdb;
+	DOSDIR found;
+	char name[8+1+3+1];
+} HOSTFIND;
+
+uint8_t host_dos_mem[HOST_DOS_MEM_SIZE];
+
+static const char *share_dir;
+static DOSSDA *sda;
+static uint8_t *iobuf;
+/** Contents we write, to check what we read back. */
+static uint8_t ref[0x10000];
+
+static bool print_stats;
+static unsigned failures;
+/** File where calls are being captured to, if any. */
+static const char *capture_file;
+
+// Capture files are read and written as is; check that the layout
+// matches the real target even though _Packed is ignored here.
+_Static_assert(sizeof(SFTRACEHEADER) == 16, "SFTRACEHEADER layout");
+_Static_assert(sizeof(SFTRACERECORD) == 16, "SFTRACERECORD layout");
+
+/** State of the measurement in progress. */
+static uint64_t start_time;
+static uint32_t start_hgcm_calls, start_host_calls;
+
+// Stand-ins for the Open Watcom inline assembly used by the resident part.
+
+static void vbox_send_request(uint16_t iobase, uint32_t addr)
+{
+	(void) iobase;
+	host_vmmdev_request(addr);
+}
+
+static inline uint16_t dos_sft_decref(DOSSFT __far *sft)
+{
+	// Same as int 2Fh/1208h: returns the old count, and the last reference
+	// leaves the SFT marked as 0xFFFF (in use) for the redirector to clean up.
+	uint16_t count = sft->num_handles;
+	sft->num_handles = count == 1 ? 0xFFFF : count - 1;
+	return count;
+}
+
+static uint16_t disk_bytes_to_clusters(uint64_t bytes)
+{
+	uint64_t clusters = bytes / BYTES_PER_CLUSTER;
+	return clusters > 0xFFFF ? 0xFFFF : clusters;
+}
+
+static inline __segment get_cs(void)
+{
+	return 0;
+}
+
+static inline __segment get_ds(void)
+{
+	return 0;
+}
+
+static LPTSRDATA int2f_get_tsr_data(void)
+{
+	return &data;
+}
+
+static void check(bool cond, const char *what, const char *name)
+{
+	if (!cond) {
+		fprintf(stderr, "FAIL: %s on %s\n", what, name);
+		failures++;
+	}
+}
+
+static void begin_measure(void)
+{
+	start_hgcm_calls = data.vb.hgcm_calls;
+	start_host_calls = host_hgcm_calls;
+	start_time = host_sim_time_ns;
+}
+
+/** Prints the result of a measurement as a CSV line. */
+static void end_measure(const char *test, unsigned long param, unsigned long ops, unsigned long bytes)
+{
+	uint64_t usecs = (host_sim_time_ns - start_time) / 1000;
+	uint32_t hgcm_calls = data.vb.hgcm_calls - start_hgcm_calls;
+
+	check(hgcm_calls == host_hgcm_calls - start_host_calls, "counting HGCM calls", test);
+
+	printf("%s,%lu,%lu,%lu,%llu,%u\n", test, param, ops, bytes,
+	       (unsigned long long) usecs, hgcm_calls);
+}
+
+/** Checks that the test did not leave anything open in the host. */
+static void check_no_leaks(const char *test)
+{
+	unsigned i;
+
+	check(host_shfl_open_handles() == 0, "leaking host handles", test);
+	for (i = 0; i < NUM_FILES; i++) {
+		check(data.files[i].root == SHFL_ROOT_NIL, "leaking openfiles", test);
+	}
+}
+
+/** Issues a redirector call, as DOS would do via int 2Fh.
+ *  @returns the DOS error code, or 0 on success. */
+static int redir_call(uint8_t fn, union INTPACK *r)
+{
+	// Keep the BDA tick count moving with the simulated time
+	*(uint16_t *) MK_FP(0x40, 0x6C) = host_sim_time_ns / NS_PER_TICK;
+
+	r->h.ah = 0x11;
+	r->h.al = fn;
+	r->w.flags = 0;
+
+	if (!handle_redirector_call(r)) {
+		fprintf(stderr, "FAIL: call %02X not handled\n", fn);
+		failures++;
+		return DOS_ERROR_INVALID_FUNCTION;
+	}
+
+	return r->w.flags & INTR_CF ? r->w.ax : 0;
+}
+
+/** Fills fn1 (or fn2) with the fully qualified name of a drive relative path,
+ *  like DOS does before calling the redirector. */
+static void set_fn(char *fn, const char *path)
+{
+	snprintf(fn, sizeof(sda->fn1), "%c:\\%s", DRIVE_LETTER, path);
+}
+
+static int redir_path_call(uint8_t fn, const char *path, union INTPACK *r)
+{
+	set_fn(sda->fn1, path);
+	return redir_call(fn, r);
+}
+
+/** @returns a free SFT, or NULL if all of them are in use. */
+static DOSSFT *sft_alloc(void)
+{
+	unsigned i;
+
+	// Offset 0 is never used, as in DOS every SFT block starts with a header;
+	// captures rely on this, as they use 0 for "no SFT".
+	for (i = 0; i < NUM_SFTS; i++) {
+		DOSSFT *sft = MK_FP(SFT_SEG, (i + 1) * SFT_STRIDE);
+		if (sft->num_handles == 0) {
+			memset(sft, 0, sizeof(DOSSFT));
+			return sft;
+		}
+	}
+
+	return NULL;
+}
+
+static void set_sft_regs(union INTPACK *r, DOSSFT *sft)
+{
+	r->w.es = FP_SEG(sft);
+	r->w.di = FP_OFF(sft);
+}
+
+/** Creates or opens a file; fn is DOS_FN_CREATE or DOS_FN_OPEN. */
+static DOSSFT *dos_open(uint8_t fn, const char *path, uint8_t mode)
+{
+	DOSSFT *sft = sft_alloc();
+	union INTPACK r = {0};
+
+	if (!sft) return NULL;
+
+	sda->open_mode = mode;
+	set_sft_regs(&r, sft);
+	if (redir_path_call(fn, path, &r) != 0) {
+		return NULL;
+	}
+
+	sft->num_handles = 1;
+	return sft;
+}
+
+static int dos_close(DOSSFT *sft)
+{
+	union INTPACK r = {0};
+
+	set_sft_regs(&r, sft);
+	return redir_call(DOS_FN_CLOSE, &r);
+}
+
+/** Reads or writes through the DTA, like DOS does with a user buffer.
+ *  @returns the number of bytes transferred, or -1 on error. */
+static long dos_read_write(uint8_t fn, DOSSFT *sft, void *buffer, unsigned size)
+{
+	union INTPACK r = {0};
+
+	sda->cur_dta = buffer;
+	set_sft_regs(&r, sft);
+	r.w.cx = size;
+	if (redir_call(fn, &r) != 0) {
+		return -1;
+	}
+
+	return r.w.cx;
+}
+
+static int dos_getattr(const char *path, union INTPACK *r)
+{
+	memset(r, 0, sizeof(*r));
+	return redir_path_call(DOS_FN_GET_FILE_ATTR, path, r);
+}
+
+static int dos_simple_path_call(uint8_t fn, const char *path)
+{
+	union INTPACK r = {0};
+	return redir_path_call(fn, path, &r);
+}
+
+static bool create_empty_file(const char *path)
+{
+	DOSSFT *sft = dos_open(DOS_FN_CREATE, path, OPENEX_MODE_WRITE);
+	if (!sft) return false;
+	return dos_close(sft) == 0;
+}
+
+/** Expands one part of an 8.3 pattern into its FCB form. */
+static const char *expand_fcb_part(char *dst, const char *src, unsigned len)
+{
+	unsigned i = 0;
+
+	for (; *src && *src != '.' && i < len; src++) {
+		if (*src == '*') {
+			while (i < len) dst[i++] = '?';
+		} else {
+			dst[i++] = toupper((unsigned char) *src);
+		}
+	}
+	while (i < len) dst[i++] = ' ';
+	while (*src && *src != '.') src++;
+
+	return src;
+}
+
+/** Converts an FCB style name back into NAME.EXT. */
+static void fcb_to_name(char *dst, const char *fcb)
+{
+	unsigned i;
+
+	for (i = 0; i < 8 && fcb[i] != ' '; i++) *dst++ = fcb[i];
+	if (fcb[8] != ' ') {
+		*dst++ = '.';
+		for (i = 8; i < 8+3 && fcb[i] != ' '; i++) *dst++ = fcb[i];
+	}
+	*dst = '\0';
+}
+
+static void save_find(HOSTFIND *find)
+{
+	find->sdb = sda->sdb;
+	find->found = sda->found_file;
+	fcb_to_name(find->name, find->found.filename);
+}
+
+/** FindFirst on dir with the given 8.3 pattern, like int 21h/4Eh. */
+static int dos_findfirst(const char *dir, const char *pattern, uint8_t attr, HOSTFIND *find)
+{
+	union INTPACK r = {0};
+	char expanded[8+1+3+1];
+	char path[sizeof(sda->fn1)];
+	int err;
+
+	pattern = expand_fcb_part((char *) sda->fcb_fn1, pattern, 8);
+	if (*pattern == '.') pattern++;
+	expand_fcb_part((char *) sda->fcb_fn1 + 8, pattern, 3);
+
+	// DOS passes the expanded pattern in fn1, too
+	fcb_to_name(expanded, (char *) sda->fcb_fn1);
+	snprintf(path, sizeof(path), "%s\\%s", dir, expanded);
+
+	sda->search_attr = attr;
+	err = redir_path_call(DOS_FN_FIND_FIRST, path, &r);
+	if (err == 0) save_find(find);
+
+	return err;
+}
+
+static int dos_findnext(HOSTFIND *find)
+{
+	union INTPACK r = {0};
+	int err;
+
+	// DOS restores the SDB from the caller's DTA
+	sda->sdb = find->sdb;
+	err = redir_call(DOS_FN_FIND_NEXT, &r);
+	if (err == 0) save_find(find);
+
+	return err;
+}
+
+static void fill_ref(void)
+{
+	unsigned i;
+
+	for (i = 0; i < sizeof(ref); i++) {
+		ref[i] = i * 31 + 7;
+	}
+}
+
+static bool test_seq_write(const char *path, unsigned size)
+{
+	unsigned long total = 0, ops = 0;
+	unsigned long limit = MIN(TEST_FILE_SIZE, size * 4096UL);
+	DOSSFT *sft = dos_open(DOS_FN_CREATE, path, OPENEX_MODE_WRITE);
+
+	if (!sft) {
+		check(false, "create", path);
+		return false;
+	}
+
+	memcpy(iobuf, ref, size);
+
+	begin_measure();
+	while (total < limit) {
+		long bytes = dos_read_write(DOS_FN_WRITE, sft, iobuf, size);
+		if (bytes != size) {
+			check(false, "write", path);
+			dos_close(sft);
+			return false;
+		}
+		total += bytes;
+		ops++;
+	}
+	end_measure("seqwrite", size, ops, total);
+
+	check(sft->f_size == total, "file size after write", path);
+	dos_close(sft);
+	return true;
+}
+
+static bool test_seq_read(const char *path, unsigned size)
+{
+	unsigned long total = 0, ops = 0;
+	DOSSFT *sft = dos_open(DOS_FN_OPEN, path, OPENEX_MODE_READ);
+	unsigned long expected;
+	long bytes;
+	bool same = true;
+
+	if (!sft) {
+		check(false, "open", path);
+		return false;
+	}
+
+	expected = sft->f_size;
+
+	begin_measure();
+	do {
+		bytes = dos_read_write(DOS_FN_READ, sft, iobuf, size);
+		if (bytes < 0) {
+			check(false, "read", path);
+			dos_close(sft);
+			return false;
+		}
+		same = same && memcmp(iobuf, ref, bytes) == 0;
+		total += bytes;
+		ops++;
+	} while (bytes == size);
+	end_measure("seqread", size, ops, total);
+
+	check(same, "contents read back", path);
+	check(total == expected, "bytes read back", path);
+
+	dos_close(sft);
+	return true;
+}
+
+static bool test_sequential(void)
+{
+	const char *path = WORK_DIR "\\SEQ.DAT";
+	unsigned i;
+
+	for (i = 0; i < sizeof(seq_sizes) / sizeof(seq_sizes[0]); i++) {
+		if (!test_seq_write(path, seq_sizes[i])) return false;
+		if (!test_seq_read(path, seq_sizes[i])) return false;
+	}
+
+	check(dos_simple_path_call(DOS_FN_DELETE, path) == 0, "delete", path);
+	check_no_leaks("seq");
+	return true;
+}
+
+static bool test_random_read(void)
+{
+	const char *path = WORK_DIR "\\RANDOM.DAT";
+	const unsigned size = 512;
+	const unsigned long num_blocks = TEST_FILE_SIZE / size;
+	unsigned long total = 0;
+	bool same = true;
+	DOSSFT *sft;
+	unsigned i;
+
+	sft = dos_open(DOS_FN_CREATE, path, OPENEX_MODE_WRITE);
+	if (!sft) {
+		check(false, "create", path);
+		return false;
+	}
+	memcpy(iobuf, ref, 32768U);
+	for (i = 0; i < TEST_FILE_SIZE / 32768U; i++) {
+		if (dos_read_write(DOS_FN_WRITE, sft, iobuf, 32768U) != 32768U) {
+			check(false, "write", path);
+			dos_close(sft);
+			return false;
+		}
+	}
+	dos_close(sft);
+
+	sft = dos_open(DOS_FN_OPEN, path, OPENEX_MODE_READ);
+	if (!sft) {
+		check(false, "open", path);
+		return false;
+	}
+
+	srand(1);
+	begin_measure();
+	for (i = 0; i < NUM_ITERATIONS; i++) {
+		unsigned long block = ((unsigned long)rand() % num_blocks);
+		long bytes;
+
+		// DOS handles seeks from the start without calling the redirector
+		sft->f_pos = block * size;
+
+		bytes = dos_read_write(DOS_FN_READ, sft, iobuf, size);
+		if (bytes != size) {
+			check(false, "read", path);
+			dos_close(sft);
+			return false;
+		}
+		same = same && memcmp(iobuf, &ref[(block * size) % 32768U], size) == 0;
+		total += bytes;
+	}
+	end_measure("randread", size, NUM_ITERATIONS, total);
+
+	check(same, "contents read back", path);
+
+	dos_close(sft);
+	check(dos_simple_path_call(DOS_FN_DELETE, path) == 0, "delete", path);
+	check_no_leaks("random");
+	return true;
+}
+
+static bool test_open_close(void)
+{
+	const char *path = WORK_DIR "\\OPEN.DAT";
+	unsigned i;
+
+	if (!create_empty_file(path)) {
+		check(false, "create", path);
+		return false;
+	}
+
+	begin_measure();
+	for (i = 0; i < NUM_ITERATIONS; i++) {
+		DOSSFT *sft = dos_open(DOS_FN_OPEN, path, OPENEX_MODE_READ);
+		if (!sft) {
+			check(false, "open", path);
+			return false;
+		}
+		dos_close(sft);
+	}
+	end_measure("openclose", 0, NUM_ITERATIONS, 0);
+
+	check(dos_simple_path_call(DOS_FN_DELETE, path) == 0, "delete", path);
+	check_no_leaks("open");
+	return true;
+}
+
+static bool test_getattr(void)
+{
+	const char *path = WORK_DIR "\\ATTR.DAT";
+	union INTPACK r;
+	unsigned i;
+
+	if (!create_empty_file(path)) {
+		check(false, "create", path);
+		return false;
+	}
+
+	begin_measure();
+	for (i = 0; i < NUM_ITERATIONS; i++) {
+		if (dos_getattr(path, &r) != 0) {
+			check(false, "getattr", path);
+			return false;
+		}
+	}
+	end_measure("getattr", 0, NUM_ITERATIONS, 0);
+
+	check(!(r.w.ax & _A_SUBDIR) && r.w.bx == 0 && r.w.di == 0, "attributes", path);
+
+	check(dos_simple_path_call(DOS_FN_DELETE, path) == 0, "delete", path);
+	check_no_leaks("getattr");
+	return true;
+}
+
+/** Counts the entries matching pattern in dir. */
+static unsigned long find_all(const char *dir, const char *pattern)
+{
+	HOSTFIND find;
+	unsigned long entries = 0;
+
+	if (dos_findfirst(dir, pattern, _A_NORMAL | _A_SUBDIR, &find) != 0) {
+		return 0;
+	}
+	do {
+		entries++;
+	} while (dos_findnext(&find) == 0);
+
+	return entries;
+}
+
+static bool test_find(void)
+{
+	const char *dir = WORK_DIR "\\FIND";
+	char path[100];
+	unsigned long entries;
+	unsigned i;
+
+	if (dos_simple_path_call(DOS_FN_MKDIR, dir) != 0) {
+		check(false, "mkdir", dir);
+		return false;
+	}
+
+	for (i = 0; i < NUM_FIND_FILES; i++) {
+		snprintf(path, sizeof(path), "%s\\F%07u.DAT", dir, i);
+		if (!create_empty_file(path)) {
+			check(false, "create", path);
+			return false;
+		}
+	}
+
+	begin_measure();
+	entries = find_all(dir, "*.*");
+	end_measure("find", NUM_FIND_FILES, entries, 0);
+
+	// All of the files, plus . and ..
+	check(entries == NUM_FIND_FILES + 2, "number of entries found", dir);
+	check(find_all(dir, "F000001?.DAT") == 10, "number of entries found with wildcards", dir);
+	check(find_all(dir, "F0000099.DAT") == 1, "finding a single file", dir);
+
+	for (i = 0; i < NUM_FIND_FILES; i++) {
+		snprintf(path, sizeof(path), "%s\\F%07u.DAT", dir, i);
+		dos_simple_path_call(DOS_FN_DELETE, path);
+	}
+	check(dos_simple_path_call(DOS_FN_RMDIR, dir) == 0, "rmdir", dir);
+
+	check_no_leaks("find");
+	return entries > 0;
+}
+
+/** Directory and file operations: mkdir, chdir, rename, delete, seek, etc. */
+static bool test_dirops(void)
+{
+	const char *dir = WORK_DIR "\\SUB";
+	const char *file = WORK_DIR "\\SUB\\A.TXT";
+	const char *renamed = WORK_DIR "\\SUB\\B.TXT";
+	unsigned long ops = 0;
+	union INTPACK r;
+	DOSSFT *sft;
+
+	begin_measure();
+
+	check(dos_simple_path_call(DOS_FN_MKDIR, dir) == 0, "mkdir", dir); ops++;
+	check(dos_simple_path_call(DOS_FN_CHDIR, dir) == 0, "chdir", dir); ops++;
+	check(dos_simple_path_call(DOS_FN_CHDIR, WORK_DIR "\\MISSING") == DOS_ERROR_PATH_NOT_FOUND,
+	      "chdir to a missing directory", dir); ops++;
+
+	sft = dos_open(DOS_FN_CREATE, file, OPENEX_MODE_WRITE); ops++;
+	if (!sft) {
+		check(false, "create", file);
+		return false;
+	}
+	check(dos_read_write(DOS_FN_WRITE, sft, ref, 100) == 100, "write", file); ops++;
+
+	memset(&r, 0, sizeof(r));
+	set_sft_regs(&r, sft);
+	check(redir_call(DOS_FN_SEEK_END, &r) == 0 && r.w.dx == 0 && r.w.ax == 100, "seek from end", file); ops++;
+
+	memset(&r, 0, sizeof(r));
+	set_sft_regs(&r, sft);
+	check(redir_call(DOS_FN_COMMIT, &r) == 0, "commit", file); ops++;
+
+	// Like int 21h/5701h, the new time is sent to the host on close
+	sft->f_time = (12 << 11) | (34 << 5) | (56 / 2);
+	sft->f_date = ((2020 - 1980) << 9) | (6 << 5) | 15;
+	sft->dev_info |= DOS_SFT_FLAG_TIME_SET;
+	check(dos_close(sft) == 0, "close", file); ops++;
+
+	check(dos_getattr(file, &r) == 0 && r.w.bx == 0 && r.w.di == 100, "getattr", file); ops++;
+	check(r.w.cx == ((12 << 11) | (34 << 5) | (56 / 2)) && r.w.dx == (((2020 - 1980) << 9) | (6 << 5) | 15),
+	      "modification time", file);
+
+	set_fn(sda->fn2, renamed);
+	check(dos_simple_path_call(DOS_FN_RENAME, file) == 0, "rename", file); ops++;
+	check(dos_getattr(file, &r) == DOS_ERROR_FILE_NOT_FOUND, "getattr after rename", file); ops++;
+	check(dos_getattr(renamed, &r) == 0 && r.w.di == 100, "getattr after rename", renamed); ops++;
+
+	check(dos_simple_path_call(DOS_FN_RMDIR, dir) != 0, "rmdir of a non-empty directory", dir); ops++;
+	check(dos_simple_path_call(DOS_FN_DELETE, renamed) == 0, "delete", renamed); ops++;
+	check(dos_simple_path_call(DOS_FN_RMDIR, dir) == 0, "rmdir", dir); ops++;
+
+	memset(&r, 0, sizeof(r));
+	check(redir_call(DOS_FN_GET_DISK_FREE, &r) == 0 && r.h.al == SECTORS_PER_CLUSTER
+	      && r.w.cx == BYTES_PER_SECTOR && r.w.bx != 0, "disk free", WORK_DIR); ops++;
+
+	end_measure("dirops", 0, ops, 0);
+
+	check_no_leaks("dirops");
+	return true;
+}
+
+/** Generates files with long names directly in the host, then opens
+ *  every mangled (i.e. containing '~') name that DOS sees for them. */
+static bool test_mangled(void)
+{
+	const char *dir = WORK_DIR "\\MANGLED";
+	char hostpath[PATH_MAX], path[120];
+	unsigned long ops = 0, checked = 0;
+	HOSTFIND find;
+	unsigned i;
+
+	if (dos_simple_path_call(DOS_FN_MKDIR, dir) != 0) {
+		check(false, "mkdir", dir);
+		return false;
+	}
+
+	for (i = 0; i < NUM_MANGLED_FILES; i++) {
+		FILE *f;
+		snprintf(hostpath, sizeof(hostpath), "%s/%s/MANGLED/Long file name %02u.text", share_dir, WORK_DIR, i);
+		f = fopen(hostpath, "w");
+		if (!f) {
+			check(false, "creating host file", hostpath);
+			return false;
+		}
+		fprintf(f, "Long file name %02u", i);
+		fclose(f);
+	}
+
+	begin_measure();
+	if (dos_findfirst(dir, "*.*", _A_NORMAL, &find) == 0) {
+		do {
+			DOSSFT *sft;
+			if (!strchr(find.name, '~')) continue;
+			snprintf(path, sizeof(path), "%s\\%s", dir, find.name);
+			sft = dos_open(DOS_FN_OPEN, path, OPENEX_MODE_READ);
+			if (!sft) {
+				check(false, "open", path);
+				return false;
+			}
+			dos_close(sft);
+			ops++;
+		} while (dos_findnext(&find) == 0);
+	}
+	end_measure("mangled", 0, ops, 0);
+
+	check(ops == NUM_MANGLED_FILES, "number of mangled names", dir);
+
+	// Now check that each mangled name really opens its own file
+	if (dos_findfirst(dir, "*.*", _A_NORMAL, &find) == 0) {
+		do {
+			char expected[32];
+			DOSSFT *sft;
+			long bytes;
+
+			if (!strchr(find.name, '~')) continue;
+			snprintf(path, sizeof(path), "%s\\%s", dir, find.name);
+			sft = dos_open(DOS_FN_OPEN, path, OPENEX_MODE_READ);
+			if (!sft) {
+				check(false, "open", path);
+				continue;
+			}
+			bytes = dos_read_write(DOS_FN_READ, sft, iobuf, 100);
+			dos_close(sft);
+
+			// The file names differ only in the number, which the mangled name
+			// cannot keep, so just check that we opened one of them.
+			snprintf(expected, sizeof(expected), "Long file name ");
+			check(bytes == strlen(expected) + 2 && memcmp(iobuf, expected, strlen(expected)) == 0,
+			      "contents of mangled file", path);
+			checked++;
+		} while (dos_findnext(&find) == 0);
+	}
+	check(checked == NUM_MANGLED_FILES, "reopening mangled names", dir);
+
+	for (i = 0; i < NUM_MANGLED_FILES; i++) {
+		snprintf(hostpath, sizeof(hostpath), "%s/%s/MANGLED/Long file name %02u.text", share_dir, WORK_DIR, i);
+		unlink(hostpath);
+	}
+	check(dos_simple_path_call(DOS_FN_RMDIR, dir) == 0, "rmdir", dir);
+
+	check_no_leaks("mangled");
+	return true;
+}
+
+/** Starts capturing the calls made by the tests, like 'vbsf trace start'. */
+static void capture_start(void)
+{
+	data.trace_seg = TRACE_SEG;
+	data.trace_size = TRACE_SIZE;
+	data.trace_len = 0;
+	data.trace_lost = 0;
+	data.tracing = true;
+}
+
+/** Adds a phase mark to the capture, like 'vbsf trace mark'. */
+static void capture_mark(void)
+{
+	SFTRACERECORD *rec;
+
+	if (!data.tracing) return;
+
+	if (data.trace_size - data.trace_len < sizeof(SFTRACERECORD)) {
+		data.trace_lost++;
+		return;
+	}
+
+	rec = MK_FP(data.trace_seg, data.trace_len);
+	memset(rec, 0, sizeof(SFTRACERECORD));
+	rec->fn = SFTRACE_FN_MARK;
+	rec->ticks = *(uint16_t *) MK_FP(0x40, 0x6C);
+	data.trace_len += sizeof(SFTRACERECORD);
+}
+
+/** Stops capturing and saves the capture, like 'vbsf trace stop'. */
+static bool capture_stop(const char *filename)
+{
+	SFTRACEHEADER hdr;
+	FILE *f;
+	bool ok;
+
+	data.tracing = false;
+
+	check(data.trace_lost == 0, "capture buffer too small for", filename);
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SFTRACE_MAGIC, sizeof(hdr.magic));
+	hdr.version = SFTRACE_VERSION;
+	hdr.size = data.trace_len;
+	hdr.lost = data.trace_lost;
+
+	f = fopen(filename, "wb");
+	if (!f) return false;
+	ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1
+	     && fwrite(MK_FP(data.trace_seg, 0), 1, data.trace_len, f) == data.trace_len;
+
+	return fclose(f) == 0 && ok;
+}
+
+typedef struct {
+	unsigned long calls, skipped, differed;
+	unsigned long captured_hgcm_calls;
+	unsigned long bytes;
+} REPLAYPHASE;
+
+/** Open files during a replay, indexed like the SFTs. */
+static struct {
+	/** Offset of the SFT in the capture, or 0 if this entry is free. */
+	uint16_t sft;
+	DOSSFT *hostsft;
+} replay_files[NUM_SFTS];
+
+static DOSSFT *find_replay_file(uint16_t sft)
+{
+	unsigned i;
+	for (i = 0; i < NUM_SFTS; i++) {
+		if (replay_files[i].sft == sft) {
+			return replay_files[i].hostsft;
+		}
+	}
+	return NULL;
+}
+
+static void forget_replay_file(uint16_t sft)
+{
+	unsigned i;
+	for (i = 0; i < NUM_SFTS; i++) {
+		if (replay_files[i].sft == sft) {
+			replay_files[i].sft = 0;
+			return;
+		}
+	}
+}
+
+static bool remember_replay_file(uint16_t sft, DOSSFT *hostsft)
+{
+	unsigned i;
+	for (i = 0; i < NUM_SFTS; i++) {
+		if (replay_files[i].sft == 0) {
+			replay_files[i].sft = sft;
+			replay_files[i].hostsft = hostsft;
+			return true;
+		}
+	}
+	return false;
+}
+
+/** Sets fn1 to a captured name, replacing its drive letter. */
+static void set_replay_fn(char *fn, const char *name)
+{
+	strcpy(fn, name);
+	if (fn[0]) fn[0] = DRIVE_LETTER;
+}
+
+/** Replays a single captured call, directly on the redirector as DOS would.
+ *  Unlike 'vbsf replay', this bypasses DOS and so also sets the file
+ *  position of reads and writes from the capture.
+ *  @returns false if the result differs from the captured one: a different
+ *           error code, or a different number of bytes read or written. */
+static bool replay_call(const SFTRACERECORD *rec, const char *fn1, const char *fn2, REPLAYPHASE *phase)
+{
+	static HOSTFIND find;
+	static bool find_valid = false;
+	unsigned captured_err = rec->flags & SFTRACE_FLAG_ERROR ? rec->result : 0;
+	union INTPACK r = {0};
+	DOSSFT *sft = NULL;
+	int err;
+
+	switch (rec->fn) {
+	case DOS_FN_READ:
+	case DOS_FN_WRITE:
+	case DOS_FN_CLOSE:
+	case DOS_FN_COMMIT:
+	case DOS_FN_SEEK_END:
+		sft = find_replay_file(rec->sft);
+		if (!sft) {
+			// We did not manage to replay the open of this file
+			phase->skipped++;
+			return true;
+		}
+		set_sft_regs(&r, sft);
+		break;
+	}
+
+	switch (rec->fn) {
+	case DOS_FN_CREATE:
+	case DOS_FN_OPEN:
+	case DOS_FN_OPEN_EX:
+		sft = sft_alloc();
+		if (!sft) {
+			phase->skipped++;
+			return true;
+		}
+		if (rec->fn == DOS_FN_OPEN_EX) {
+			sda->openex_act = rec->arg >> 8;
+			sda->openex_mode = rec->arg & 0xFF;
+		} else {
+			sda->open_mode = rec->arg & 0xFF;
+		}
+		set_sft_regs(&r, sft);
+		set_replay_fn(sda->fn1, fn1);
+		err = redir_call(rec->fn, &r);
+		if (err == 0) {
+			sft->num_handles = 1;
+			if (captured_err || !remember_replay_file(rec->sft, sft)) {
+				// Still replayed it, but do not keep the result
+				dos_close(sft);
+			}
+		}
+		break;
+	case DOS_FN_CLOSE:
+		forget_replay_file(rec->sft);
+		err = redir_call(DOS_FN_CLOSE, &r);
+		break;
+	case DOS_FN_READ:
+	case DOS_FN_WRITE:
+		sft->f_pos = rec->pos;
+		if (rec->fn == DOS_FN_WRITE) memcpy(iobuf, ref, rec->arg);
+		sda->cur_dta = iobuf;
+		r.w.cx = rec->arg;
+		err = redir_call(rec->fn, &r);
+		if (err == 0) {
+			phase->bytes += r.w.cx;
+			if (!captured_err && r.w.cx != rec->result) return false;
+		}
+		break;
+	case DOS_FN_COMMIT:
+	case DOS_FN_SEEK_END:
+		err = redir_call(rec->fn, &r);
+		break;
+	case DOS_FN_GET_FILE_ATTR:
+	case DOS_FN_DELETE:
+	case DOS_FN_MKDIR:
+	case DOS_FN_RMDIR:
+	case DOS_FN_CHDIR:
+		set_replay_fn(sda->fn1, fn1);
+		err = redir_call(rec->fn, &r);
+		break;
+	case DOS_FN_RENAME:
+		set_replay_fn(sda->fn1, fn1);
+		set_replay_fn(sda->fn2, fn2);
+		err = redir_call(rec->fn, &r);
+		break;
+	case DOS_FN_FIND_FIRST:
+	{
+		const char *pattern = strrchr(fn1, '\\');
+		pattern = expand_fcb_part((char *) sda->fcb_fn1, pattern ? pattern + 1 : fn1, 8);
+		if (*pattern == '.') pattern++;
+		expand_fcb_part((char *) sda->fcb_fn1 + 8, pattern, 3);
+		sda->search_attr = rec->arg;
+		set_replay_fn(sda->fn1, fn1);
+		err = redir_call(rec->fn, &r);
+		find_valid = err == 0;
+		if (find_valid) save_find(&find);
+		break;
+	}
+	case DOS_FN_FIND_NEXT:
+		if (!find_valid) {
+			phase->skipped++;
+			return true;
+		}
+		err = dos_findnext(&find);
+		find_valid = err == 0;
+		break;
+	case DOS_FN_GET_DISK_FREE:
+		err = redir_call(rec->fn, &r);
+		break;
+	default:
+		// Lock, set attributes, etc. are not captured with enough detail to replay them
+		phase->skipped++;
+		return true;
+	}
+
+	return (unsigned) err == captured_err;
+}
+
+static void print_replay_phase(unsigned num, const REPLAYPHASE *phase)
+{
+	char name[32];
+
+	end_measure("replay", num, phase->calls, phase->bytes);
+	printf("# phase %u: %lu skipped, %lu with a different result, %lu HGCM calls when captured\n",
+	       num, phase->skipped, phase->differed, phase->captured_hgcm_calls);
+
+	snprintf(name, sizeof(name), "phase %u", num);
+	check(phase->differed == 0, "replayed results", name);
+}
+
+/** Reads a filename from the capture.
+ *  @returns a pointer past it, or NULL if it does not fit in the capture. */
+static const uint8_t *get_replay_name(char *dst, const uint8_t *src, const uint8_t *end)
+{
+	unsigned len;
+
+	if (src >= end || src + 1 + src[0] > end) return NULL;
+
+	len = src[0];
+	memcpy(dst, src + 1, len);
+	dst[len] = '\0';
+
+	return src + 1 + len;
+}
+
+/** Replays a capture made with 'vbsf trace' (or -c) against the fake host,
+ *  printing one line per captured phase. */
+static bool replay(const char *filename)
+{
+	SFTRACEHEADER hdr;
+	uint8_t *buf;
+	const uint8_t *p, *end;
+	char fn1[sizeof(sda->fn1) + 1], fn2[sizeof(sda->fn2) + 1];
+	REPLAYPHASE phase;
+	unsigned phase_num = 1, i;
+	FILE *f;
+
+	f = fopen(filename, "rb");
+	if (!f) {
+		fprintf(stderr, "Cannot read capture from '%s'\n", filename);
+		return false;
+	}
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1
+	        || memcmp(hdr.magic, SFTRACE_MAGIC, sizeof(hdr.magic)) != 0
+	        || hdr.version != SFTRACE_VERSION) {
+		fprintf(stderr, "'%s' is not a valid capture file\n", filename);
+		fclose(f);
+		return false;
+	}
+
+	buf = malloc(hdr.size);
+	if (!buf || fread(buf, 1, hdr.size, f) != hdr.size) {
+		fprintf(stderr, "'%s' is not a valid capture file\n", filename);
+		free(buf);
+		fclose(f);
+		return false;
+	}
+	fclose(f);
+
+	if (hdr.lost) {
+		printf("# %u calls were lost during the capture\n", hdr.lost);
+	}
+
+	memset(replay_files, 0, sizeof(replay_files));
+	memset(&phase, 0, sizeof(phase));
+	begin_measure();
+
+	p = buf;
+	end = buf + hdr.size;
+	while (end - p >= (long) sizeof(SFTRACERECORD)) {
+		const SFTRACERECORD *rec = (const SFTRACERECORD *) p;
+
+		p += sizeof(SFTRACERECORD);
+		fn1[0] = fn2[0] = '\0';
+		if (rec->flags & SFTRACE_FLAG_FN1) p = get_replay_name(fn1, p, end);
+		if (p && rec->flags & SFTRACE_FLAG_FN2) p = get_replay_name(fn2, p, end);
+		if (!p) break; // Truncated capture
+
+		if (rec->fn == SFTRACE_FN_MARK) {
+			if (phase.calls) print_replay_phase(phase_num++, &phase);
+			memset(&phase, 0, sizeof(phase));
+			begin_measure();
+			continue;
+		}
+
+		phase.calls++;
+		if (!replay_call(rec, fn1, fn2, &phase)) phase.differed++;
+		phase.captured_hgcm_calls += rec->hgcm_calls;
+	}
+
+	if (phase.calls) print_replay_phase(phase_num, &phase);
+
+	// Close whatever the capture left open
+	for (i = 0; i < NUM_SFTS; i++) {
+		if (replay_files[i].sft) dos_close(replay_files[i].hostsft);
+	}
+
+	free(buf);
+	return true;
+}
+
+/** Runs one of the tests, as a separate phase of the capture if any. */
+static bool run_test(bool (*test)(void))
+{
+	capture_mark();
+	return test();
+}
+
+static void print_call_stats(void)
+{
+	unsigned fn;
+
+	puts("# fn,calls,hgcm_calls");
+	for (fn = 0; fn < NUM_STATS_FN; fn++) {
+		if (!data.stats[fn].calls) continue;
+		printf("# %02X,%u,%u\n", fn, data.stats[fn].calls, data.stats[fn].hgcm_calls);
+	}
+	printf("# bytes read: %u, bytes written: %u\n", data.bytes_read, data.bytes_written);
+}
+
+/** Sets up the simulated DOS structures, like DOS and VBSF's installer would. */
+static void setup_dos(void)
+{
+	DOSCDS *cds = MK_FP(CDS_SEG, 0);
+	uint8_t *upper_case = MK_FP(NLS_SEG, 0);
+	FCHAR *file_char = MK_FP(NLS_SEG, 0x100);
+	unsigned i;
+
+	sda = MK_FP(SDA_SEG, 0);
+	iobuf = MK_FP(IOBUF_SEG, 0);
+
+	snprintf(cds->curr_path, sizeof(cds->curr_path), "%c:\\", DRIVE_LETTER);
+	cds->flags = DOS_CDS_FLAG_NETWORK;
+	sda->drive_cds = cds;
+
+	// Plain ASCII upper casing; good enough for the names used here
+	for (i = 0; i < 128; i++) {
+		upper_case[i] = 0x80 + i;
+	}
+
+	file_char->size = offsetof(FCHAR, illegal) - sizeof(uint16_t) + strlen(illegal_chars);
+	file_char->unk1 = 1;
+	file_char->lowest = 0;
+	file_char->highest = 0xFF;
+	file_char->first_x = 0x00;
+	file_char->last_x = 0x20;
+	file_char->unk3 = 2;
+	file_char->n_illegal = strlen(illegal_chars);
+	memcpy((uint8_t *) file_char + offsetof(FCHAR, illegal), illegal_chars, strlen(illegal_chars));
+
+	data.dossda = sda;
+	data.file_upper_case = upper_case;
+	data.file_char = file_char;
+	data.tz_offset = 0;
+	data.short_fnames = false;
+	data.hash_chars = DEF_HASH_CHARS;
+	data.drive_bitmap = 0;
+
+	for (i = 0; i < NUM_DRIVES; i++) {
+		data.drives[i].root = SHFL_ROOT_NIL;
+		data.drives[i].case_insensitive = false;
+	}
+	for (i = 0; i < NUM_FILES; i++) {
+		data.files[i].root = SHFL_ROOT_NIL;
+		data.files[i].handle = SHFL_HANDLE_NIL;
+	}
+}
+
+/** Connects to the fake host and mounts its share, like 'vbsf mount' does. */
+static bool mount_share(bool ci)
+{
+	// Must be static, as it is handed to the host by address (see i86.h)
+	static SHFLSTRING_WITH_BUF(str, SHFL_MAX_LEN);
+	int drive = drive_letter_to_index(DRIVE_LETTER);
+	SHFLROOT root = SHFL_ROOT_NIL;
+	vboxerr err;
+
+	data.vb.iobase = 0;
+	data.vb.dds.regionSize = VBOX_BUFFER_SIZE;
+	data.vb.dds.physicalAddress = linear_addr(data.vb.buf);
+
+	err = vbox_hgcm_connect_existing(&data.vb, "VBoxSharedFolders", &data.hgcm_client_id);
+	if (err) {
+		fprintf(stderr, "Cannot connect to shared folder service, err=%d\n", err);
+		return false;
+	}
+
+	err = vbox_shfl_set_utf8(&data.vb, data.hgcm_client_id);
+	if (err) {
+		fprintf(stderr, "Cannot configure UTF-8 on shared folder service, err=%d\n", err);
+		return false;
+	}
+
+	shflstring_strcpy(&str.shflstr, host_shfl_share_name());
+
+	err = vbox_shfl_map_folder(&data.vb, data.hgcm_client_id, &str.shflstr, &root);
+	if (err) {
+		fprintf(stderr, "Cannot mount shared folder '%s', err=%d\n", host_shfl_share_name(), err);
+		return false;
+	}
+
+	data.drives[drive].root = root;
+	data.drives[drive].case_insensitive = ci;
+	data.drive_bitmap |= 1UL << drive;
+
+	return true;
+}
+
+static void print_help(void)
+{
+	puts("\nUsage:\n"
+	     "    vbsfhost [-l <USECS>] [-t <USECS>] [-i] [-s] [-c <FILE>] <DIR> [<TEST>..]\n"
+	     "    vbsfhost [-l <USECS>] [-t <USECS>] [-i] [-s] -r <FILE> <DIR>\n\n"
+	     "Runs VBSF's resident part against a fake shared folders host serving DIR,\n"
+	     "mounted as drive X:, and measures how many HGCM calls each test takes.\n"
+	     "Options:\n"
+	     "    -l <USECS>         simulated latency of each HGCM call (default 20)\n"
+	     "    -t <USECS>         simulated transfer cost per KiB read or written (default 1)\n"
+	     "    -i                 mount the drive as case insensitive\n"
+	     "    -s                 print per function call counters at the end\n"
+	     "    -c <FILE>          capture the calls made by the tests into FILE\n"
+	     "    -r <FILE>          replay a capture instead of running the tests\n"
+	     "Supported tests (all by default):\n"
+	     "    seq                sequential read & write with different buffer sizes\n"
+	     "    random             random 512 byte reads\n"
+	     "    open               open/close rate\n"
+	     "    getattr            get attributes rate\n"
+	     "    find               FindFirst/FindNext on a generated directory\n"
+	     "    dirops             mkdir, chdir, rename, delete, seek, etc.\n"
+	     "    mangled            open generated files with mangled names\n\n"
+	     "Output is CSV: test,param,ops,bytes,usecs,hgcm_calls\n"
+	     "where usecs is the simulated time spent in the host.\n"
+	     "A replay prints one 'replay' line per phase of the capture.\n"
+	     "Exits with an error if any of the checks made along the way fails,\n"
+	     "or if any replayed call has a different result than when captured.");
+}
+
+int main(int argc, const char *argv[])
+{
+	bool all = true, do_seq = false, do_random = false, do_open = false, do_getattr = false, do_find = false;
+	bool do_dirops = false, do_mangled = false, ci = false;
+	const char *replay_file = NULL;
+	char hostpath[PATH_MAX];
+	bool ok = true;
+	int argi = 1;
+
+	host_hgcm_latency_us = 20;
+	host_transfer_us_per_kib = 1;
+
+	for (; argi < argc && argv[argi][0] == '-'; argi++) {
+		if (strcmp(argv[argi], "-l") == 0 && argi + 1 < argc) {
+			host_hgcm_latency_us = atoi(argv[++argi]);
+		} else if (strcmp(argv[argi], "-t") == 0 && argi + 1 < argc) {
+			host_transfer_us_per_kib = atoi(argv[++argi]);
+		} else if (strcmp(argv[argi], "-i") == 0) {
+			ci = true;
+		} else if (strcmp(argv[argi], "-s") == 0) {
+			print_stats = true;
+		} else if (strcmp(argv[argi], "-c") == 0 && argi + 1 < argc) {
+			capture_file = argv[++argi];
+		} else if (strcmp(argv[argi], "-r") == 0 && argi + 1 < argc) {
+			replay_file = argv[++argi];
+		} else {
+			print_help();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (argi >= argc || (replay_file && (capture_file || argi + 1 < argc))) {
+		print_help();
+		return EXIT_FAILURE;
+	}
+
+	share_dir = argv[argi++];
+	if (!host_shfl_init(share_dir)) {
+		fprintf(stderr, "Cannot share '%s'\n", share_dir);
+		return EXIT_FAILURE;
+	}
+
+	for (; argi < argc; argi++) {
+		all = false;
+		if (strcasecmp(argv[argi], "seq") == 0) {
+			do_seq = true;
+		} else if (strcasecmp(argv[argi], "random") == 0) {
+			do_random = true;
+		} else if (strcasecmp(argv[argi], "open") == 0) {
+			do_open = true;
+		} else if (strcasecmp(argv[argi], "getattr") == 0) {
+			do_getattr = true;
+		} else if (strcasecmp(argv[argi], "find") == 0) {
+			do_find = true;
+		} else if (strcasecmp(argv[argi], "dirops") == 0) {
+			do_dirops = true;
+		} else if (strcasecmp(argv[argi], "mangled") == 0) {
+			do_mangled = true;
+		} else {
+			print_help();
+			return EXIT_FAILURE;
+		}
+	}
+
+	setup_dos();
+	fill_ref();
+
+	if (!mount_share(ci)) {
+		return EXIT_FAILURE;
+	}
+
+	if (replay_file) {
+		printf("# vbsfhost replay %s latency=%uus transfer=%uus/KiB\n", replay_file,
+		       host_hgcm_latency_us, host_transfer_us_per_kib);
+		puts("test,param,ops,bytes,usecs,hgcm_calls");
+
+		ok = replay(replay_file);
+		if (print_stats) print_call_stats();
+		check(host_shfl_open_handles() == 0, "leaking host handles", replay_file);
+
+		if (failures) {
+			fprintf(stderr, "%u check(s) failed\n", failures);
+		}
+
+		return ok && !failures ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (capture_file) capture_start();
+
+	if (dos_simple_path_call(DOS_FN_MKDIR, WORK_DIR) != 0) {
+		fprintf(stderr, "Cannot create %c:\\%s\n", DRIVE_LETTER, WORK_DIR);
+		return EXIT_FAILURE;
+	}
+
+	printf("# vbsfhost %s latency=%uus transfer=%uus/KiB\n", WORK_DIR,
+	       host_hgcm_latency_us, host_transfer_us_per_kib);
+	puts("test,param,ops,bytes,usecs,hgcm_calls");
+
+	if (ok && (all || do_seq)) ok = run_test(test_sequential);
+	if (ok && (all || do_random)) ok = run_test(test_random_read);
+	if (ok && (all || do_open)) ok = run_test(test_open_close);
+	if (ok && (all || do_getattr)) ok = run_test(test_getattr);
+	if (ok && (all || do_find)) ok = run_test(test_find);
+	if (ok && (all || do_dirops)) ok = run_test(test_dirops);
+	if (ok && (all || do_mangled)) ok = run_test(test_mangled);
+
+	if (print_stats) print_call_stats();
+
+	check(dos_simple_path_call(DOS_FN_RMDIR, WORK_DIR) == 0, "rmdir", WORK_DIR);
+
+	snprintf(hostpath, sizeof(hostpath), "%s/%s", share_dir, WORK_DIR);
+	check(access(hostpath, F_OK) != 0, "removing the work directory", hostpath);
+
+	if (capture_file && !capture_stop(capture_file)) {
+		fprintf(stderr, "Cannot write capture to '%s'\n", capture_file);
+		ok = false;
+	}
+
+	if (failures) {
+		fprintf(stderr, "%u check(s) failed\n", failures);
+	}
+
+	return ok && !failures ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,168 @@
+/*
+ * VBMouse - Programmable interval timer routines
+ * Copyright (C) 2022 Javier S. Pedro
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef INT08PIT_H
+#define INT08PIT_H
+
+#include <stdint.h>
+#include <conio.h>
+#include <i86.h>
+
+#include "pic8259.h"
+
+/** Input clock of the PIT, in Hz. */
+#define PIT_FREQUENCY 1193182UL
+
+enum pit_ports {
+	PIT_PORT_COUNTER0 = 0x40,
+	PIT_PORT_CONTROL  = 0x43,
+};
+
+enum pit_control {
+	PIT_CONTROL_COUNTER0     = 0 << 6,
+	PIT_CONTROL_LATCH        = 0 << 4,
+	PIT_CONTROL_ACCESS_LOHI  = 3 << 4,
+	PIT_CONTROL_MODE_RATE    = 2 << 1,
+	PIT_CONTROL_MODE_SQUARE  = 3 << 1,
+	/** 8254 read-back command: latch count and status of counter 0. */
+	PIT_CONTROL_READBACK_COUNTER0 = (3 << 6) | (1 << 1),
+};
+
+enum pit_status {
+	/** State of the counter output pin. */
+	PIT_STATUS_OUT           = 1 << 7,
+	PIT_STATUS_MODE_MASK     = 3 << 1,
+};
+
+/** Reads the current value of counter 0, which drives int 08h. */
+static uint16_t pit_read_counter0(void)
+{
+	uint8_t lo, hi;
+
+	outp(PIT_PORT_CONTROL, PIT_CONTROL_COUNTER0 | PIT_CONTROL_LATCH);
+	lo = inp(PIT_PORT_COUNTER0);
+	hi = inp(PIT_PORT_COUNTER0);
+
+	return (hi << 8) | lo;
+}
+
+static void pit_set_counter0_mode(uint8_t mode)
+{
+	_disable();
+	outp(PIT_PORT_CONTROL, PIT_CONTROL_COUNTER0 | PIT_CONTROL_ACCESS_LOHI | mode);
+	// Same period the BIOS uses (65536 clocks, 18.2 Hz)
+	outp(PIT_PORT_COUNTER0, 0);
+	outp(PIT_PORT_COUNTER0, 0);
+	_enable();
+}
+
+/** Returns the tick count to use along with a counter 0 reading,
+ *  counting a tick that the BIOS has not seen yet because IRQ0 is still
+ *  pending (e.g. interrupts are disabled, or we are in another interrupt handler).
+ *  Must be called right after reading the counter.
+ *  @param clocks PIT clocks elapsed in the current period, according to counter 0. */
+static inline uint16_t pit_adjust_ticks(uint16_t ticks, uint16_t clocks)
+{
+	// If the counter wrapped after we read it, the reading still belongs
+	// to the old period and will be near its end; if it wrapped before,
+	// it belongs to the new one and will be near its start.
+	if (clocks < 0x8000U && pic_is_pending(0)) {
+		ticks++;
+	}
+	return ticks;
+}
+
+/** Switches counter 0 to rate generator mode, keeping the BIOS period.
+ *  In this mode the counter decrements by one every clock (in the BIOS default
+ *  square wave mode it decrements by two, twice per period), which is
+ *  what pit_get_timestamp() expects. */
+static inline void pit_start_timing(void)
+{
+	pit_set_counter0_mode(PIT_CONTROL_MODE_RATE);
+}
+
+/** Restores the BIOS default square wave mode. */
+static inline void pit_stop_timing(void)
+{
+	pit_set_counter0_mode(PIT_CONTROL_MODE_SQUARE);
+}
+
+/** Returns a timestamp in PIT clocks (~0.838 usecs) by combining
+ *  the low word of the BIOS tick count with counter 0.
+ *  Only valid between pit_start_timing() and pit_stop_timing();
+ *  wraps around every hour or so. */
+static uint32_t pit_get_timestamp(void)
+{
+	volatile uint16_t __far *ticks = MK_FP(0x40, 0x6C);
+	uint16_t cur_ticks, adj_ticks, clocks;
+
+	do {
+		cur_ticks = *ticks;
+		// Counter counts down from 65536 (read as 0)
+		clocks = 0 - pit_read_counter0();
+		adj_ticks = pit_adjust_ticks(cur_ticks, clocks);
+		// If a tick happened while we were reading the counter, retry.
+	} while (cur_ticks != *ticks);
+
+	return ((uint32_t)adj_ticks << 16) | clocks;
+}
+
+/** Like pit_get_timestamp(), but also valid while counter 0 is in the
+ *  BIOS default square wave mode, so it can be used from resident code.
+ *  In that mode the counter runs twice per period decrementing by two,
+ *  and the output pin tells us which half of the period we are in.
+ *  Requires an 8254 (for the read-back command), which any AT has. */
+static uint32_t pit_get_timestamp_any_mode(void)
+{
+	volatile uint16_t __far *ticks = MK_FP(0x40, 0x6C);
+	uint16_t cur_ticks, adj_ticks, count, clocks;
+	uint8_t status, lo, hi;
+
+	do {
+		cur_ticks = *ticks;
+		outp(PIT_PORT_CONTROL, PIT_CONTROL_READBACK_COUNTER0);
+		status = inp(PIT_PORT_COUNTER0);
+		lo = inp(PIT_PORT_COUNTER0);
+		hi = inp(PIT_PORT_COUNTER0);
+
+		count = (hi << 8) | lo;
+
+		if ((status & PIT_STATUS_MODE_MASK) == PIT_CONTROL_MODE_SQUARE) {
+			clocks = (uint16_t)(0 - count) / 2;
+			if (!(status & PIT_STATUS_OUT)) {
+				clocks += 0x8000U; // Second half of the period
+			}
+		} else {
+			clocks = 0 - count;
+		}
+
+		adj_ticks = pit_adjust_ticks(cur_ticks, clocks);
+	} while (cur_ticks != *ticks);
+
+	return ((uint32_t)adj_ticks << 16) | clocks;
+}
+
+/** Converts an interval in PIT clocks to microseconds. */
+static inline uint32_t pit_clocks_to_usecs(uint32_t clocks)
+{
+	// Avoid 32-bit overflow: 1000000/1193182 ~= 3125/3728
+	return (clocks / 3728UL) * 3125UL + ((clocks % 3728UL) * 3125UL) / 3728UL;
+}
+
+#endif // INT08PIT_H
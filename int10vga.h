@@ -20,6 +20,7 @@
 #ifndef INT10_H
 #define INT10_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <conio.h>
 
@@ -48,16 +49,28 @@ static inline uint8_t bda_get_byte(unsigned int offset) {
 #define bda_get_cur_video_page()  bda_get_word(0x62)
 #define bda_get_last_row()        bda_get_byte(0x84)
 #define bda_get_char_height()     bda_get_word(0x85)
+#define bda_get_ega_info()        bda_get_byte(0x87)
 
 #define bda_get_tick_count()      bda_get_dword(0x6c)
 #define bda_get_tick_count_lo()   bda_get_word(0x6c)
 
+enum int10_functions {
+	INT10_SET_MODE      = 0x00,
+	INT10_LOAD_FONT     = 0x11,
+	INT10_VBE_GET_MODE_INFO = 0x4F01,
+	INT10_VBE_SET_MODE  = 0x4F02,
+	INT10_VBE_GET_MODE  = 0x4F03,
+	INT10_VBE_WINDOW    = 0x4F05,
+};
+
 enum videotype {
 	VIDEO_UNKNOWN,
 	VIDEO_TEXT,
 	VIDEO_CGA,
 	VIDEO_EGA,
-	VIDEO_VGA
+	VIDEO_VGA,
+	/** VESA BIOS extensions packed pixel/direct color mode, accessed through a window. */
+	VIDEO_VBE
 };
 
 struct modeinfo {
@@ -73,6 +86,11 @@ struct modeinfo {
 
 	/** Pointer to video memory. */
 	uint8_t __far * begin;
+
+	/** For VBE modes: granularity of the window position and size of the window, in KiB. */
+	uint16_t win_granularity, win_size;
+	/** For VBE modes: function that moves the window without going through int10, if any. */
+	void (__far *win_func)();
 };
 
 static void get_current_video_mode_info(struct modeinfo *info)
@@ -195,6 +213,153 @@ static void get_current_video_mode_info(struct modeinfo *info)
 	info->begin = MK_FP(segment, info->page * bda_get_video_page_size());
 }
 
+/** VBE mode number bits. */
+enum vbe_mode_bits {
+	VBE_MODE_NUMBER_MASK  = 0x1FF,
+	VBE_MODE_LINEAR       = 1 << 14,
+};
+
+enum vbe_mode_attributes {
+	VBE_MODE_ATTR_GRAPHICS  = 1 << 4,
+};
+
+enum vbe_window_attributes {
+	VBE_WIN_ATTR_SUPPORTED  = 1 << 0,
+	VBE_WIN_ATTR_READABLE   = 1 << 1,
+	VBE_WIN_ATTR_WRITABLE   = 1 << 2,
+};
+
+enum vbe_memory_models {
+	VBE_MEMORY_MODEL_PLANAR  = 3,
+	VBE_MEMORY_MODEL_PACKED  = 4,
+	VBE_MEMORY_MODEL_DIRECT  = 6,
+};
+
+/** Returned by INT10_VBE_GET_MODE_INFO. Only the fields we use; the BIOS writes up to 256 bytes. */
+struct vbe_mode_info {
+	uint16_t attributes;
+	uint8_t win_a_attributes, win_b_attributes;
+	uint16_t win_granularity;
+	uint16_t win_size;
+	uint16_t win_a_segment, win_b_segment;
+	void (__far *win_func)();
+	uint16_t bytes_per_line;
+	uint16_t x_resolution, y_resolution;
+	uint8_t x_char_size, y_char_size;
+	uint8_t num_planes;
+	uint8_t bits_per_pixel;
+	uint8_t num_banks;
+	uint8_t memory_model;
+	uint8_t bank_size;
+	uint8_t num_image_pages;
+	uint8_t reserved;
+};
+
+/** Size of the buffer the BIOS may fill for INT10_VBE_GET_MODE_INFO. */
+#define VBE_MODE_INFO_BUFFER_SIZE 256
+
+/** Returns the current VBE mode number, or 0xFFFF if there is no VBE. */
+static uint16_t vbe_get_current_mode(void);
+#pragma aux vbe_get_current_mode = \
+	"mov ax, 0x4F03" \
+	"int 0x10" \
+	"cmp ax, 0x004F" \
+	"je end" \
+	"mov bx, 0xFFFF" \
+	"end:" \
+	__value [bx] \
+	__modify [ax]
+
+static bool vbe_get_mode_info(uint16_t mode, void __far *buffer);
+#pragma aux vbe_get_mode_info = \
+	"mov ax, 0x4F01" \
+	"int 0x10" \
+	"cmp ax, 0x004F" \
+	"sete al" \
+	__parm [cx] [es di] \
+	__value [al] \
+	__modify [ax]
+
+/** Returns the current position of window A, in granularity units. */
+static uint16_t vbe_get_window(void);
+#pragma aux vbe_get_window = \
+	"mov ax, 0x4F05" \
+	"mov bx, 0x0100" /* Get window position (bh = 1) of window A (bl = 0) */ \
+	"int 0x10" \
+	__value [dx] \
+	__modify [ax bx]
+
+/** Moves window A to the given position (in granularity units). */
+static void vbe_set_window(uint16_t pos);
+#pragma aux vbe_set_window = \
+	"mov ax, 0x4F05" \
+	"xor bx, bx" /* Set window position (bh = 0) of window A (bl = 0) */ \
+	"int 0x10" \
+	__parm [dx] \
+	__modify [ax bx]
+
+/** Same as vbe_set_window, but calling the far function the BIOS gave us
+ *  in the mode information, which is much cheaper than int10. */
+static void vbe_call_window_func(void (__far * __far *func)(), uint16_t pos);
+#pragma aux vbe_call_window_func = \
+	"xor bx, bx" \
+	"call dword ptr es:[di]" \
+	__parm [es di] [dx] \
+	__modify [ax bx dx]
+
+/** If the current mode is a VBE graphics mode, fills info with its details
+ *  and returns true. Modes where we cannot draw (e.g. linear framebuffer) get type VIDEO_UNKNOWN
+ *  but still their true resolution.
+ *  @param buffer at least VBE_MODE_INFO_BUFFER_SIZE bytes for the BIOS to fill. */
+static bool get_current_vbe_mode_info(struct modeinfo *info, struct vbe_mode_info __far *buffer)
+{
+	const uint8_t win_rw = VBE_WIN_ATTR_SUPPORTED | VBE_WIN_ATTR_READABLE | VBE_WIN_ATTR_WRITABLE;
+	uint16_t mode = vbe_get_current_mode();
+
+	if (mode == 0xFFFF || (mode & VBE_MODE_NUMBER_MASK) < 0x100) {
+		return false; // No VBE or a standard VGA mode
+	}
+	if (!vbe_get_mode_info(mode & VBE_MODE_NUMBER_MASK, buffer)
+	        || !(buffer->attributes & VBE_MODE_ATTR_GRAPHICS)) {
+		return false; // Leave text modes to the BIOS data area
+	}
+
+	info->type = VIDEO_UNKNOWN;
+	info->page = 0;
+	info->pixels_width = buffer->x_resolution;
+	info->pixels_height = buffer->y_resolution;
+	info->bytes_per_line = buffer->bytes_per_line;
+	info->odd_scanline_offset = 0;
+	info->begin = MK_FP(buffer->win_a_segment, 0);
+	info->win_granularity = buffer->win_granularity;
+	info->win_size = buffer->win_size;
+	info->win_func = buffer->win_func;
+
+	if ((buffer->win_a_attributes & win_rw) != win_rw || (mode & VBE_MODE_LINEAR)
+	        || !buffer->win_granularity || buffer->win_size > 64 || !buffer->bytes_per_line) {
+		// We can only draw through window A, and only if it can be both read and written
+		return true;
+	}
+
+	if (buffer->memory_model == VBE_MEMORY_MODEL_PLANAR && buffer->bits_per_pixel == 4
+	        && buffer->y_resolution <= 0xFFFFU / buffer->bytes_per_line) {
+		// 16-color modes such as 800x600, which still fit in a single 64KiB plane,
+		// work like the standard VGA ones.
+		info->type = VIDEO_VGA;
+		info->bits_per_pixel = 1;
+		info->num_planes = 4;
+	} else if ((buffer->memory_model == VBE_MEMORY_MODEL_PACKED
+	                || buffer->memory_model == VBE_MEMORY_MODEL_DIRECT)
+	           && buffer->bits_per_pixel >= 8 && buffer->bits_per_pixel <= 32) {
+		info->type = VIDEO_VBE;
+		// 15bpp modes use 16 bits per pixel
+		info->bits_per_pixel = (buffer->bits_per_pixel + 7) & ~7;
+		info->num_planes = 1;
+	}
+
+	return true;
+}
+
 static inline uint16_t __far * get_video_char(const struct modeinfo *info, unsigned int x, unsigned int y)
 {
 	return (uint16_t __far *) (info->begin + (y * info->bytes_per_line) + (x * 2));
@@ -212,6 +377,24 @@ static inline uint8_t __far * get_video_scanline(const struct modeinfo *info, un
 	}
 }
 
+/** Given a pointer into scanline y, returns the same position in scanline y + 1.
+ *  Cheaper than calling get_video_scanline() for every scanline. */
+static inline uint8_t __far * get_next_video_scanline(const struct modeinfo *info,
+                                                      uint8_t __far *line, unsigned int y)
+{
+	if (info->odd_scanline_offset) {
+		// Even scanlines are followed by the same row in the odd bank,
+		// odd scanlines by the next row in the even bank.
+		if (y%2) {
+			return line - info->odd_scanline_offset + info->bytes_per_line;
+		} else {
+			return line + info->odd_scanline_offset;
+		}
+	} else {
+		return line + info->bytes_per_line;
+	}
+}
+
 enum vga_io_ports {
 	VGA_PORT_SC_ADDRESS = 0x3c4,
 	VGA_PORT_SC_DATA    = 0x3c5,
@@ -232,6 +415,16 @@ enum vga_gc_regs {
 	VGA_GC_REG_BIT_MASK = 8
 };
 
+enum vga_gc_data_rotate {
+	VGA_GC_FUNCTION_REPLACE = 0 << 3,
+	VGA_GC_FUNCTION_AND     = 1 << 3,
+	VGA_GC_FUNCTION_OR      = 2 << 3,
+	VGA_GC_FUNCTION_XOR     = 3 << 3,
+};
+
+/** Map mask that enables writes to all 4 planes. */
+#define VGA_SC_MAP_MASK_ALL 0xF
+
 struct videoregs {
 	uint8_t sc_reg;
 	uint8_t sc_map_mask;
@@ -302,6 +495,32 @@ static void vga_set_graphics_mode(struct videoregs __far *regs, unsigned read, u
 	}
 }
 
+/** Returns the amount of video memory of an EGA or VGA, in KiB, as recorded by the BIOS. */
+static inline unsigned vga_get_memory_size(void)
+{
+	return (((bda_get_ega_info() >> 5) & 3) + 1) * 64;
+}
+
+/** Copies count bytes of video memory one byte at a time.
+ *  In write mode 1 this copies all planes at once through the VGA latches. */
+static void vga_latch_copy(uint8_t __far *dst, const uint8_t __far *src, unsigned count);
+#pragma aux vga_latch_copy = \
+	"push ds" \
+	"mov ds, dx" \
+	"rep movsb" \
+	"pop ds" \
+	__parm [es di] [dx si] [cx] \
+	__modify [cx si di]
+
+/** Reads a byte of video memory to load the VGA latches, then writes val to it.
+ *  In write mode 0, the VGA combines val with the latches using the current function. */
+static void vga_latch_write(uint8_t __far *p, uint8_t val);
+#pragma aux vga_latch_write = \
+	"mov ah, es:[bx]" \
+	"mov es:[bx], al" \
+	__parm [es bx] [al] \
+	__modify [ah]
+
 static inline void vga_select_plane(unsigned plane)
 {
 	vga_gc_reg_write(VGA_GC_REG_READ_MAP, plane & 0x3);
@@ -0,0 +1,88 @@
+/*
+ * VBMouse - Routines to access extended memory through the BIOS
+ * Copyright (C) 2022 Javier S. Pedro
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef INT15MEM_H
+#define INT15MEM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/** Access rights of the source/destination descriptors: present, writable data. */
+#define INT15_DESC_ACCESS_DATA 0x93
+
+/** A protected mode segment descriptor, as used by the block move service. */
+struct int15_descriptor {
+	uint16_t limit;
+	uint16_t base_lo;
+	uint8_t  base_mid;
+	uint8_t  access;
+	uint8_t  limit_hi;
+	/** Bits 24-31 of the base; honored by any 386+ BIOS. */
+	uint8_t  base_hi;
+};
+
+/** The GDT passed to the block move service;
+ *  only the source and destination descriptors are filled by the caller. */
+struct int15_move_gdt {
+	struct int15_descriptor dummy;
+	struct int15_descriptor gdt;
+	struct int15_descriptor source;
+	struct int15_descriptor dest;
+	struct int15_descriptor bios_cs;
+	struct int15_descriptor bios_ss;
+};
+
+/** Copies words from one physical address to another.
+ *  The BIOS (or the memory manager, when running in V86 mode)
+ *  switches to protected mode for the duration of the copy,
+ *  with interrupts disabled.
+ *  @return 0 on success. */
+static uint8_t int15_move_block_raw(struct int15_move_gdt __far *gdt, uint16_t words);
+#pragma aux int15_move_block_raw = \
+	"mov ah, 0x87" \
+	"int 0x15" \
+	__parm [es si] [cx] \
+	__value [ah] \
+	__modify [ax]
+
+static void int15_set_descriptor(struct int15_descriptor __far *desc, uint32_t addr)
+{
+	desc->limit = 0xFFFF;
+	desc->base_lo = addr & 0xFFFF;
+	desc->base_mid = (addr >> 16) & 0xFF;
+	desc->access = INT15_DESC_ACCESS_DATA;
+	desc->limit_hi = 0;
+	desc->base_hi = addr >> 24;
+}
+
+/** Copies bytes (must be even) between two physical addresses,
+ *  any of which can be above 1MiB.
+ *  @param gdt scratch space for the descriptors.
+ *  @return true on success. */
+static bool int15_move_block(struct int15_move_gdt __far *gdt,
+                             uint32_t dest, uint32_t source, uint16_t bytes)
+{
+	_fmemset(gdt, 0, sizeof(struct int15_move_gdt));
+	int15_set_descriptor(&gdt->source, source);
+	int15_set_descriptor(&gdt->dest, dest);
+	return int15_move_block_raw(gdt, bytes / 2) == 0;
+}
+
+#endif // INT15MEM_H
@@ -41,6 +41,8 @@ enum ps2m_status {
 	PS2M_STATUS_BUTTON_1 = 1 << 0,
 	PS2M_STATUS_BUTTON_2 = 1 << 1,
 	PS2M_STATUS_BUTTON_3 = 1 << 2,
+	/** Always set in the first byte of a packet, used to resynchronize. */
+	PS2M_STATUS_ALWAYS_1 = 1 << 3,
 	PS2M_STATUS_X_NEG    = 1 << 4,
 	PS2M_STATUS_Y_NEG    = 1 << 5,
 	PS2M_STATUS_X_OVF    = 1 << 6,
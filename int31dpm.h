@@ -0,0 +1,87 @@
+/*
+ * VBMouse - DPMI services used by the Windows driver
+ * Copyright (C) 2022 Javier S. Pedro
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef INT31DPM_H
+#define INT31DPM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Real mode registers, as used by DPMI to call into real mode
+ *  and to pass them to real mode callbacks. */
+typedef _Packed struct dpmi_rm_regs {
+	uint32_t edi, esi, ebp, reserved, ebx, edx, ecx, eax;
+	uint16_t flags, es, ds, fs, gs, ip, cs, sp, ss;
+} dpmi_rm_regs;
+
+// Offsets for use from inline assembly, which does not support structs.
+#define DPMI_RM_REGS_ESI_OFFSET 0x04
+#define DPMI_RM_REGS_EBX_OFFSET 0x10
+#define DPMI_RM_REGS_EDX_OFFSET 0x14
+#define DPMI_RM_REGS_ECX_OFFSET 0x18
+#define DPMI_RM_REGS_EAX_OFFSET 0x1C
+#define DPMI_RM_REGS_IP_OFFSET  0x2A
+#define DPMI_RM_REGS_CS_OFFSET  0x2C
+#define DPMI_RM_REGS_SP_OFFSET  0x2E
+
+/** Calls a real mode interrupt handler with the given registers,
+ *  which are updated with the values on return.
+ *  If ss:sp are zero, the DPMI host provides a real mode stack.
+ *  @return true on success. */
+static bool dpmi_simulate_real_mode_interrupt(uint8_t intno, dpmi_rm_regs __far *regs);
+#pragma aux dpmi_simulate_real_mode_interrupt = \
+	"mov ax, 0x300" \
+	"xor bh, bh" \
+	"xor cx, cx"     /* Do not copy any words to the real mode stack */ \
+	"int 0x31" \
+	"setnc al" \
+	__parm [bl] [es di] \
+	__value [al] \
+	__modify [ax bx cx]
+
+/** Allocates a real mode address that, when called, switches to protected mode
+ *  and calls the given routine. The routine is called with interrupts disabled,
+ *  ds:si pointing to the real mode stack and es:di to the given register structure,
+ *  must update regs cs:ip (and sp) to return to the real mode caller,
+ *  and return with iret.
+ *  @return real mode segment:offset of the callback, or NULL on failure. */
+static void __far *dpmi_allocate_callback(void (__far *proc)(), dpmi_rm_regs __far *regs);
+#pragma aux dpmi_allocate_callback = \
+	"push ds" \
+	"mov ds, bx" \
+	"mov ax, 0x303" \
+	"int 0x31" \
+	"jnc end" \
+	"xor cx, cx" \
+	"xor dx, dx" \
+	"end:" \
+	"pop ds" \
+	__parm [bx si] [es di] \
+	__value [cx dx] \
+	__modify [ax cx dx]
+
+/** Frees a real mode callback address obtained with dpmi_allocate_callback. */
+static void dpmi_free_callback(void __far *callback);
+#pragma aux dpmi_free_callback = \
+	"mov ax, 0x304" \
+	"int 0x31" \
+	__parm [cx dx] \
+	__modify [ax]
+
+#endif /* INT31DPM_H */
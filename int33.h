@@ -86,6 +86,11 @@ enum INT33_API {
 	 *  @param cx horizontal speed, dx vertical speed */
 	INT33_SET_MOUSE_SPEED = 0xF,
 
+	/** Hides the cursor while it is over the given area ("conditional off"),
+	 *  until the next INT33_SHOW_CURSOR call.
+	 *  @param cx = left, dx = top, si = right, di = bottom. */
+	INT33_SET_EXCLUSION_AREA = 0x10,
+
 	/** If the mouse is moved more than this mickeys in one second,
 	 *  the mouse motion is doubled.
 	 *  @param cx doubling threshold (mickeys per second) */
@@ -146,6 +151,58 @@ enum INT33_API {
 	// Our internal API functions:
 	/** Obtains a pointer to the driver's data in es:di. */
 	INT33_GET_TSR_DATA = 0x73,
+	/** Gets events queued by the driver, as an alternative to an event handler.
+	 *  The first call starts queueing events (until the next reset).
+	 *  @param es:di buffer receiving struct int33_queued_event entries, oldest first
+	 *  @param cx maximum number of entries to copy
+	 *  @return cx number of entries copied, bx number of entries still queued,
+	 *          dx number of entries lost since the last call because the queue was full
+	 *          (motion-only entries are merged and dropped first). */
+	INT33_GET_QUEUED_EVENTS = 0x74,
+	/** Sets a handler that gets every mouse event straight from the device,
+	 *  before any scaling or int33 processing. It is called (far) with
+	 *  ax = events, only INT33_EVENT_MASK_MOVEMENT, _WHEEL_MOVEMENT and _ABSOLUTE,
+	 *  bx = current button status (higher byte is wheel movement),
+	 *  cx, dx = if absolute, position from 0 to 0xFFFF across the screen,
+	 *           otherwise motion in mickeys since the previous call,
+	 *  si = current INT33_HOST_CURSOR_STATUS bits.
+	 *  It is also called from the timer tick with ax = 0 when only
+	 *  the host cursor status changed.
+	 *  Button transitions are left for the handler to find out.
+	 *  Removed by a reset (ax=0 or ax=21h).
+	 *  @param es:dx address of the raw event handler, or NULL to remove it
+	 *  @param bx INT33_RAW_API_VERSION the caller expects
+	 *  @return ax INT33_RAW_API_MAGIC, bx INT33_RAW_API_VERSION of the driver;
+	 *          the handler is only set if it matches the caller's. */
+	INT33_SET_RAW_EVENT_HANDLER = 0x75,
+	/** Gets whether the host can draw the graphic cursor for us.
+	 *  @return ax INT33_RAW_API_MAGIC, bx INT33_HOST_CURSOR_STATUS bits. */
+	INT33_GET_HOST_CURSOR_STATUS = 0x76,
+};
+
+#define INT33_RAW_API_MAGIC   'VB'
+#define INT33_RAW_API_VERSION 2
+
+enum INT33_HOST_CURSOR_STATUS {
+	/** The host cursor is enabled (e.g. VirtualBox or VMware SVGA II, with hostcur). */
+	INT33_HOST_CURSOR_AVAILABLE = 1 << 0,
+	/** The host is drawing the cursor right now,
+	 *  i.e. it also supports the current video mode / mouse mode. */
+	INT33_HOST_CURSOR_ACTIVE    = 1 << 1,
+};
+
+/** Entries returned by INT33_GET_QUEUED_EVENTS. */
+struct int33_queued_event {
+	/** Low word of the BIOS tick count when the event happened. */
+	uint16_t ticks;
+	/** Bitfield of events (see INT33_EVENT_MASK), not filtered by the event mask. */
+	uint16_t events;
+	/** Button status as passed to event handlers (higher byte is wheel movement). */
+	uint16_t buttons;
+	/** Cursor position. */
+	int16_t x, y;
+	/** Total motion in mickeys, as passed to event handlers. */
+	int16_t delta_x, delta_y;
 };
 
 enum INT33_CAPABILITY_BITS {
@@ -198,6 +255,18 @@ static uint16_t int33_reset(void);
 	__value [ax] \
 	__modify [ax bx]
 
+static void int33_show_cursor(void);
+#pragma aux int33_show_cursor = \
+	"mov ax, 0x1" \
+	"int 0x33" \
+	__modify [ax]
+
+static void int33_hide_cursor(void);
+#pragma aux int33_hide_cursor = \
+	"mov ax, 0x2" \
+	"int 0x33" \
+	__modify [ax]
+
 static void int33_set_horizontal_window(int16_t min, int16_t max);
 #pragma aux int33_set_horizontal_window = \
 	"mov ax, 0x7" \
@@ -0,0 +1,53 @@
+/*
+ * VBMouse - 8042 keyboard controller routines
+ * Copyright (C) 2022 Javier S. Pedro
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef KBC8042_H
+#define KBC8042_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <conio.h>
+
+enum kbc_ports {
+	KBC_PORT_DATA   = 0x60,
+	KBC_PORT_STATUS = 0x64,
+};
+
+enum kbc_status {
+	/** There is a byte waiting to be read from the data port. */
+	KBC_STATUS_OUTPUT_FULL     = 1 << 0,
+	/** The byte in the output buffer comes from the auxiliary (mouse) device. */
+	KBC_STATUS_AUX_OUTPUT_FULL = 1 << 5,
+};
+
+/** Returns true and reads the pending byte if the controller
+ *  has a byte from the auxiliary (mouse) device in its output buffer. */
+static bool kbc_read_aux_byte(uint8_t __far *byte)
+{
+	const uint8_t mask = KBC_STATUS_OUTPUT_FULL | KBC_STATUS_AUX_OUTPUT_FULL;
+
+	if ((inp(KBC_PORT_STATUS) & mask) != mask) {
+		return false;
+	}
+
+	*byte = inp(KBC_PORT_DATA);
+	return true;
+}
+
+#endif // KBC8042_H
@@ -288,7 +288,8 @@ static inline char *find_real_name(
 		goto not_found;
 	}
 
-	*(uint16_t *)&shflstrlfn.shflstr.ach[shflstrlfn.shflstr.u16Length] = '*\\';
+	shflstrlfn.shflstr.ach[shflstrlfn.shflstr.u16Length] = '\\';
+	shflstrlfn.shflstr.ach[shflstrlfn.shflstr.u16Length + 1] = '*';
 	shflstrlfn.shflstr.u16Length += 2;
 	shflstrlfn.shflstr.ach[shflstrlfn.shflstr.u16Length] = '\0';
 
@@ -323,7 +324,7 @@ static inline char *find_real_name(
 			vbox_shfl_close(&data->vb, data->hgcm_client_id, root, parms.create.Handle);
 			return (char *)0;
 		}
-		d = _fstrcpy_local(dest, &shfldirinfo.dirinfo.name.ach);
+		d = _fstrcpy_local(dest, shfldirinfo.dirinfo.name.ach);
 
 		translate_filename_from_host(&shfldirinfo.dirinfo.name, false, true);
 		mangle_to_8_3_filename(hash, fcb_name, &shfldirinfo.dirinfo.name);
@@ -409,7 +410,7 @@ static uint16_t get_true_host_name_n(SHFLROOT root, TSRDATAPTR data, uint8_t *ds
 			goto return_name;
 		}
 
-		len = (uint16_t)(d - dst);
+		len = (uint16_t)(d - (char *)dst);
 
 		*d = '\0';
 
@@ -17,22 +17,71 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <i86.h>
 
 #include "dlog.h"
+#include "utils.h"
+#include "int08pit.h"
 #include "int15ps2.h"
 #include "int10vga.h"
 #include "int16kbd.h"
 #include "int2fwin.h"
 #include "int33.h"
+#include "kbc8042.h"
+#include "pic8259.h"
 #include "vbox.h"
 #include "vmware.h"
+#include "vmwsvga.h"
 #include "mousetsr.h"
+#include "mousvbox.h"
 
 #define MSB_MASK 0x8000U
 
+/** Offset inside each plane of the off-screen video memory used
+ *  to save the contents below the cursor when using the VGA latches. */
+#define LATCH_SAVE_AREA_OFFSET 0xFFC0U
+STATIC_ASSERT(0x10000UL - LATCH_SAVE_AREA_OFFSET >= 3 * GRAPHIC_CURSOR_HEIGHT);
+
+#if USE_VBE
+// reload_video_info() uses the pre-shifted masks as a buffer for the VBE mode info
+STATIC_ASSERT(GRAPHIC_CURSOR_SHIFTED_MASK_LEN >= VBE_MODE_INFO_BUFFER_SIZE);
+#endif
+
+#if USE_VMWSVGA
+/** What we need to build and send the cursor shape to the SVGA II FIFO. */
+struct vmwsvga_scratch {
+	struct int15_move_gdt gdt;
+	uint32_t cmd[VMWSVGA_DEFINE_CURSOR_CMD_LEN(GRAPHIC_CURSOR_HEIGHT)];
+};
+// load_cursor() and reload_video_info() use the pre-shifted masks as scratch space
+STATIC_ASSERT(GRAPHIC_CURSOR_SHIFTED_MASK_LEN >= sizeof(struct vmwsvga_scratch));
+#endif
+
+// Check the offsets used from assembly
+STATIC_ASSERT(offsetof(TSRDATA, prev_int10_handler) == TSRDATA_PREV_INT10_OFFSET);
+#if USE_PS2_DIRECT
+STATIC_ASSERT(offsetof(TSRDATA, prev_int15_handler) == TSRDATA_PREV_INT15_OFFSET);
+#endif
+#if USE_VBE
+STATIC_ASSERT(offsetof(TSRDATA, vbe_app_window) == TSRDATA_VBE_APP_WINDOW_OFFSET);
+#endif
+STATIC_ASSERT(offsetof(TSRDATA, defer) == TSRDATA_DEFER_OFFSET);
+STATIC_ASSERT(offsetof(TSRDATA, haswheel) == TSRDATA_HASWHEEL_OFFSET);
+STATIC_ASSERT(offsetof(TSRDATA, pos) == TSRDATA_POS_OFFSET);
+STATIC_ASSERT(offsetof(TSRDATA, delta) == TSRDATA_DELTA_OFFSET);
+STATIC_ASSERT(offsetof(TSRDATA, screen_granularity) == TSRDATA_GRANULARITY_OFFSET);
+STATIC_ASSERT(offsetof(TSRDATA, buttons) == TSRDATA_BUTTONS_OFFSET);
+STATIC_ASSERT(offsetof(TSRDATA, wheel_delta) == TSRDATA_WHEEL_DELTA_OFFSET);
+STATIC_ASSERT(offsetof(TSRDATA, button) == TSRDATA_BUTTON_OFFSET);
+STATIC_ASSERT(sizeof(((TSRDATA *)0)->button[0]) == TSRDATA_BUTTON_SIZE);
+
+// Windows 386 copies the instance data on every VM switch; keep it well below
+// the ~1.5 KiB it took while the 32bpp save-under buffer was part of it.
+STATIC_ASSERT(TSRDATA_INSTANCE_SIZE <= 1024);
+
 TSRDATA data;
 
 static const uint16_t default_cursor_graphic[] = {
@@ -136,7 +185,13 @@ static inline uint8_t * get_prev_graphic_cursor_scanline(unsigned bytes_per_line
                                                          unsigned plane,
                                                          unsigned y)
 {
-	return &data.cursor_prev_graphic[((plane * num_lines) + y) * bytes_per_line];
+	unsigned offset = ((plane * num_lines) + y) * bytes_per_line;
+#if USE_VBE
+	if (data.video_mode.bits_per_pixel > 8) {
+		return &data.cursor_prev_graphic_vbe[offset];
+	}
+#endif
+	return &data.cursor_prev_graphic[offset];
 }
 
 static inline uint16_t get_graphic_cursor_and_mask_line(unsigned y)
@@ -149,14 +204,33 @@ static inline uint16_t get_graphic_cursor_xor_mask_line(unsigned y)
 	return data.cursor_graphic[GRAPHIC_CURSOR_HEIGHT + y];
 }
 
+/** Number of pixels that start inside each byte, i.e. possible sub-byte alignments. */
+static inline unsigned get_pixels_per_byte(unsigned bits_per_pixel)
+{
+	return bits_per_pixel >= 8 ? 1 : 8 / bits_per_pixel;
+}
+
+/** Returns the offset of the byte containing pixel x inside a scanline (rounding down).
+ *  With 8 or more bits per pixel (always a multiple of 8), this avoids computing x * bits_per_pixel,
+ *  which would overflow 16 bits in wide high color modes. */
+static inline unsigned get_pixel_byte_offset(unsigned bits_per_pixel, unsigned x)
+{
+	if (bits_per_pixel >= 8) {
+		return x * (bits_per_pixel / 8);
+	} else {
+		return (x * bits_per_pixel) / 8;
+	}
+}
+
 /** Compute the total number of bytes between start and end pixels,
  *  rounding up as necessary to cover all bytes. */
 static inline unsigned get_scanline_segment_bytes(unsigned bits_per_pixel, unsigned start, unsigned size)
 {
 	// Get starting byte (round down)
-	unsigned start_byte = (start * bits_per_pixel) / 8;
+	unsigned start_byte = get_pixel_byte_offset(bits_per_pixel, start);
 	// Get end byte (round up)
-	unsigned end_byte = (((start + size) * bits_per_pixel) + (8-1)) / 8;
+	unsigned end_byte = get_pixel_byte_offset(bits_per_pixel,
+	                                          start + size + get_pixels_per_byte(bits_per_pixel) - 1);
 
 	return end_byte - start_byte;
 }
@@ -170,6 +244,112 @@ static inline uint8_t build_pixel_mask(unsigned bits_per_pixel)
 	else                          return 0xFF;
 }
 
+/** Number of bytes in each scanline of the pre-shifted cursor masks,
+ *  enough to fit the cursor starting at any pixel inside a byte. */
+static inline unsigned get_shifted_mask_scanline_bytes(unsigned bits_per_pixel)
+{
+	const unsigned pixels_per_byte = get_pixels_per_byte(bits_per_pixel);
+	return (((GRAPHIC_CURSOR_WIDTH + pixels_per_byte - 1) * bits_per_pixel) + (8-1)) / 8;
+}
+
+/** Expands the graphic cursor masks to the given bits per pixel,
+ *  once for each possible sub-byte alignment of the cursor,
+ *  so that drawing it is just a matter of AND/XORing whole bytes. */
+static void build_shifted_cursor_masks(unsigned bits_per_pixel)
+{
+	const unsigned pixels_per_byte = get_pixels_per_byte(bits_per_pixel);
+	const unsigned bytes_per_pixel = bits_per_pixel >= 8 ? bits_per_pixel / 8 : 1;
+	const unsigned mask_bytes = get_shifted_mask_scanline_bytes(bits_per_pixel);
+	const uint8_t msb_pixel_mask = build_pixel_mask(bits_per_pixel);
+	// In 8bpp (palette) modes, use 0x0F as "white pixel";
+	// in direct color modes, all bits set is already white.
+	const uint8_t xor_color = bits_per_pixel == 8 ? 0x0F : 0xFF;
+	uint8_t *and_mask = data.cursor_shifted_and_mask;
+	uint8_t *xor_mask = data.cursor_shifted_xor_mask;
+	unsigned align, y, x, b;
+
+	for (align = 0; align < pixels_per_byte; align++) {
+		for (y = 0; y < GRAPHIC_CURSOR_HEIGHT; y++) {
+			uint16_t cursor_and_mask = get_graphic_cursor_and_mask_line(y);
+			uint16_t cursor_xor_mask = get_graphic_cursor_xor_mask_line(y);
+
+			// Pixels not covered by the cursor are left unchanged
+			memset(and_mask, 0xFF, mask_bytes);
+			memset(xor_mask, 0, mask_bytes);
+
+			for (x = 0; x < GRAPHIC_CURSOR_WIDTH; x++) {
+				unsigned bit = (align + x) * bits_per_pixel;
+				uint8_t pixel_mask = msb_pixel_mask >> (bit % 8);
+
+				// The MSBs of each mask correspond to the current pixel
+				for (b = 0; b < bytes_per_pixel; b++) {
+					if (!(cursor_and_mask & MSB_MASK)) {
+						and_mask[bit / 8 + b] &= ~pixel_mask;
+					}
+					if (cursor_xor_mask & MSB_MASK) {
+						xor_mask[bit / 8 + b] |= pixel_mask & xor_color;
+					}
+				}
+
+				cursor_and_mask <<= 1;
+				cursor_xor_mask <<= 1;
+			}
+
+			and_mask += mask_bytes;
+			xor_mask += mask_bytes;
+		}
+	}
+
+	data.cursor_shifted_id = data.cursor_shape_id;
+}
+
+/** @returns a new id, unique among all VMs, from cursor_shape_serial. */
+static uint16_t new_cursor_serial(void)
+{
+	if (++data.cursor_shape_serial == 0) {
+		data.cursor_shape_serial = 1; // 0 is reserved for stale masks
+	}
+	return data.cursor_shape_serial;
+}
+
+/** Gives this VM's cursor a new cursor_shape_id after its shape or the video mode changed,
+ *  so that the shifted masks are rebuilt before drawing it. */
+static void new_cursor_shape_id(void)
+{
+	data.cursor_shape_id = new_cursor_serial();
+}
+
+/** Builds the shifted masks, unless they are already those of this VM's current cursor. */
+static inline void update_shifted_cursor_masks(unsigned bits_per_pixel)
+{
+	if (!data.cursor_shape_id) {
+		new_cursor_shape_id(); // Never had one (e.g. right after install)
+	}
+	if (data.cursor_shifted_id != data.cursor_shape_id) {
+		// Cursor shape or video mode changed since we last built the masks,
+		// or another VM used them
+		build_shifted_cursor_masks(bits_per_pixel);
+	}
+}
+
+/** Returns the offset into the pre-shifted cursor masks of the first byte
+ *  to draw at the top left corner of the given cursor area. */
+static unsigned get_shifted_mask_offset(const struct point __far *start,
+                                        const struct point __far *offset)
+{
+	const unsigned bits_per_pixel = data.video_mode.bits_per_pixel;
+	const unsigned pixels_per_byte = get_pixels_per_byte(bits_per_pixel);
+	// Pixel inside the first byte where the (unclipped) cursor starts.
+	// start.x - offset.x is negative if the cursor is clipped at the left,
+	// but pixels_per_byte is a power of two so this still works.
+	unsigned align = (start->x - offset->x) & (pixels_per_byte - 1);
+	// Mask bytes that fall to the left of the screen.
+	unsigned skip_bytes = ((align + offset->x) * bits_per_pixel) / 8;
+
+	return ((align * GRAPHIC_CURSOR_HEIGHT) + offset->y)
+	        * get_shifted_mask_scanline_bytes(bits_per_pixel) + skip_bytes;
+}
+
 /** Hides the graphical mouse cursor, by restoring the contents of
  *  data.cursor_prev_graphic (i.e. what was below the cursor before we drew it)
  *  to video memory. */
@@ -190,16 +370,19 @@ static void hide_graphic_cursor(void)
 	                                                   start.x, size.x);
 
 	for (plane = 0; plane < info->num_planes; plane++) {
+		uint8_t __far *line = get_video_scanline(info, start.y)
+		                      + (start.x * info->bits_per_pixel) / 8;
+
 		if (info->num_planes > 1) vga_select_plane(plane);
 
 		for (y = 0; y < size.y; y++) {
-			uint8_t __far *line = get_video_scanline(info, start.y + y)
-			                      + (start.x * info->bits_per_pixel) / 8;
 			uint8_t *prev = get_prev_graphic_cursor_scanline(cursor_bytes_per_line, size.y,
 			                                                 plane, y);
 
 			// Restore this scaline from cursor_prev
 			_fmemcpy(line, prev, cursor_bytes_per_line);
+
+			line = get_next_video_scanline(info, line, start.y + y);
 		}
 	}
 
@@ -213,8 +396,8 @@ static void show_graphic_cursor(void)
 {
 	const struct modeinfo *info = &data.video_mode;
 	struct point start, size, offset;
-	unsigned cursor_bytes_per_line;
-	const uint8_t msb_pixel_mask = build_pixel_mask(info->bits_per_pixel);
+	unsigned cursor_bytes_per_line, mask_bytes_per_line;
+	const uint8_t *and_mask, *xor_mask;
 	unsigned plane, y;
 
 	// Compute the area where the cursor is supposed to be drawn
@@ -222,119 +405,447 @@ static void show_graphic_cursor(void)
 		return;
 	}
 
+	update_shifted_cursor_masks(info->bits_per_pixel);
+
 	// For each scanline, we will copy this amount of bytes
 	cursor_bytes_per_line = get_scanline_segment_bytes(info->bits_per_pixel,
 	                                                   start.x, size.x);
+	mask_bytes_per_line = get_shifted_mask_scanline_bytes(info->bits_per_pixel);
 
 	for (plane = 0; plane < info->num_planes; plane++) {
+		uint8_t __far *line = get_video_scanline(info, start.y)
+		                      + (start.x * info->bits_per_pixel) / 8;
+
+		and_mask = &data.cursor_shifted_and_mask[get_shifted_mask_offset(&start, &offset)];
+		xor_mask = &data.cursor_shifted_xor_mask[get_shifted_mask_offset(&start, &offset)];
+
 		if (info->num_planes > 1) vga_select_plane(plane);
 
 		for (y = 0; y < size.y; y++) {
-			uint8_t __far *line = get_video_scanline(info, start.y + y)
-			                      + (start.x * info->bits_per_pixel) / 8;
 			uint8_t *prev = get_prev_graphic_cursor_scanline(cursor_bytes_per_line, size.y,
 			                                                 plane, y);
-			uint16_t cursor_and_mask = get_graphic_cursor_and_mask_line(offset.y + y)
-			                           << offset.x;
-			uint16_t cursor_xor_mask = get_graphic_cursor_xor_mask_line(offset.y + y)
-			                           << offset.x;
-			unsigned x;
+			unsigned i;
 
 			// First, backup this scanline to prev before any changes
 			_fmemcpy(prev, line, cursor_bytes_per_line);
 
-			if (info->bits_per_pixel < 8) {
-				uint8_t pixel_mask = msb_pixel_mask;
-				uint8_t pixel = *line;
+			for (i = 0; i < cursor_bytes_per_line; i++) {
+				line[i] = (line[i] & and_mask[i]) ^ xor_mask[i];
+			}
 
-				// when start.x is not pixel aligned,
-				// scaline points the previous multiple of pixels_per_byte;
-				// and the initial pixel will not be at the MSB of it.
-				// advance the pixel_mask accordingly
-				pixel_mask >>= (start.x * info->bits_per_pixel) % 8;
+			line = get_next_video_scanline(info, line, start.y + y);
+			and_mask += mask_bytes_per_line;
+			xor_mask += mask_bytes_per_line;
+		}
+	}
 
-				for (x = 0; x < size.x; x++) {
-					// The MSBs of each mask correspond to the current pixel
-					if (!(cursor_and_mask & MSB_MASK)) {
-						pixel &= ~pixel_mask;
-					}
-					if (cursor_xor_mask & MSB_MASK) {
-						pixel ^= pixel_mask;
-					}
+	data.cursor_pos = data.pos;
+	data.cursor_visible = true;
+}
 
-					// Advance to the next pixel
-					pixel_mask >>= info->bits_per_pixel;
-					if (!pixel_mask) {
-						// Time to advance to the next byte
-						*line = pixel; // Save current byte first
-						pixel = *(++line);
-						pixel_mask = msb_pixel_mask;
-					}
+/** Returns the off-screen video memory where we save the contents below the cursor
+ *  when using the VGA latches. None of the planar modes use the last bytes of
+ *  the last page of each 64KiB plane, as long as the card has 256KiB. */
+static inline uint8_t __far * get_latch_save_area(void)
+{
+	return MK_FP(FP_SEG(data.video_mode.begin), LATCH_SAVE_AREA_OFFSET);
+}
 
-					// Advance to the next bit in the cursor mask
-					cursor_and_mask <<= 1;
-					cursor_xor_mask <<= 1;
-				}
+/** Copies the cursor area from src to dst on all planes at once.
+ *  Reading a byte loads all 4 planes into the VGA latches,
+ *  and writing any byte in write mode 1 stores the latches back. */
+static void copy_graphic_cursor_latches(const struct point __far *start,
+                                        const struct point __far *size,
+                                        unsigned bytes_per_line,
+                                        bool to_screen)
+{
+	const struct modeinfo *info = &data.video_mode;
+	uint8_t __far *line = get_video_scanline(info, start->y)
+	                      + (start->x * info->bits_per_pixel) / 8;
+	uint8_t __far *save = get_latch_save_area();
+	unsigned y;
+
+	for (y = 0; y < size->y; y++) {
+		if (to_screen) {
+			vga_latch_copy(line, save, bytes_per_line);
+		} else {
+			vga_latch_copy(save, line, bytes_per_line);
+		}
 
-				if (pixel_mask != msb_pixel_mask) {
-					// We ended up in the middle of a byte, save it
-					*line = pixel;
-				}
-			} else if (info->bits_per_pixel == 8) {
-				// Simplified version for byte-aligned pixels
-				for (x = 0; x < size.x; x++) {
-					uint8_t pixel = 0;
+		line = get_next_video_scanline(info, line, start->y + y);
+		save += bytes_per_line;
+	}
+}
 
-					if (cursor_and_mask & MSB_MASK) {
-						pixel = *line;
-					}
-					if (cursor_xor_mask & MSB_MASK) {
-						pixel ^= 0x0F; // Use 0x0F as "white pixel"
-					}
+/** Like hide_graphic_cursor(), but for planar modes when using the VGA latches. */
+static void hide_graphic_cursor_latches(struct videoregs __far *regs)
+{
+	struct point start, size, offset;
+
+	if (!get_graphic_cursor_area(&data.cursor_pos, &start, &size, &offset)) {
+		return;
+	}
 
-					// Advance to the next pixel
-					*line = pixel;
-					++line;
+	vga_set_graphics_mode(regs, 0, 1);
+	vga_sc_reg_write(VGA_SC_REG_MAP_MASK, VGA_SC_MAP_MASK_ALL);
 
-					// Advance to the next bit in the cursor mask
-					cursor_and_mask <<= 1;
-					cursor_xor_mask <<= 1;
-				}
+	copy_graphic_cursor_latches(&start, &size,
+	                            get_scanline_segment_bytes(data.video_mode.bits_per_pixel,
+	                                                       start.x, size.x),
+	                            true);
+
+	data.cursor_visible = false;
+}
+
+/** Like show_graphic_cursor(), but for planar modes when using the VGA latches.
+ *  The background is saved with latch copies, and the masks are applied to
+ *  all planes at once by the VGA ALU. */
+static void show_graphic_cursor_latches(struct videoregs __far *regs)
+{
+	const struct modeinfo *info = &data.video_mode;
+	struct point start, size, offset;
+	unsigned cursor_bytes_per_line, mask_bytes_per_line;
+	const uint8_t *and_mask, *xor_mask;
+	uint8_t __far *line;
+	unsigned y, i;
+
+	if (!get_graphic_cursor_area(&data.pos, &start, &size, &offset)) {
+		return;
+	}
+
+	update_shifted_cursor_masks(info->bits_per_pixel);
+
+	cursor_bytes_per_line = get_scanline_segment_bytes(info->bits_per_pixel,
+	                                                   start.x, size.x);
+	mask_bytes_per_line = get_shifted_mask_scanline_bytes(info->bits_per_pixel);
+
+	vga_sc_reg_write(VGA_SC_REG_MAP_MASK, VGA_SC_MAP_MASK_ALL);
+
+	// Save the background to off-screen memory
+	vga_set_graphics_mode(regs, 0, 1);
+	copy_graphic_cursor_latches(&start, &size, cursor_bytes_per_line, false);
+
+	// In write mode 0 with the AND function, reading a byte loads the latches,
+	// and writing the mask stores latch & mask to all planes. Same for XOR.
+	// Bytes where the mask would not change anything are not touched.
+	vga_set_graphics_mode(regs, 0, 0);
+
+	vga_gc_reg_write(VGA_GC_REG_DATA_ROTATE, VGA_GC_FUNCTION_AND);
+	line = get_video_scanline(info, start.y) + (start.x * info->bits_per_pixel) / 8;
+	and_mask = &data.cursor_shifted_and_mask[get_shifted_mask_offset(&start, &offset)];
+	for (y = 0; y < size.y; y++) {
+		for (i = 0; i < cursor_bytes_per_line; i++) {
+			if (and_mask[i] != 0xFF) {
+				vga_latch_write(&line[i], and_mask[i]);
+			}
+		}
+		line = get_next_video_scanline(info, line, start.y + y);
+		and_mask += mask_bytes_per_line;
+	}
+
+	vga_gc_reg_write(VGA_GC_REG_DATA_ROTATE, VGA_GC_FUNCTION_XOR);
+	line = get_video_scanline(info, start.y) + (start.x * info->bits_per_pixel) / 8;
+	xor_mask = &data.cursor_shifted_xor_mask[get_shifted_mask_offset(&start, &offset)];
+	for (y = 0; y < size.y; y++) {
+		for (i = 0; i < cursor_bytes_per_line; i++) {
+			if (xor_mask[i] != 0) {
+				vga_latch_write(&line[i], xor_mask[i]);
 			}
 		}
+		line = get_next_video_scanline(info, line, start.y + y);
+		xor_mask += mask_bytes_per_line;
 	}
 
 	data.cursor_pos = data.pos;
 	data.cursor_visible = true;
 }
 
-/** Refreshes cursor position and visibility. */
-static void refresh_cursor(void)
+#if USE_VBE
+/** Moves the VBE window, if necessary, so that it covers the given offset into video memory.
+ *  @param ptr receives the pointer to that offset inside the window.
+ *  @return number of bytes that can be accessed from there without moving the window again. */
+static unsigned map_vbe_window(uint32_t offset, uint8_t __far * __far *ptr)
 {
-	bool should_show = data.visible_count >= 0;
-	bool pos_changed, needs_refresh;
+	struct modeinfo *info = &data.video_mode;
+	uint16_t offset_kb = offset >> 10;
+	uint16_t window_kb = data.vbe_window * info->win_granularity;
+	uint16_t remaining_kb;
+
+	if (offset_kb < window_kb || offset_kb - window_kb >= info->win_size) {
+		// Not covered by the current window position
+		data.vbe_window = offset_kb / info->win_granularity;
+		window_kb = data.vbe_window * info->win_granularity;
+		if (info->win_func) {
+			vbe_call_window_func(&info->win_func, data.vbe_window);
+		} else {
+			vbe_set_window(data.vbe_window);
+		}
+	}
+
+	// Offset inside the window, which is at most 64KiB
+	offset_kb -= window_kb;
+	*ptr = info->begin + ((offset_kb << 10) | ((uint16_t) offset & 0x3FF));
+
+	remaining_kb = info->win_size - offset_kb;
+	if (remaining_kb >= 64) {
+		return 0xFFFFU; // Would overflow, but much more than any scanline anyway
+	}
+	return remaining_kb * 1024U - ((uint16_t) offset & 0x3FF);
+}
+
+/** Restores (if and_mask is NULL) the saved contents of a cursor scanline in a VBE mode,
+ *  or saves them to prev and applies the cursor masks,
+ *  moving the window in between if the scanline crosses the window boundary. */
+static void update_vbe_scanline(uint32_t offset, unsigned bytes, uint8_t *prev,
+                                const uint8_t *and_mask, const uint8_t *xor_mask)
+{
+	while (bytes > 0) {
+		uint8_t __far *line;
+		unsigned n = map_vbe_window(offset, &line);
+		unsigned i;
+
+		if (n > bytes) n = bytes;
+
+		if (and_mask) {
+			_fmemcpy(prev, line, n);
+			for (i = 0; i < n; i++) {
+				line[i] = (line[i] & and_mask[i]) ^ xor_mask[i];
+			}
+			and_mask += n;
+			xor_mask += n;
+		} else {
+			_fmemcpy(line, prev, n);
+		}
+
+		prev += n;
+		offset += n;
+		bytes -= n;
+	}
+}
 
+/** Returns the offset into video memory of the given pixel in a VBE mode. */
+static inline uint32_t get_vbe_video_offset(const struct point __far *pos)
+{
+	const struct modeinfo *info = &data.video_mode;
+	return mulu32(pos->y, info->bytes_per_line) + get_pixel_byte_offset(info->bits_per_pixel, pos->x);
+}
+
+/** Like hide_graphic_cursor(), but for VBE modes. */
+static void hide_graphic_cursor_vbe(void)
+{
+	const struct modeinfo *info = &data.video_mode;
+	struct point start, size, offset;
+	unsigned cursor_bytes_per_line;
+	uint32_t video_offset;
+	unsigned y;
+
+	if (info->bits_per_pixel > 8 && data.cursor_prev_vbe_owner != data.cursor_prev_vbe_id) {
+		// Another VM drew its cursor since and overwrote what was below ours
+		dputs("Cursor background lost to another VM");
+		data.cursor_visible = false;
+		return;
+	}
+
+	if (!get_graphic_cursor_area(&data.cursor_pos, &start, &size, &offset)) {
+		return;
+	}
+
+	cursor_bytes_per_line = get_scanline_segment_bytes(info->bits_per_pixel,
+	                                                   start.x, size.x);
+	video_offset = get_vbe_video_offset(&start);
+
+	for (y = 0; y < size.y; y++) {
+		update_vbe_scanline(video_offset, cursor_bytes_per_line,
+		                    get_prev_graphic_cursor_scanline(cursor_bytes_per_line, size.y, 0, y),
+		                    NULL, NULL);
+		video_offset += info->bytes_per_line;
+	}
+
+	data.cursor_visible = false;
+}
+
+/** Like show_graphic_cursor(), but for VBE modes. */
+static void show_graphic_cursor_vbe(void)
+{
+	const struct modeinfo *info = &data.video_mode;
+	struct point start, size, offset;
+	unsigned cursor_bytes_per_line, mask_bytes_per_line, mask_offset;
+	uint32_t video_offset;
+	unsigned y;
+
+	if (!get_graphic_cursor_area(&data.pos, &start, &size, &offset)) {
+		return;
+	}
+
+	update_shifted_cursor_masks(info->bits_per_pixel);
+
+	cursor_bytes_per_line = get_scanline_segment_bytes(info->bits_per_pixel,
+	                                                   start.x, size.x);
+	mask_bytes_per_line = get_shifted_mask_scanline_bytes(info->bits_per_pixel);
+	mask_offset = get_shifted_mask_offset(&start, &offset);
+	video_offset = get_vbe_video_offset(&start);
+
+	for (y = 0; y < size.y; y++) {
+		update_vbe_scanline(video_offset, cursor_bytes_per_line,
+		                    get_prev_graphic_cursor_scanline(cursor_bytes_per_line, size.y, 0, y),
+		                    &data.cursor_shifted_and_mask[mask_offset],
+		                    &data.cursor_shifted_xor_mask[mask_offset]);
+		video_offset += info->bytes_per_line;
+		mask_offset += mask_bytes_per_line;
+	}
+
+	if (info->bits_per_pixel > 8) {
+		// The shared buffer holds our screen contents now
+		data.cursor_prev_vbe_id = new_cursor_serial();
+		data.cursor_prev_vbe_owner = data.cursor_prev_vbe_id;
+	}
+
+	data.cursor_pos = data.pos;
+	data.cursor_visible = true;
+}
+
+/** Hides and/or draws the cursor in a VBE mode.
+ *  The program is likely using the window too, so we put it back where it was;
+ *  in between, the window only moves when the cursor crosses its boundary.
+ *  Where it was is only asked to the BIOS if int10_isr did not see the program set it,
+ *  since programs may also move it through the window function, which we cannot see. */
+static void update_graphic_cursor_vbe(bool hide, bool show)
+{
+	uint16_t prev_window = data.vbe_app_window;
+
+	if (prev_window == VBE_WINDOW_UNKNOWN) {
+		prev_window = vbe_get_window();
+	}
+
+	data.vbe_window = prev_window;
+
+	if (hide) hide_graphic_cursor_vbe();
+	if (show) show_graphic_cursor_vbe();
+
+	if (data.vbe_window != prev_window) {
+		if (data.video_mode.win_func) {
+			vbe_call_window_func(&data.video_mode.win_func, prev_window);
+		} else {
+			vbe_set_window(prev_window);
+		}
+	}
+}
+#endif /* USE_VBE */
+
+/** Hides the graphic cursor (if hide) and then draws it at the current position (if show),
+ *  saving and restoring the VGA registers in planar modes. */
+static void update_graphic_cursor(bool hide, bool show)
+{
+	bool video_planar = data.video_mode.num_planes > 1;
+	struct videoregs regs;
+
+#if USE_VBE
+	if (data.video_mode.type == VIDEO_VBE) {
+		update_graphic_cursor_vbe(hide, show);
+		return;
+	}
+#endif
+
+	// If current video mode is planar,
+	// we will have to play with the VGA registers
+	// so let's save and restore them.
+	if (video_planar) {
+		vga_save_registers(&regs);
+	}
+
+	if (data.cursor_latches) {
+		if (hide) hide_graphic_cursor_latches(&regs);
+		if (show) show_graphic_cursor_latches(&regs);
+	} else {
+		if (video_planar) vga_set_graphics_mode(&regs, 0, 0);
+		if (hide) hide_graphic_cursor();
+		if (show) show_graphic_cursor();
+	}
+
+	if (video_planar) {
+		vga_restore_register(&regs);
+	}
+}
+
+/** Whether any part of the cursor is over the exclusion area, if there is one. */
+static bool cursor_in_exclusion_area(void)
+{
+	int16_t left, top, right, bottom;
+
+	if (!data.exclusion) {
+		return false;
+	}
+
+	// Compute the area covered by the cursor, in virtual coordinates
+	if (data.video_mode.type == VIDEO_TEXT) {
+		left = snap_to_grid(data.pos.x, data.screen_granularity.x);
+		top = snap_to_grid(data.pos.y, data.screen_granularity.y);
+		right = left + data.screen_granularity.x - 1;
+		bottom = top + data.screen_granularity.y - 1;
+	} else {
+		left = data.pos.x - data.cursor_hotspot.x * data.screen_scale.x;
+		top = data.pos.y - data.cursor_hotspot.y * data.screen_scale.y;
+		right = left + GRAPHIC_CURSOR_WIDTH * data.screen_scale.x - 1;
+		bottom = top + GRAPHIC_CURSOR_HEIGHT * data.screen_scale.y - 1;
+	}
+
+	return left <= data.exclusion_max.x && right >= data.exclusion_min.x
+	        && top <= data.exclusion_max.y && bottom >= data.exclusion_min.y;
+}
+
+/** Whether the cursor should currently be visible. */
+bool cursor_should_show(void)
+{
 #if USE_WIN386
 	// Windows 386 is already rendering the cursor for us.
 	// Hide our own.
-	if (data.w386cursor) should_show = false;
+	if (data.w386cursor) return false;
 #endif
 
+	return data.visible_count >= 0 && !cursor_in_exclusion_area();
+}
+
+/** Redraws the cursor if its position or visibility changed. */
+static void update_cursor(void)
+{
+	bool should_show = cursor_should_show();
+	bool pos_changed, needs_refresh;
+
 #if USE_VIRTUALBOX
 	if (data.vbavail && data.vbwantcursor) {
 		// We want to use the VirtualBox host cursor.
-		// See if we have to update its visibility.
-		int err = 0;
-		if (should_show != data.cursor_visible) {
-			err = vbox_set_pointer_visible(&data.vb, should_show);
-			if (err == 0 && data.vbhaveabs) {
-				data.cursor_visible = should_show;
-			}
-		}
-		if (err == 0 && data.vbhaveabs) {
+		if (data.vbhaveabs) {
 			// No need to refresh the cursor; VirtualBox is already showing it for us.
+			// Just see if we have to update its visibility,
+			// which is left for the next timer tick or mouse event,
+			// so that hiding and showing it again in between costs nothing.
+			if (should_show != data.cursor_visible) {
+				data.vbcursorpending = true;
+			}
 			return;
 		}
+		// If we interrupted a request, the host cursor is left as is.
+		if (should_show != data.cursor_visible && !data.vbbusy) {
+			set_vbox_cursor_visible(should_show);
+		}
+	}
+#endif
+
+#if USE_VMWSVGA
+	if (data.vmwsvgacursor) {
+		// The host draws the cursor; we only have to tell it where.
+		if (should_show && (!data.cursor_visible
+		        || data.cursor_pos.x != data.pos.x || data.cursor_pos.y != data.pos.y)) {
+			vmwsvga_set_cursor_pos(&data.vmwsvga,
+			                       data.pos.x / data.screen_scale.x,
+			                       data.pos.y / data.screen_scale.y);
+			data.cursor_pos = data.pos;
+		}
+		if (should_show != data.cursor_visible) {
+			vmwsvga_set_cursor_visible(&data.vmwsvga, should_show);
+			data.cursor_visible = should_show;
+		}
+		return;
 	}
 #endif
 
@@ -358,120 +869,167 @@ static void refresh_cursor(void)
 		}
 	} else if (data.video_mode.type != VIDEO_UNKNOWN) {
 		// Graphic video modes
+		update_graphic_cursor(data.cursor_visible, should_show);
+	} else {
+		// Unknown video mode, don't render cursor.
+	}
+}
 
-		bool video_planar = data.video_mode.num_planes > 1;
-		struct videoregs regs;
-		// If current video mode is planar,
-		// we will have to play with the VGA registers
-		// so let's save and restore them.
-		if (video_planar) {
-			vga_save_registers(&regs);
-			vga_set_graphics_mode(&regs, 0, 0);
-		}
+/** Refreshes cursor position and visibility. */
+static void refresh_cursor(void)
+{
+	if (data.in_refresh) {
+		// We interrupted another redraw (e.g. from the timer tick);
+		// leave it for later.
+		data.cursor_dirty = true;
+		return;
+	}
 
-		if (data.cursor_visible) {
-			hide_graphic_cursor();
-		}
-		if (should_show) {
-			show_graphic_cursor();
-		}
+	data.in_refresh = true;
+	data.cursor_dirty = false;
+	update_cursor();
+	data.last_refresh_time = pit_get_timestamp_any_mode();
+	data.in_refresh = false;
+}
 
-		if (video_planar) {
-			vga_restore_register(&regs);
+/** Called after the mouse moved. With framecap, only redraws the cursor
+ *  if it has not been redrawn during the last FRAME_CAP_TIME;
+ *  otherwise it is left dirty for the next event or the timer tick.
+ *  This only caps the redraw rate; it does not wait for the vertical retrace,
+ *  since reading the retrace status from the interrupt would reset the
+ *  attribute controller flip-flop under whoever is using it. */
+static void refresh_cursor_after_event(void)
+{
+	if (data.frame_cap) {
+		data.cursor_dirty = true;
+		if (pit_get_timestamp_any_mode() - data.last_refresh_time < FRAME_CAP_TIME) {
+			return;
 		}
-	} else {
-		// Unknown video mode, don't render cursor.
 	}
+
+	refresh_cursor();
 }
 
 /** Forcefully hides the mouse cursor if shown. */
 static void hide_cursor(void)
 {
+	// We may be called from within a redraw (e.g. from the int10 hook),
+	// so do not clear its guard when we are done.
+	bool was_in_refresh = data.in_refresh;
+
+	data.in_refresh = true;
+
 #if USE_VIRTUALBOX
-	if (data.vbavail && data.vbwantcursor) {
-		vbox_set_pointer_visible(&data.vb, false);
+	// If we interrupted a request, the host cursor is left as is.
+	if (data.vbavail && data.vbwantcursor && !data.vbbusy) {
+		set_vbox_cursor_visible(false);
+		data.vbcursorpending = false;
 		if (data.vbhaveabs) {
 			data.cursor_visible = false;
 		}
 	}
 #endif
 
+#if USE_VMWSVGA
+	if (data.vmwsvgacursor) {
+		vmwsvga_set_cursor_visible(&data.vmwsvga, false);
+		data.cursor_visible = false;
+	}
+#endif
+
 	if (data.cursor_visible) {
 		if (data.video_mode.type == VIDEO_TEXT) {
 			hide_text_cursor();
 		} else if (data.video_mode.type != VIDEO_UNKNOWN) {
-			hide_graphic_cursor();
+			update_graphic_cursor(true, false);
 		}
 	}
+
+	data.in_refresh = was_in_refresh;
 }
 
-/** Loads the current graphic cursor,
- *  which in this case means uploading it to the host. */
-static void load_cursor(void)
+/** Whether the given graphic cursor shape and hotspot are the current ones.
+ *  Only the current shape is remembered, not a cache of recent ones:
+ *  VirtualBox's SetPointerShape holds a single shape, and the emulated SVGA II
+ *  adapters (VirtualBox, QEMU) only keep the last defined cursor whatever its id,
+ *  so a program cycling through several shapes must upload each of them anyway. */
+static bool graphic_cursor_equals(int16_t hot_x, int16_t hot_y, const uint16_t __far *shape)
 {
-#if USE_VIRTUALBOX
-	if (data.vbavail && data.vbwantcursor) {
-		VMMDevReqMousePointer *req = (VMMDevReqMousePointer *) data.vb.buf;
-		const unsigned width = GRAPHIC_CURSOR_WIDTH, height = GRAPHIC_CURSOR_HEIGHT;
-		uint8_t  *output = req->pointerData;
-		unsigned int y, x;
+	unsigned i;
 
-		memset(req, 0, sizeof(VMMDevReqMousePointer));
-
-		req->header.size = vbox_req_mouse_pointer_size(width, height);
-		req->header.version = VMMDEV_REQUEST_HEADER_VERSION;
-		req->header.requestType = VMMDevReq_SetPointerShape;
-		req->header.rc = -1;
-
-		req->fFlags = VBOX_MOUSE_POINTER_SHAPE;
-		req->xHot = BOUND(data.cursor_hotspot.x, 0, width);
-		req->yHot = BOUND(data.cursor_hotspot.y, 0, height);
-		req->width = width;
-		req->height = height;
+	if (data.cursor_hotspot.x != hot_x || data.cursor_hotspot.y != hot_y) {
+		return false;
+	}
 
-		// AND mask
-		// int33 format is 1-bit per pixel packed into 16-bit LE values,
-		// while VirtualBox wants 1-bit per pixel packed into 8-bit.
-		// All we have to do is byteswap 16-bit values.
-		for (y = 0; y < height; ++y) {
-			uint16_t cursor_line = get_graphic_cursor_and_mask_line(y);
-			output[0] = (cursor_line >> 8) & 0xFF;
-			output[1] = cursor_line & 0xFF;
-			output += GRAPHIC_CURSOR_SCANLINE_LEN;
+	for (i = 0; i < GRAPHIC_CURSOR_DATA_LEN / sizeof(uint16_t); i++) {
+		if (data.cursor_graphic[i] != shape[i]) {
+			return false;
 		}
+	}
 
-		// XOR mask
-		// int33 format is again 1-bit per pixel packed into 16-bit LE values,
-		// however VirtualBox wants 4-byte per pixel packed "RGBA".
-		for (y = 0; y < height; ++y) {
-			uint16_t cursor_line = get_graphic_cursor_xor_mask_line(y);
+	return true;
+}
 
-			for (x = 0; x < width; ++x) {
-				// MSB of line is current mask bit, we shift it on each iteration
-				uint8_t val = (cursor_line & MSB_MASK) ? 0xFF : 0;
+/** Invalidates everything derived from the graphic cursor shape. */
+static inline void graphic_cursor_changed(void)
+{
+	new_cursor_shape_id();
+#if USE_VIRTUALBOX
+	data.vbshapeloaded = false;
+#endif
+#if USE_VMWSVGA
+	data.vmwsvgashapeloaded = false;
+#endif
+}
 
-				output[0] = val;
-				output[1] = val;
-				output[2] = val;
-				output[3] = 0;
+/** Loads the current graphic cursor,
+ *  which in this case means uploading it to the host. */
+static void load_cursor(void)
+{
+#if USE_VIRTUALBOX
+	// If we interrupted a request, the shape is loaded the next time.
+	if (data.vbavail && data.vbwantcursor && !data.vbshapeloaded && !data.vbbusy) {
+		load_vbox_cursor();
+	}
+#endif
 
-				cursor_line <<= 1;
-				output += 4;
-			}
+#if USE_VMWSVGA
+	if (data.vmwsvgacursor && !data.vmwsvgashapeloaded) {
+		struct vmwsvga_scratch *scratch = (struct vmwsvga_scratch *) data.cursor_shifted_and_mask;
+		uint32_t *cmd = scratch->cmd;
+		unsigned y;
+
+		cmd[0] = VMWSVGA_CMD_DEFINE_CURSOR;
+		cmd[1] = VMWSVGA_CURSOR_ID;
+		cmd[2] = BOUND(data.cursor_hotspot.x, 0, GRAPHIC_CURSOR_WIDTH);
+		cmd[3] = BOUND(data.cursor_hotspot.y, 0, GRAPHIC_CURSOR_HEIGHT);
+		cmd[4] = VMWSVGA_CURSOR_WIDTH;
+		cmd[5] = GRAPHIC_CURSOR_HEIGHT;
+		cmd[6] = 1; // AND mask bits per pixel
+		cmd[7] = 1; // XOR mask bits per pixel
+
+		// int33 format is 1-bit per pixel packed into 16-bit LE values,
+		// while SVGA wants 1-bit per pixel packed into 8-bit (MSB first),
+		// with each scanline padded to 32 bits.
+		// The extra pixels on the right are transparent (AND 1, XOR 0).
+		for (y = 0; y < GRAPHIC_CURSOR_HEIGHT; ++y) {
+			uint16_t and_line = get_graphic_cursor_and_mask_line(y);
+			uint16_t xor_line = get_graphic_cursor_xor_mask_line(y);
+			cmd[8 + y] = 0xFFFF0000UL | (uint16_t)((and_line >> 8) | (and_line << 8));
+			cmd[8 + GRAPHIC_CURSOR_HEIGHT + y] = (uint16_t)((xor_line >> 8) | (xor_line << 8));
 		}
 
-		dputs("Loading cursor to VBox");
+		// We just overwrote the pre-shifted masks
+		data.cursor_shifted_id = 0;
 
-		vbox_send_request(data.vb.iobase, data.vb.dds.physicalAddress);
+		dputs("Loading cursor to SVGA");
 
-		if (req->header.rc != 0) {
-			dputs("Could not send cursor to VirtualBox");
-			return;
+		data.vmwsvgashapeloaded = vmwsvga_send_command(&data.vmwsvga, cmd,
+		                              VMWSVGA_DEFINE_CURSOR_CMD_LEN(GRAPHIC_CURSOR_HEIGHT),
+		                              &scratch->gdt);
+		if (!data.vmwsvgashapeloaded) {
+			dputs("Could not send cursor to SVGA");
 		}
-
-		// After we send this message, it looks like VirtualBox shows the cursor
-		// even if we didn't actually want it to be visible at this point.
-		vbox_set_pointer_visible(&data.vb, false);
 	}
 #endif
 }
@@ -480,6 +1038,48 @@ static void load_cursor(void)
 static void reload_video_info(void)
 {
 	get_current_video_mode_info(&data.video_mode);
+	// The depth may have changed
+	new_cursor_shape_id();
+
+#if USE_VBE
+	// The BIOS data area does not know about VBE modes, so ask the BIOS.
+	// The pre-shifted masks are just a cache, so we can borrow them
+	// for the BIOS to fill the VBE mode information.
+	get_current_vbe_mode_info(&data.video_mode,
+	                          (struct vbe_mode_info *) data.cursor_shifted_and_mask);
+	data.cursor_shifted_id = 0;
+	// Ask where the window is the next time we draw, unless the program tells int10 first
+	data.vbe_app_window = VBE_WINDOW_UNKNOWN;
+#endif
+
+#if USE_VMWSVGA
+	if (data.vmwsvgacursor) {
+		// In case we stop using it in the new mode
+		vmwsvga_set_cursor_visible(&data.vmwsvga, false);
+		data.vmwsvgacursor = false;
+	}
+	// The host only draws the cursor in SVGA modes (e.g. VBE ones),
+	// not in the VGA compatible ones.
+	if (data.vmwsvgaavail && data.vmwsvgawantcursor
+	        && data.video_mode.type != VIDEO_TEXT
+#if USE_WIN386
+	        && !data.haswin386 // Windows' display driver owns the device
+#endif
+	        && vmwsvga_is_enabled(&data.vmwsvga)) {
+		data.vmwsvgacursor = vmwsvga_init_fifo(&data.vmwsvga,
+		                         (struct int15_move_gdt *) data.cursor_shifted_and_mask);
+		// The shape may have been lost with the mode change
+		data.vmwsvgashapeloaded = false;
+		load_cursor();
+	}
+#endif
+
+	// The off-screen area we use to save the cursor background
+	// only exists with 256KiB of video memory, and must not be visible.
+	data.cursor_latches = data.video_mode.num_planes > 1
+	                      && vga_get_memory_size() >= 256
+	                      && data.video_mode.pixels_height
+	                         <= LATCH_SAVE_AREA_OFFSET / data.video_mode.bytes_per_line;
 
 	data.screen_max.x = data.video_mode.pixels_width - 1;
 	data.screen_max.y = data.video_mode.pixels_height - 1;
@@ -525,33 +1125,55 @@ static inline bool video_mode_changed(void)
 	}
 }
 
+/** Reloads the information about the current video mode after a mode change,
+ *  forgetting the cursor and resetting the window to the new screen size. */
+static void reset_video_info(void)
+{
+	if (data.cursor_visible) {
+		// Assume cursor is lost with no way to restore prev contents
+		data.cursor_visible = false;
+	}
+
+	reload_video_info();
+
+	if (data.video_mode.type != VIDEO_UNKNOWN) {
+		// If we know the screen size for this mode, then reset the window to it
+		data.min.x = 0;
+		data.min.y = 0;
+		data.max.x = data.screen_max.x;
+		data.max.y = data.screen_max.y;
+	}
+}
+
 /** Checks if the video mode has changed and if so
- *  refreshes the information about the current video mode.  */
+ *  refreshes the information about the current video mode.
+ *  Mode changes through int10 are already tracked by int10_isr;
+ *  this is for programs that set the mode some other way. */
 static void refresh_video_info(void)
 {
 	if (video_mode_changed()) {
-		if (data.cursor_visible) {
-			// Assume cursor is lost with no way to restore prev contents
-			data.cursor_visible = false;
-		}
-
-		reload_video_info();
-
-		if (data.video_mode.type != VIDEO_UNKNOWN) {
-			// If we know the screen size for this mode, then reset the window to it
-			data.min.x = 0;
-			data.min.y = 0;
-			data.max.x = data.screen_max.x;
-			data.max.y = data.screen_max.y;
-		}
+		reset_video_info();
 	}
 }
 
+#if USE_STATS
+/** Counts a handler call that started at the given PIT timestamp. */
+static void count_handler_call(struct handlerstats *stats, uint32_t start)
+{
+	stats->calls++;
+	stats->clocks += pit_get_timestamp_any_mode() - start;
+}
+#endif
+
 /** Calls the application-registered event handler. */
 static void call_event_handler(void (__far *handler)(), uint16_t events,
                                uint16_t buttons, int16_t x, int16_t y,
                                int16_t delta_x, int16_t delta_y)
 {
+#if USE_STATS
+	uint32_t start = pit_get_timestamp_any_mode();
+#endif
+
 #if TRACE_EVENTS
 	dprintf("calling event handler events=0x%x buttons=0x%x x=%d y=%d dx=%d dy=%d\n",
 	        events, buttons, x, y, delta_x, delta_y);
@@ -567,16 +1189,227 @@ static void call_event_handler(void (__far *handler)(), uint16_t events,
 
 		call dword ptr [handler]
 	}
+
+#if USE_STATS
+	count_handler_call(&data.handler_stats, start);
+#endif
 }
 
-/** Process a mouse event internally.
- *  @param buttons currently pressed buttons as a bitfield
- *  @param absolute whether mouse coordinates are an absolute value
- *  @param x y if absolute, then absolute coordinates in screen pixels
- *             if relative, then relative coordinates in mickeys
- *  @param z relative wheel mouse movement
- */
-static void handle_mouse_event(uint16_t buttons, bool absolute, int x, int y, int z)
+/** @return INT33_HOST_CURSOR_STATUS bits for the current video mode. */
+static uint16_t get_host_cursor_status(void)
+{
+	uint16_t status = 0;
+
+#if USE_VIRTUALBOX
+	if (data.vbavail && data.vbwantcursor) {
+		status |= INT33_HOST_CURSOR_AVAILABLE;
+		if (data.vbhaveabs) {
+			status |= INT33_HOST_CURSOR_ACTIVE;
+		}
+	}
+#endif
+#if USE_VMWSVGA
+	// Under Windows the display driver owns the SVGA device,
+	// so we never draw the VMware SVGA cursor there (see reload_video_info).
+	if (data.vmwsvgaavail && data.vmwsvgawantcursor
+#if USE_WIN386
+	        && !data.haswin386
+#endif
+	        ) {
+		status |= INT33_HOST_CURSOR_AVAILABLE;
+		if (data.vmwsvgacursor) {
+			status |= INT33_HOST_CURSOR_ACTIVE;
+		}
+	}
+#endif
+
+	return status;
+}
+
+/** Calls the raw event handler set with INT33_SET_RAW_EVENT_HANDLER. */
+static void call_raw_event_handler(void (__far *handler)(), uint16_t events,
+                                   uint16_t buttons, uint16_t x, uint16_t y,
+                                   uint16_t host_cursor_status)
+{
+#if USE_STATS
+	uint32_t start = pit_get_timestamp_any_mode();
+#endif
+
+	__asm {
+		mov ax, [events]
+		mov bx, [buttons]
+		mov cx, [x]
+		mov dx, [y]
+		mov si, [host_cursor_status]
+
+		call dword ptr [handler]
+	}
+
+#if USE_STATS
+	count_handler_call(&data.raw_handler_stats, start);
+#endif
+}
+
+/** @return true if at least rate_window clocks have passed since the last
+ *  event handler call. */
+static bool rate_window_elapsed(void)
+{
+	// If time seemingly went backwards, this wraps to a large value
+	return pit_get_timestamp_any_mode() - data.last_handler_time >= data.rate_window;
+}
+
+/** Calls the event handler for the given events plus any pending ones,
+ *  reporting the current position and accumulated motion. */
+static void post_events(uint16_t events, uint16_t buttons)
+{
+	int16_t x = snap_to_grid(data.pos.x, data.screen_granularity.x);
+	int16_t y = snap_to_grid(data.pos.y, data.screen_granularity.y);
+
+	data.in_event_handler = true;
+
+	events |= data.pending_events;
+	data.pending_events = 0;
+
+	if (data.rate_window) {
+		data.last_handler_time = pit_get_timestamp_any_mode();
+	}
+
+	call_event_handler(data.event_handler, events,
+	                   buttons, x, y, data.delta.x, data.delta.y);
+	data.in_event_handler = false;
+}
+
+static inline bool is_motion_only(uint16_t events)
+{
+	return !(events & ~(INT33_EVENT_MASK_MOVEMENT | INT33_EVENT_MASK_ABSOLUTE));
+}
+
+/** Removes the oldest motion-only event from the queue, moving the older ones up.
+ *  @return false if there is no such event. */
+static bool drop_queued_motion(void)
+{
+	uint8_t i, j;
+
+	for (i = 0; i < data.queue_count; i++) {
+		if (is_motion_only(data.queue[(data.queue_head + i) % EVENT_QUEUE_SIZE].events)) {
+			for (j = i; j > 0; j--) {
+				data.queue[(data.queue_head + j) % EVENT_QUEUE_SIZE]
+				        = data.queue[(data.queue_head + j - 1) % EVENT_QUEUE_SIZE];
+			}
+			data.queue_head = (data.queue_head + 1) % EVENT_QUEUE_SIZE;
+			data.queue_count--;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/** Appends an event with the current position and motion to the queue.
+ *  A motion-only event is merged into the newest one if that is also motion-only,
+ *  since it already has the newer position and total motion.
+ *  If the queue is full, the oldest motion-only event is dropped;
+ *  only if there is none, the oldest event is. */
+static void queue_event(uint16_t events, uint16_t buttons)
+{
+	struct int33_queued_event *e = NULL;
+
+	if (data.queue_count > 0 && is_motion_only(events)) {
+		e = &data.queue[(data.queue_head + data.queue_count - 1) % EVENT_QUEUE_SIZE];
+		if (is_motion_only(e->events)) {
+#if USE_STATS
+			data.merged_events++;
+#endif
+		} else {
+			e = NULL;
+		}
+	}
+
+	if (!e) {
+		if (data.queue_count == EVENT_QUEUE_SIZE) {
+			if (!drop_queued_motion()) {
+				data.queue_head = (data.queue_head + 1) % EVENT_QUEUE_SIZE;
+				data.queue_count--;
+			}
+			data.queue_lost++;
+		}
+
+		e = &data.queue[(data.queue_head + data.queue_count) % EVENT_QUEUE_SIZE];
+		data.queue_count++;
+	}
+
+	e->ticks = bda_get_tick_count_lo();
+	e->events = events;
+	e->buttons = buttons;
+	e->x = snap_to_grid(data.pos.x, data.screen_granularity.x);
+	e->y = snap_to_grid(data.pos.y, data.screen_granularity.y);
+	e->delta_x = data.delta.x;
+	e->delta_y = data.delta.y;
+}
+
+/** Removes the oldest event from the queue.
+ *  Safe to call while the PS/2 interrupt may be appending events.
+ *  @return false if the queue was empty. */
+static bool dequeue_event(struct int33_queued_event __far *e)
+{
+	uint16_t flags = save_flags_cli();
+	bool found = data.queue_count > 0;
+
+	if (found) {
+		*e = data.queue[data.queue_head];
+		data.queue_head = (data.queue_head + 1) % EVENT_QUEUE_SIZE;
+		data.queue_count--;
+	}
+
+	restore_flags(flags);
+
+	return found;
+}
+
+/** When deferring, redraws the cursor and calls the event handler for the
+ *  queued events. Consecutive motion-only events are merged into the last one.
+ *  Called from the timer tick and on every int33 call. */
+static void process_deferred(void)
+{
+	struct int33_queued_event e;
+
+	if (data.in_deferred || data.in_event_handler) {
+		return; // Do not reenter
+	}
+
+	data.in_deferred = true;
+
+	if (data.cursor_dirty) {
+		data.cursor_dirty = false;
+		refresh_cursor();
+	}
+
+	// If a program is pulling the events, leave them for it.
+	while (!data.queue_pull && dequeue_event(&e)) {
+		uint16_t events = e.events & data.event_mask;
+
+		if (is_motion_only(e.events) && data.queue_count
+		        && is_motion_only(data.queue[data.queue_head].events)) {
+			// The next event already contains the newer position and total motion
+#if USE_STATS
+			data.merged_events++;
+#endif
+			continue;
+		}
+
+		if (data.event_handler && events) {
+			data.in_event_handler = true;
+			call_event_handler(data.event_handler, events,
+			                   e.buttons, e.x, e.y, e.delta_x, e.delta_y);
+			data.in_event_handler = false;
+		}
+	}
+
+	data.in_deferred = false;
+}
+
+/** Process a mouse event internally, see handle_mouse_event. */
+static void process_mouse_event(uint16_t buttons, bool absolute, int x, int y, int z)
 {
 	uint16_t events = 0;
 	int i;
@@ -692,17 +1525,208 @@ static void handle_mouse_event(uint16_t buttons, bool absolute, int x, int y, in
 	}
 	data.buttons = buttons;
 
-	refresh_cursor();
+#if USE_VIRTUALBOX
+	if (data.vbavail) apply_host_cursor_visibility();
+#endif
+
+	if (events && (data.defer || data.queue_pull)) {
+		queue_event(events, buttons);
+	}
+
+	if (data.defer) {
+		// Cursor and event handler will be taken care of from
+		// the timer tick or the next int33 call.
+		data.cursor_dirty = true;
+		return;
+	}
+
+	refresh_cursor_after_event();
 
 	events &= data.event_mask;
 	if (data.event_handler && events) {
-		x = snap_to_grid(data.pos.x, data.screen_granularity.x);
-		y = snap_to_grid(data.pos.y, data.screen_granularity.y);
+		if (data.rate_window && is_motion_only(events) && !rate_window_elapsed()) {
+			// Only motion, and too soon after the last call; report it later
+			// together with the next event (or from the timer).
+			data.pending_events |= events;
+#if USE_STATS
+			data.merged_events++;
+#endif
+			return;
+		}
+
+		post_events(events, buttons);
+	}
+}
+
+/** Process a mouse event internally.
+ *  @param buttons currently pressed buttons as a bitfield
+ *  @param absolute whether mouse coordinates are an absolute value
+ *  @param x y if absolute, then absolute coordinates in screen pixels
+ *             if relative, then relative coordinates in mickeys
+ *  @param z relative wheel mouse movement
+ */
+static void handle_mouse_event(uint16_t buttons, bool absolute, int x, int y, int z)
+{
+	// The BIOS may call us with interrupts enabled,
+	// so let the timer tick know that the mouse state is being updated.
+	bool was_in_mouse_event = data.in_mouse_event;
+
+	data.in_mouse_event = true;
+	process_mouse_event(buttons, absolute, x, y, z);
+	data.in_mouse_event = was_in_mouse_event;
+}
+
+/** Process a mouse event coming from the mouse or the host.
+ *  Hands it unmodified to the raw event handler, if any,
+ *  then processes it internally like handle_mouse_event.
+ *  @param x y if absolute, then absolute coordinates from 0 to 0xFFFF
+ *             if relative, then relative coordinates in mickeys */
+static void handle_device_event(uint16_t buttons, bool absolute, int x, int y, int z)
+{
+	if (data.raw_handler) {
+		uint16_t events = absolute ? INT33_EVENT_MASK_ABSOLUTE : 0;
+
+		if (absolute || x || y) {
+			events |= INT33_EVENT_MASK_MOVEMENT;
+		}
+		if (z) {
+			events |= INT33_EVENT_MASK_WHEEL_MOVEMENT;
+		}
+
+		data.raw_host_cursor_status = get_host_cursor_status();
+		call_raw_event_handler(data.raw_handler, events,
+		                       buttons | ((z & 0xFF) << 8), x, y,
+		                       data.raw_host_cursor_status);
+	}
+
+	if (absolute) {
+		// Scale to 0..screen_size (in pixels).
+		// If the user is using a window larger than the screen, use it.
+		x = scaleu((uint16_t) x, 0xFFFFU, MAX(data.max.x, data.screen_max.x));
+		y = scaleu((uint16_t) y, 0xFFFFU, MAX(data.max.y, data.screen_max.y));
+	}
+
+	handle_mouse_event(buttons, absolute, x, y, z);
+}
+
+#if USE_VMWARE
+#if USE_STATS
+static void vmware_count_queue_depth(unsigned depth)
+{
+	unsigned bucket = 0;
+
+	data.vmwstats.drains++;
+	data.vmwstats.last_depth = depth;
+	if (depth > data.vmwstats.max_depth) {
+		data.vmwstats.max_depth = depth;
+	}
+
+	// Bucket n counts depths up to 2^n, the last one everything else
+	while (bucket < VMW_QUEUE_HIST_SIZE - 1 && depth > (1U << bucket)) {
+		bucket++;
+	}
+	data.vmwstats.depth_hist[bucket]++;
+}
+#endif /* USE_STATS */
+
+/** Reads all the packets queued in the VMware absolute pointer interface,
+ *  and handles them as mouse events, merging consecutive motion-only packets
+ *  so that we do not lag behind the host when the queue backs up.
+ *  Nothing is posted if the queue is empty.
+ *  @param ps2_buttons buttons from the PS/2 packet that woke us up. */
+static void handle_vmware_queue(unsigned ps2_buttons)
+{
+	uint32_t vmwstatus = vmware_abspointer_status();
+	unsigned depth = (vmwstatus & VMWARE_ABSPOINTER_STATUS_MASK_DATA)
+	                 / VMWARE_ABSPOINTER_DATA_PACKET_SIZE;
+	bool pending = false;
+	// Contents of the pending (not yet posted) event
+	unsigned buttons;
+	bool abs;
+	int x, y, z;
+
+#if TRACE_EVENTS
+	dprintf("vmware status=0x%lx\n", vmwstatus);
+#endif
+
+	if (!depth) {
+		return;
+	}
+
+#if USE_STATS
+	vmware_count_queue_depth(depth);
+#endif
+
+	while (depth--) {
+		struct vmware_abspointer_data vmw;
+		unsigned pbuttons = ps2_buttons;
+		bool pabs;
+		int px, py, pz;
+
+		vmware_abspointer_data(VMWARE_ABSPOINTER_DATA_PACKET_SIZE, &vmw);
+
+#if TRACE_EVENTS
+		dprintf("vmware pstatus=0x%lx x=%ld y=%ld z=%d\n",
+		        vmw.status, vmw.x, vmw.y, (int) (uint8_t) vmw.z);
+#endif
+
+		if (vmw.status & VMWARE_ABSPOINTER_STATUS_RELATIVE) {
+			pabs = false;
+			px = (int16_t) vmw.x;
+			py = (int16_t) vmw.y;
+		} else {
+			pabs = true;
+			px = vmw.x & 0xFFFFU;
+			py = vmw.y & 0xFFFFU;
+		}
+		pz = (uint8_t) vmw.z;
+
+		if (vmw.status & VMWARE_ABSPOINTER_STATUS_BUTTON_LEFT) {
+			pbuttons |= PS2M_STATUS_BUTTON_1;
+		}
+		if (vmw.status & VMWARE_ABSPOINTER_STATUS_BUTTON_RIGHT) {
+			pbuttons |= PS2M_STATUS_BUTTON_2;
+		}
+		if (vmw.status & VMWARE_ABSPOINTER_STATUS_BUTTON_MIDDLE) {
+			pbuttons |= PS2M_STATUS_BUTTON_3;
+		}
+
+#if USE_STATS
+		data.vmwstats.packets++;
+#endif
+
+		if (pending) {
+			if (pbuttons == buttons && pabs == abs && !pz && !z) {
+				// Neither this nor the pending packet contain anything but motion,
+				// so we can just post the final position.
+				if (abs) {
+					x = px;
+					y = py;
+				} else {
+					x += px;
+					y += py;
+				}
+#if USE_STATS
+				data.vmwstats.merged++;
+#endif
+				continue;
+			}
 
-		call_event_handler(data.event_handler, events,
-		                   buttons, x, y, data.delta.x, data.delta.y);
+			// Never merge button transitions nor wheel movement
+			handle_device_event(buttons, abs, x, y, z);
+		}
+
+		pending = true;
+		buttons = pbuttons;
+		abs = pabs;
+		x = px;
+		y = py;
+		z = pz;
 	}
+
+	handle_device_event(buttons, abs, x, y, z);
 }
+#endif /* USE_VMWARE */
 
 static void handle_ps2_packet(void)
 {
@@ -732,14 +1756,11 @@ static void handle_ps2_packet(void)
 
 #if USE_VIRTUALBOX
 	if (data.vbavail) {
-		uint16_t vbx, vby;
-		if ((vbox_get_mouse(&data.vb, &abs, &vbx, &vby) == 0) && abs) {
-			// VirtualBox gives unsigned coordinates from 0...0xFFFFU,
-			// scale to 0..screen_size (in pixels).
-			refresh_video_info();
-			// If the user is using a window larger than the screen, use it.
-			x = scaleu(vbx, 0xFFFFU, MAX(data.max.x, data.screen_max.x));
-			y = scaleu(vby, 0xFFFFU, MAX(data.max.y, data.screen_max.y));
+		if (vbox_update_position()) {
+			abs = true;
+			// VirtualBox gives unsigned coordinates from 0...0xFFFFU
+			x = data.vbx;
+			y = data.vby;
 			data.vbhaveabs = true;
 		} else {
 			// VirtualBox does not support absolute coordinates,
@@ -752,128 +1773,261 @@ static void handle_ps2_packet(void)
 
 #if USE_VMWARE
 	if (data.vmwavail) {
-		uint32_t vmwstatus = vmware_abspointer_status();
-		uint16_t data_avail = vmwstatus & VMWARE_ABSPOINTER_STATUS_MASK_DATA;
+		// Ignore the PS/2 packet if there is no VMware data, it is likely garbage
+		handle_vmware_queue(status & (PS2M_STATUS_BUTTON_1 | PS2M_STATUS_BUTTON_2 | PS2M_STATUS_BUTTON_3));
+		return;
+	}
+#endif /* USE_VMWARE */
 
-#if TRACE_EVENTS
-		dprintf("vmware status=0x%lx\n", vmwstatus);
-#endif
+	handle_device_event(status & (PS2M_STATUS_BUTTON_1 | PS2M_STATUS_BUTTON_2 | PS2M_STATUS_BUTTON_3),
+	                    abs, x, y, z);
+}
 
-		if (data_avail >= VMWARE_ABSPOINTER_DATA_PACKET_SIZE) {
-			struct vmware_abspointer_data vmw;
-			vmware_abspointer_data(VMWARE_ABSPOINTER_DATA_PACKET_SIZE, &vmw);
+/** Assembles PS/2 packets one byte at a time,
+ *  when using the BIOS in streaming mode or reading the mouse directly. */
+static void handle_ps2_byte(uint8_t byte)
+{
+	uint16_t ticks = bda_get_tick_count_lo();
 
 #if TRACE_EVENTS
-			dprintf("vmware pstatus=0x%x x=%d y=%d z=%d\n",
-			        status, vmw.x, vmw.y, (int) (uint8_t) vmw.z);
-#endif
-
-			if (vmw.status & VMWARE_ABSPOINTER_STATUS_RELATIVE) {
-				x = (int16_t) vmw.x;
-				y = (int16_t) vmw.y;
-				z = (uint8_t) vmw.z;
-			} else {
-				abs = true;
-				// Scale to screen coordinates
-				refresh_video_info();
-				x = scaleu(vmw.x & 0xFFFFU, 0xFFFFU,
-				           MAX(data.max.x, data.screen_max.x));
-				y = scaleu(vmw.y & 0xFFFFU, 0xFFFFU,
-				           MAX(data.max.y, data.screen_max.y));
-				z = (uint8_t) vmw.z;
-			}
+	dprintf("ps2 byte %d/%d = %x\n",
+	        1 + data.cur_packet_bytes, data.packet_size, byte);
+#endif /* TRACE_EVENTS */
+
+	if (data.cur_packet_bytes &&
+	        ticks >= data.cur_packet_ticks + MAX_PS2_PACKET_DELAY) {
+		// Assume the start of a new packet
+		dprintf("dropping packet! prev_ticks=%u new_ticks=%u\n",
+		        data.cur_packet_ticks, ticks);
+		data.cur_packet_bytes = 0;
+	}
+	if (data.cur_packet_bytes == 0) {
+		if (!(byte & PS2M_STATUS_ALWAYS_1)) {
+			// Cannot be the status byte, so we lost synchronization;
+			// skip bytes until we find something that looks like one.
+			dprintf("resync, skipping byte %x\n", byte);
+			return;
+		}
+		data.cur_packet_ticks = ticks;
+	}
+
+	data.ps2_packet[data.cur_packet_bytes] = byte;
+	data.cur_packet_bytes++;
+
+	if (data.cur_packet_bytes >= data.packet_size) {
+		handle_ps2_packet();
+		data.cur_packet_bytes = 0;
+	}
+}
+
+/** PS/2 BIOS calls this routine to notify mouse events.
+ *  In our case, each time we receive a byte from the mouse. */
+static void ps2_mouse_handler(uint16_t word0, uint16_t word1, uint16_t word2, uint16_t word3)
+{
+#pragma aux ps2_mouse_handler "*" parm caller [ax] [bx] [cx] [dx] modify [ax bx cx dx si di es fs gs]
+
+	// Are we using the BIOS in 3-packet mode directly?
+	if (data.bios_packet_size == PS2M_PACKET_SIZE_PLAIN) {
+		// Just forward it to the full packet handler.
+		data.ps2_packet[0] = word0;
+		data.ps2_packet[1] = word1;
+		data.ps2_packet[2] = word2;
+		(void) word3;
+		handle_ps2_packet();
+		return;
+	}
+
+	// Otherwise we are using the BIOS in 1-packet size mode,
+	// receiving one byte at a time.
+	// We have to compute synchronization ourselves.
+	handle_ps2_byte(word0);
+}
+
+void __declspec(naked) __far ps2_mouse_callback()
+{
+	__asm {
+		pusha
+		push ds
+		push es
+		push fs
+		push gs
+
+		; 8 + 4 saved registers, 24 bytes
+		; plus 4 bytes for retf address
+		; = 28 bytes of stack before callback args
+		; The BIOS always pushes 4 words, so first BIOS parameter is at bp + 28 + 6
+
+		mov bp, sp
+		push cs
+		pop ds
+
+		mov ax,[bp+28+6]	; Status
+		mov bx,[bp+28+4]	; X
+		mov cx,[bp+28+2]	; Y
+		mov dx,[bp+28+0]	; Z
+
+		call ps2_mouse_handler
+
+		pop gs
+		pop fs
+		pop es
+		pop ds
+		popa
+
+		retf
+	}
+}
+
+#if USE_PS2_DIRECT
+/** Handles IRQ12 ourselves, reading the mouse byte from the keyboard controller,
+ *  which saves going through the BIOS handler and its far callback for every byte. */
+static void ps2_irq_handler(void)
+#pragma aux ps2_irq_handler "*" modify [ax bx cx dx si di es fs gs]
+{
+	uint8_t byte;
+
+	if (!data.ps2directactive) {
+		// BIOS is talking to the mouse, or we gave up on reading it directly
+		data.prev_int74_handler();
+		return;
+	}
+
+	if (!kbc_read_aux_byte(&byte)) {
+		// Nothing from the mouse; maybe someone else's, or the controller
+		// emulation is not good enough for us. Let the BIOS deal with it.
+		if (++data.ps2directbad >= MAX_PS2_DIRECT_BAD_IRQS) {
+			dputs("KBC not reporting mouse data, going back to the BIOS");
+			data.ps2directactive = false;
+		}
+		data.prev_int74_handler();
+		return;
+	}
+
+	data.ps2directbad = 0;
+
+	handle_ps2_byte(byte);
+
+	pic_send_eoi(PS2_MOUSE_IRQ);
+}
+
+void __declspec(naked) __far ps2_irq_isr(void)
+{
+	__asm {
+		pusha
+		push ds
+		push es
+		push fs
+		push gs
+
+		push cs
+		pop ds
+
+		call ps2_irq_handler
+
+		pop gs
+		pop fs
+		pop es
+		pop ds
+		popa
 
-			if (vmw.status & VMWARE_ABSPOINTER_STATUS_BUTTON_LEFT) {
-				status |= PS2M_STATUS_BUTTON_1;
-			}
-			if (vmw.status & VMWARE_ABSPOINTER_STATUS_BUTTON_RIGHT) {
-				status |= PS2M_STATUS_BUTTON_2;
-			}
-			if (vmw.status & VMWARE_ABSPOINTER_STATUS_BUTTON_MIDDLE) {
-				status |= PS2M_STATUS_BUTTON_3;
-			}
-		} else {
-			return; // Ignore the PS/2 packet otherwise, it is likely garbage
-		}
+		iret
 	}
-#endif /* USE_VMWARE */
-
-	handle_mouse_event(status & (PS2M_STATUS_BUTTON_1 | PS2M_STATUS_BUTTON_2 | PS2M_STATUS_BUTTON_3),
-	                   abs, x, y, z);
 }
 
-/** PS/2 BIOS calls this routine to notify mouse events.
- *  In our case, each time we receive a byte from the mouse. */
-static void ps2_mouse_handler(uint16_t word0, uint16_t word1, uint16_t word2, uint16_t word3)
+/** Called before someone else (e.g. another mouse driver or a game)
+ *  uses the BIOS pointing device interface, which needs to see the mouse replies.
+ *  @return whether we were reading the mouse directly, for int15_post_handler. */
+static bool int15_pre_handler(void)
+#pragma aux int15_pre_handler "*" value [al] modify [ax bx cx dx si di es fs gs]
 {
-#pragma aux ps2_mouse_handler "*" parm caller [ax] [bx] [cx] [dx] modify [ax bx cx dx si di es fs gs]
-
-	uint16_t ticks = bda_get_tick_count_lo();
-
-	// Are we using the BIOS in 3-packet mode directly?
-	if (data.bios_packet_size == PS2M_PACKET_SIZE_PLAIN) {
-		// Just forward it to the full packet handler.
-		data.ps2_packet[0] = word0;
-		data.ps2_packet[1] = word1;
-		data.ps2_packet[2] = word2;
-		(void) word3;
-		handle_ps2_packet();
-		return;
-	}
+	bool was_direct = data.ps2directactive;
 
-	// Otherwise we are using the BIOS in 1-packet size mode,
-	// receiving one byte at a time.
-	// We have to compute synchronization ourselves.
+	data.ps2directactive = false;
 
-#if TRACE_EVENTS
-	dprintf("ps2 callback byte %d/%d = %x\n",
-	        1 + data.cur_packet_bytes, data.packet_size, word0 & 0xFF);
-#endif /* TRACE_EVENTS */
+	return was_direct;
+}
 
-	if (data.cur_packet_bytes &&
-	        ticks >= data.cur_packet_ticks + MAX_PS2_PACKET_DELAY) {
-		// Assume the start of a new packet
-		dprintf("dropping packet! prev_ticks=%u new_ticks=%u\n",
-		        data.cur_packet_ticks, ticks);
-		data.cur_packet_bytes = 0;
-	}
-	if (data.cur_packet_bytes == 0) {
-		data.cur_packet_ticks = ticks;
+/** Called after the BIOS pointing device call.
+ *  Our own calls are always done with direct mode already off.
+ *  @param function the original int15 ax.
+ *  @param was_direct what int15_pre_handler returned. */
+static void int15_post_handler(uint16_t function, bool was_direct)
+#pragma aux int15_post_handler "*" parm [ax] [dl] modify [ax bx cx dx si di es fs gs]
+{
+	if (!was_direct) {
+		return;
 	}
 
-	data.ps2_packet[data.cur_packet_bytes] = word0;
-	data.cur_packet_bytes++;
-
-	if (data.cur_packet_bytes >= data.packet_size) {
-		handle_ps2_packet();
-		data.cur_packet_bytes = 0;
+	if (function == 0xC204) {
+		// Just getting the device ID changes nothing; keep reading the mouse ourselves
+		data.ps2directactive = true;
+	} else {
+		// Someone else reconfigured the mouse behind our back (maybe even its callback),
+		// so leave it to the BIOS and start from scratch on the next reset.
+		dputs("PS/2 mouse configured by someone else, going back to the BIOS");
+		data.hw_ok = false;
 	}
 }
 
-void __declspec(naked) __far ps2_mouse_callback()
+void __declspec(naked) __far int15_isr(void)
 {
 	__asm {
+		; wasm doesn't support structs, see TSRDATA_PREV_INT15_OFFSET
+		cmp ah, 0xC2 ; Pointing device BIOS interface
+		je pointing_device
+		jmp dword ptr cs:[data + TSRDATA_PREV_INT15_OFFSET]
+
+	pointing_device:
+		push ax ; Keep the function number for int15_post_handler
+		push ax ; and room for what int15_pre_handler returns
+
 		pusha
 		push ds
 		push es
 		push fs
 		push gs
 
-		; 8 + 4 saved registers, 24 bytes
-		; plus 4 bytes for retf address
-		; = 28 bytes of stack before callback args
-		; The BIOS always pushes 4 words, so first BIOS parameter is at bp + 28 + 6
+		push cs
+		pop ds
+
+		call int15_pre_handler
 
+		; 8 + 4 saved registers, 24 bytes, then the room for the result
 		mov bp, sp
-		push cs
+		mov [bp + 24], al
+
+		pop gs
+		pop fs
+		pop es
 		pop ds
+		popa
 
-		mov ax,[bp+28+6]	; Status
-		mov bx,[bp+28+4]	; X
-		mov cx,[bp+28+2]	; Y
-		mov dx,[bp+28+0]	; Z
+		; Let the BIOS talk to the mouse
+		pushf
+		call dword ptr cs:[data + TSRDATA_PREV_INT15_OFFSET]
 
-		call ps2_mouse_handler
+		pushf ; The BIOS returns errors in the carry flag
+		pusha
+		push ds
+		push es
+		push fs
+		push gs
+
+		; 8 + 4 saved registers, 24 bytes, then the flags returned by the BIOS,
+		; what int15_pre_handler returned, the function number,
+		; and the interrupt frame (ip, cs, flags)
+		mov bp, sp
+		mov ax, [bp + 24]
+		and ax, 1 ; Return only the BIOS carry flag to the caller,
+		and word ptr [bp + 34], 0xFFFE ; keeping its own IF, TF, DF, etc.
+		or [bp + 34], ax
+		mov dl, [bp + 26]
+		mov ax, [bp + 28]
+
+		push cs
+		pop ds
+
+		call int15_post_handler
 
 		pop gs
 		pop fs
@@ -881,17 +2035,21 @@ void __declspec(naked) __far ps2_mouse_callback()
 		pop ds
 		popa
 
-		retf
+		add sp, 6 ; Discard the BIOS flags, the pre handler result and the function number
+		iret
 	}
 }
+#endif /* USE_PS2_DIRECT */
 
 #if USE_INTEGRATION
 static void set_absolute(bool enable)
 {
 #if USE_VIRTUALBOX
 	data.vbhaveabs = false;
+	data.vbdirty = true; // Ask for the position again on the next packet
 	if (data.vbavail) {
-		int err = vbox_set_mouse(&data.vb, enable, false);
+		int err = set_vbox_absolute(enable);
+
 		if (enable && !err) {
 			dputs("VBox absolute mouse enabled");
 			data.vbhaveabs = true;
@@ -926,6 +2084,11 @@ static void reset_mouse_hardware()
 {
 	int err;
 
+#if USE_PS2_DIRECT
+	// The BIOS needs to see the mouse replies while we configure it
+	data.ps2directactive = false;
+#endif
+
 	// Stop receiving bytes...
 	ps2m_enable(false);
 
@@ -961,6 +2124,7 @@ static void reset_mouse_hardware()
 	if (err) {
 		dputs("error on ps2m_init during reset, ignoring");
 	}
+	data.hw_ok = !err;
 
 #if USE_WHEEL
 	if (data.usewheel
@@ -986,6 +2150,10 @@ static void reset_mouse_hardware()
 	ps2m_set_sample_rate(PS2M_SAMPLE_RATE_80);
 	ps2m_set_scaling_factor(1); // 1 = 1:1 scaling
 
+	if (data.hw_ok && ps2m_get_device_id(&data.device_id)) {
+		data.hw_ok = false; // Can't check it later, so always reinitialize
+	}
+
 	ps2m_set_callback(get_cs():>ps2_mouse_callback);
 
 #if USE_INTEGRATION
@@ -996,6 +2164,58 @@ static void reset_mouse_hardware()
 #endif
 
 	ps2m_enable(true);
+
+#if USE_PS2_DIRECT
+	// Only read the mouse directly if the BIOS also let us assemble the packets;
+	// otherwise the controller or BIOS are probably emulated and may not like it.
+	// Windows 386 virtualizes the controller, so leave that to the BIOS, too.
+	data.ps2directbad = 0;
+	data.ps2directactive = data.ps2direct && data.prev_int74_handler && data.hw_ok
+	                       && data.bios_packet_size == PS2M_PACKET_SIZE_STREAMING
+#if USE_WIN386
+	                       && !data.haswin386
+#endif
+	                       ;
+#endif
+}
+
+/** Cheaply checks whether the mouse is still in the state reset_mouse_hardware left it,
+ *  i.e. it still reports the same device ID (which a reset by someone else would change
+ *  e.g. from the wheel mouse one back to the plain one).
+ *  This is still three commands on the PS/2 port (disable, get ID, enable),
+ *  instead of the dozen or so of a full reinitialization.
+ *  It also installs our BIOS callback again, since another program may have
+ *  replaced it without touching the mouse itself (the int15 hook only
+ *  notices that while in direct mode).
+ *  @return false if the mouse needs to be reinitialized. */
+static bool check_mouse_hardware()
+{
+	uint8_t device_id;
+	int err;
+
+#if USE_PS2_DIRECT
+	bool was_direct = data.ps2directactive;
+	// The BIOS needs to see the mouse reply
+	data.ps2directactive = false;
+#endif
+
+	ps2m_enable(false);
+	err = ps2m_get_device_id(&device_id);
+	if (!err) {
+		ps2m_set_callback(get_cs():>ps2_mouse_callback);
+	}
+	ps2m_enable(true);
+
+#if USE_PS2_DIRECT
+	data.ps2directactive = was_direct;
+#endif
+
+	if (err || device_id != data.device_id) {
+		dprintf("Mouse device ID changed to %u, reinitializing\n", device_id);
+		return false;
+	}
+
+	return true;
 }
 
 /** Reset "software" mouse settings, i.e. those configurable by the client program. */
@@ -1003,6 +2223,9 @@ static void reset_mouse_settings()
 {
 	data.event_mask = 0;
 	data.event_handler = 0;
+	data.raw_handler = 0;
+	data.pending_events = 0;
+	data.queue_pull = false;
 
 	data.mickeysPerLine.x = 8;
 	data.mickeysPerLine.y = 16;
@@ -1012,18 +2235,25 @@ static void reset_mouse_settings()
 	data.min.y = 0;
 	data.max.y = data.screen_max.y;
 	data.visible_count = -1;
+	data.exclusion = false;
 	data.cursor_text_type = 0;
 	data.cursor_text_and_mask = 0xFFFFU;
 	data.cursor_text_xor_mask = 0x7700U;
-	data.cursor_hotspot.x = 0;
-	data.cursor_hotspot.y = 0;
-	memcpy(data.cursor_graphic, default_cursor_graphic, sizeof(data.cursor_graphic));
+	if (!graphic_cursor_equals(0, 0, default_cursor_graphic)) {
+		data.cursor_hotspot.x = 0;
+		data.cursor_hotspot.y = 0;
+		memcpy(data.cursor_graphic, default_cursor_graphic, sizeof(data.cursor_graphic));
+		graphic_cursor_changed();
+	}
 
 #if USE_WHEEL
 	data.usewheelapi = false;
 #endif
 
 	refresh_cursor(); // This will hide the cursor and update data.cursor_visible
+#if USE_VIRTUALBOX
+	if (data.vbavail) apply_host_cursor_visibility(); // Including the host one, right now
+#endif
 }
 
 /** Reset the current mouse state and throw away past events. */
@@ -1050,11 +2280,19 @@ static void reset_mouse_state()
 		data.button[i].released.last.y = 0;
 	}
 	data.wheel_delta = 0;
+	data.queue_head = 0;
+	data.queue_count = 0;
+	data.queue_lost = 0;
+	data.cursor_dirty = false;
+	data.in_refresh = false;
 	data.cursor_visible = false;
 	data.cursor_pos.x = 0;
 	data.cursor_pos.y = 0;
 	data.cursor_prev_char = 0;
 	memset(data.cursor_prev_graphic, 0, sizeof(data.cursor_prev_graphic));
+#if USE_VBE
+	data.cursor_prev_vbe_id = 0;
+#endif
 }
 
 static void return_clear_wheel_counter(union INTPACK __far *r)
@@ -1077,12 +2315,28 @@ static void return_clear_button_counter(union INTPACK __far *r, struct buttoncou
 static void int33_handler(union INTPACK r)
 #pragma aux int33_handler "*" parm caller [] modify [ax bx cx dx si di es fs gs]
 {
+	if (data.defer) {
+		// Deliver pending events before answering, so that the program sees
+		// a state consistent with its event handler calls.
+		process_deferred();
+	}
+
 	switch (r.w.ax) {
 	case INT33_RESET_MOUSE:
 		dputs("Mouse reset");
 		reload_video_info();
 		reset_mouse_settings();
-		reset_mouse_hardware();
+		if (!data.hw_ok || !check_mouse_hardware()) {
+			// Reinitializing the mouse takes a lot of PS/2 traffic,
+			// and some programs reset the mouse very often,
+			// so only do it the first time or when the hardware state may have changed.
+			reset_mouse_hardware();
+		} else {
+#if USE_INTEGRATION
+			// Still upload the cursor shape if the host does not have it
+			load_cursor();
+#endif
+		}
 		reset_mouse_state();
 		r.w.ax = INT33_MOUSE_FOUND;
 		r.w.bx = NUM_BUTTONS;
@@ -1091,7 +2345,12 @@ static void int33_handler(union INTPACK r)
 #if TRACE_EVENTS
 		dputs("Mouse show cursor");
 #endif
-		data.visible_count++;
+		// Every show cancels the exclusion area, but the counter never goes
+		// above 0, so that showing a visible cursor does not need two hides.
+		data.exclusion = false;
+		if (data.visible_count < 0) {
+			data.visible_count++;
+		}
 		refresh_cursor();
 		break;
 	case INT33_HIDE_CURSOR:
@@ -1183,10 +2442,15 @@ static void int33_handler(union INTPACK r)
 		break;
 	case INT33_SET_GRAPHICS_CURSOR:
 		dputs("Mouse set graphics cursor");
+		if (graphic_cursor_equals(r.w.bx, r.w.cx, MK_FP(r.w.es, r.w.dx))) {
+			// Some programs keep setting the same cursor; nothing to do.
+			break;
+		}
 		hide_cursor();
 		data.cursor_hotspot.x = r.w.bx;
 		data.cursor_hotspot.y = r.w.cx;
 		_fmemcpy(data.cursor_graphic, MK_FP(r.w.es, r.w.dx), sizeof(data.cursor_graphic));
+		graphic_cursor_changed();
 		load_cursor();
 		refresh_cursor();
 		break;
@@ -1211,12 +2475,24 @@ static void int33_handler(union INTPACK r)
 		dputs("Mouse set event handler");
 		data.event_mask = r.w.cx;
 		data.event_handler = MK_FP(r.w.es, r.w.dx);
+		data.pending_events = 0;
 		break;
 	case INT33_SET_MOUSE_SPEED:
 		dprintf("Mouse set speed x=%d y=%d\n", r.w.cx, r.w.dx);
 		data.mickeysPerLine.x = r.w.cx;
 		data.mickeysPerLine.y = r.w.dx;
 		break;
+	case INT33_SET_EXCLUSION_AREA:
+#if TRACE_EVENTS
+		dprintf("Mouse set exclusion area %d,%d - %d,%d\n", r.w.cx, r.w.dx, r.w.si, r.w.di);
+#endif
+		data.exclusion_min.x = MIN((int16_t) r.w.cx, (int16_t) r.w.si);
+		data.exclusion_max.x = MAX((int16_t) r.w.cx, (int16_t) r.w.si);
+		data.exclusion_min.y = MIN((int16_t) r.w.dx, (int16_t) r.w.di);
+		data.exclusion_max.y = MAX((int16_t) r.w.dx, (int16_t) r.w.di);
+		data.exclusion = true;
+		refresh_cursor();
+		break;
 	case INT33_SET_SPEED_DOUBLE_THRESHOLD:
 		dprintf("Mouse set speed double threshold=%d\n", r.w.dx);
 		data.doubleSpeedThreshold = r.w.dx;
@@ -1227,21 +2503,30 @@ static void int33_handler(union INTPACK r)
 	    {
 		    void (__far *prev_event_handler)() = data.event_handler;
 			data.event_handler = MK_FP(r.w.es, r.w.dx);
+			data.pending_events = 0;
 			r.w.es = FP_SEG(prev_event_handler);
 			r.w.dx = FP_OFF(prev_event_handler);
 	    }
 		break;
 	case INT33_GET_MOUSE_STATUS_SIZE:
 		dputs("Mouse get status size");
-		r.w.bx = sizeof(TSRDATA);
+		r.w.bx = TSRDATA_APP_STATE_SIZE;
 		break;
 	case INT33_SAVE_MOUSE_STATUS:
 		dputs("Mouse save status");
-		_fmemcpy(MK_FP(r.w.es, r.w.dx), &data, sizeof(TSRDATA));
+		_fmemcpy(MK_FP(r.w.es, r.w.dx), &data.pos, TSRDATA_APP_STATE_SIZE);
 		break;
 	case INT33_LOAD_MOUSE_STATUS:
 		dputs("Mouse load status");
-		_fmemcpy(&data, MK_FP(r.w.es, r.w.dx), sizeof(TSRDATA));
+		hide_cursor();
+		_fmemcpy(&data.pos, MK_FP(r.w.es, r.w.dx), TSRDATA_APP_STATE_SIZE);
+		// The saved state does not include the video mode, which may have changed since
+		reload_video_info();
+		graphic_cursor_changed();
+#if USE_INTEGRATION
+		load_cursor();
+#endif
+		refresh_cursor();
 		break;
 	case INT33_SET_MOUSE_SENSITIVITY:
 		dprintf("Mouse set sensitivity x=%d y=%d threshold=%d\n",
@@ -1305,6 +2590,36 @@ static void int33_handler(union INTPACK r)
 		r.w.es = FP_SEG(&data);
 		r.w.di = FP_OFF(&data);
 		break;
+	case INT33_GET_QUEUED_EVENTS:
+	    {
+		    struct int33_queued_event __far *buf = MK_FP(r.w.es, r.w.di);
+		    unsigned count = 0;
+
+		    data.queue_pull = true;
+		    while (count < r.w.cx && dequeue_event(&buf[count])) {
+			    count++;
+		    }
+
+		    r.w.cx = count;
+		    r.w.bx = data.queue_count;
+		    r.w.dx = data.queue_lost;
+		    data.queue_lost = 0;
+	    }
+		break;
+	case INT33_SET_RAW_EVENT_HANDLER:
+		dprintf("Set raw event handler version=%u\n", r.w.bx);
+		if (r.w.bx == INT33_RAW_API_VERSION) {
+			data.raw_handler = MK_FP(r.w.es, r.w.dx);
+			data.raw_host_cursor_status = get_host_cursor_status();
+		}
+		r.w.ax = INT33_RAW_API_MAGIC;
+		r.w.bx = INT33_RAW_API_VERSION;
+		break;
+	case INT33_GET_HOST_CURSOR_STATUS:
+		dputs("Get host cursor status");
+		r.w.ax = INT33_RAW_API_MAGIC;
+		r.w.bx = get_host_cursor_status();
+		break;
 	default:
 		dprintf("Unknown mouse function ax=%x\n", r.w.ax);
 		break;
@@ -1315,6 +2630,69 @@ static void int33_handler(union INTPACK r)
 void __declspec(naked) __far int33_isr(void)
 {
 	__asm {
+#if USE_INT33_FASTPATH
+		; Programs often call the polling functions in a tight loop,
+		; so answer them here without going through int33_handler.
+		; wasm doesn't support structs, see the TSRDATA_*_OFFSET defines.
+		; Interrupts are disabled, so the mouse state can't change under us.
+		cmp byte ptr cs:[data + TSRDATA_DEFER_OFFSET], 0
+		jne slow_path ; Need to process deferred events first
+		cmp ax, 0x3 ; INT33_GET_MOUSE_POSITION
+		je get_position
+		cmp ax, 0xB ; INT33_GET_MOUSE_MOTION
+		je get_motion
+		cmp ax, 0x5 ; INT33_GET_BUTTON_PRESSED_COUNTER
+		je get_counter
+		cmp ax, 0x6 ; INT33_GET_BUTTON_RELEASED_COUNTER
+		jne slow_path
+
+	get_counter:
+		cmp bx, NUM_BUTTONS
+		jae slow_path ; Wheel counter or out of range button
+		push si
+		imul si, bx, TSRDATA_BUTTON_SIZE
+		cmp al, 0x5
+		je get_counter_pressed
+		add si, TSRDATA_BUTTON_SIZE / 2 ; released counter follows the pressed one
+	get_counter_pressed:
+		mov cx, cs:[data + TSRDATA_GRANULARITY_OFFSET]
+		neg cx
+		and cx, cs:[data + si + TSRDATA_BUTTON_OFFSET] ; last.x
+		mov dx, cs:[data + TSRDATA_GRANULARITY_OFFSET + 2]
+		neg dx
+		and dx, cs:[data + si + TSRDATA_BUTTON_OFFSET + 2] ; last.y
+		mov bx, cs:[data + si + TSRDATA_BUTTON_OFFSET + 4] ; count
+		mov word ptr cs:[data + si + TSRDATA_BUTTON_OFFSET + 4], 0
+		mov ax, cs:[data + TSRDATA_BUTTONS_OFFSET]
+		pop si
+		iret
+
+	get_position:
+		mov cx, cs:[data + TSRDATA_GRANULARITY_OFFSET]
+		neg cx
+		and cx, cs:[data + TSRDATA_POS_OFFSET]
+		mov dx, cs:[data + TSRDATA_GRANULARITY_OFFSET + 2]
+		neg dx
+		and dx, cs:[data + TSRDATA_POS_OFFSET + 2]
+		mov bx, cs:[data + TSRDATA_BUTTONS_OFFSET]
+#if USE_WHEEL
+		cmp byte ptr cs:[data + TSRDATA_HASWHEEL_OFFSET], 0
+		je get_position_done
+		mov bh, cs:[data + TSRDATA_WHEEL_DELTA_OFFSET]
+		mov word ptr cs:[data + TSRDATA_WHEEL_DELTA_OFFSET], 0
+	get_position_done:
+#endif
+		iret
+
+	get_motion:
+		mov cx, cs:[data + TSRDATA_DELTA_OFFSET]
+		mov dx, cs:[data + TSRDATA_DELTA_OFFSET + 2]
+		mov word ptr cs:[data + TSRDATA_DELTA_OFFSET], 0
+		mov word ptr cs:[data + TSRDATA_DELTA_OFFSET + 2], 0
+		iret
+
+	slow_path:
+#endif
 		pusha
 		push ds
 		push es
@@ -1396,18 +2774,38 @@ static void int2f_handler(union INTPACK r)
 		data.w386_startup.device_driver = 0;
 		data.w386_startup.device_driver_data = 0;
 		data.w386_startup.instance_data = &data.w386_instance;
-		data.w386_instance[0].ptr = &data;
-		data.w386_instance[0].size = sizeof(data);
+		// Only the per-VM part, so that Windows has less to copy on every VM switch
+		data.w386_instance[0].ptr = &data.pos;
+		data.w386_instance[0].size = TSRDATA_INSTANCE_SIZE;
 		data.w386_instance[1].ptr = 0;
 		data.w386_instance[1].size = 0;
 		r.w.es = FP_SEG(&data.w386_startup);
 		r.w.bx = FP_OFF(&data.w386_startup);
 		data.haswin386 = true;
+		data.hw_ok = false;
+#if USE_PS2_DIRECT
+		data.ps2directactive = false;
+#endif
 		break;
 	case INT2F_NOTIFY_WIN386_SHUTDOWN:
 		dputs("Windows is stopping");
 		data.haswin386 = false;
 		data.w386cursor = false;
+		data.hw_ok = false;
+		break;
+	case INT2F_NOTIFY_BACKGROUND_SWITCH:
+		// Another VM may reprogram the mouse in the meantime
+		data.hw_ok = false;
+		break;
+	case INT2F_NOTIFY_FOREGROUND_SWITCH:
+		data.hw_ok = false;
+		// The host cursor shape is not per-VM; it may be another VM's now.
+#if USE_VIRTUALBOX
+		data.vbshapeloaded = false;
+#endif
+#if USE_VMWSVGA
+		data.vmwsvgashapeloaded = false;
+#endif
 		break;
 	case INT2F_NOTIFY_DEVICE_CALLOUT:
 		switch (r.w.bx) {
@@ -1456,6 +2854,189 @@ void __declspec(naked) __far int2f_isr(void)
 }
 #endif
 
+static void int1c_handler(void)
+#pragma aux int1c_handler "*" modify [ax bx cx dx si di es fs gs]
+{
+#if USE_VIRTUALBOX
+	if (data.vbavail) apply_host_cursor_visibility();
+#endif
+
+	if (data.in_mouse_event) {
+		// We interrupted the processing of a mouse event; the state is
+		// half updated, so leave everything for the next tick.
+	} else if (data.defer) {
+		process_deferred();
+	} else if (data.cursor_dirty) {
+		// Redraw the cursor if it was left for later (e.g. due to framecap).
+		refresh_cursor();
+	}
+
+	// Tell the raw event handler if the host cursor status changed meanwhile
+	// (e.g. due to a video mode change), so that it does not have to ask.
+	if (data.raw_handler && !data.in_mouse_event) {
+		uint16_t status = get_host_cursor_status();
+
+		if (status != data.raw_host_cursor_status) {
+			data.raw_host_cursor_status = status;
+			call_raw_event_handler(data.raw_handler, 0, data.buttons, 0, 0, status);
+		}
+	}
+
+	// Report motion held back by the rate limit,
+	// unless we interrupted the event handler itself or a mouse event.
+	if (data.pending_events && !data.in_event_handler && !data.in_mouse_event
+	        && data.event_handler && rate_window_elapsed()) {
+		post_events(0, data.buttons);
+	}
+
+	data.prev_int1c_handler();
+}
+
+void __declspec(naked) __far int1c_isr(void)
+{
+	__asm {
+		pusha
+		push ds
+		push es
+		push fs
+		push gs
+
+		push cs
+		pop ds
+
+		call int1c_handler
+
+		pop gs
+		pop fs
+		pop es
+		pop ds
+		popa
+
+		iret
+	}
+}
+
+/** Called before the video BIOS changes the video mode or font.
+ *  @return the previous value of in_refresh, for int10_post_handler. */
+static bool int10_pre_handler(void)
+#pragma aux int10_pre_handler "*" value [al] modify [ax bx cx dx si di es fs gs]
+{
+	bool was_in_refresh = data.in_refresh;
+
+	// Remove the cursor while we still know how it was drawn,
+	hide_cursor();
+	// and do not draw it again until the BIOS is done.
+	data.in_refresh = true;
+
+	return was_in_refresh;
+}
+
+/** Called after the video BIOS has changed the video mode or font.
+ *  @param function the original int10 ax.
+ *  @param was_in_refresh what int10_pre_handler returned. */
+static void int10_post_handler(uint16_t function, bool was_in_refresh)
+#pragma aux int10_post_handler "*" parm [ax] [dl] modify [ax bx cx dx si di es fs gs]
+{
+	data.in_refresh = was_in_refresh;
+	if (was_in_refresh) {
+		// The BIOS was called from within a redraw (or another mode change);
+		// let that finish first and redraw later.
+		data.cursor_dirty = true;
+	}
+
+	if ((function >> 8) == INT10_LOAD_FONT) {
+		// Only the number of text rows may have changed
+		refresh_video_info();
+	} else {
+		// Even if the mode number is the same, the screen was cleared
+		reset_video_info();
+	}
+
+	refresh_cursor();
+}
+
+void __declspec(naked) __far int10_isr(void)
+{
+	__asm {
+		; wasm doesn't support structs, see TSRDATA_PREV_INT10_OFFSET
+		test ah, ah ; INT10_SET_MODE
+		jz mode_change
+		cmp ah, 0x11 ; INT10_LOAD_FONT
+		jne check_vbe
+		cmp al, 0x30 ; Anything below 1130h (get font information) loads a font
+		jb mode_change
+		jmp dword ptr cs:[data + TSRDATA_PREV_INT10_OFFSET]
+	check_vbe:
+		cmp ax, 0x4F02 ; INT10_VBE_SET_MODE
+		je mode_change
+#if USE_VBE
+		cmp ax, 0x4F05 ; INT10_VBE_WINDOW
+		jne chain
+		test bx, bx ; Set window position (bh = 0) of window A (bl = 0)
+		jnz chain
+		; Remember it, so that drawing the cursor does not need to ask the BIOS
+		mov cs:[data + TSRDATA_VBE_APP_WINDOW_OFFSET], dx
+	chain:
+#endif
+		jmp dword ptr cs:[data + TSRDATA_PREV_INT10_OFFSET]
+
+	mode_change:
+		push ax ; Keep the function number for int10_post_handler
+		push ax ; and room for what int10_pre_handler returns
+
+		pusha
+		push ds
+		push es
+		push fs
+		push gs
+
+		push cs
+		pop ds
+
+		call int10_pre_handler
+
+		; 8 + 4 saved registers, 24 bytes, then the room for the result
+		mov bp, sp
+		mov [bp + 24], al
+
+		pop gs
+		pop fs
+		pop es
+		pop ds
+		popa
+
+		; Let the BIOS do the actual mode change
+		pushf
+		call dword ptr cs:[data + TSRDATA_PREV_INT10_OFFSET]
+
+		pusha
+		push ds
+		push es
+		push fs
+		push gs
+
+		; 8 + 4 saved registers, 24 bytes, then what int10_pre_handler returned
+		; and the function number
+		mov bp, sp
+		mov dl, [bp + 24]
+		mov ax, [bp + 26]
+
+		push cs
+		pop ds
+
+		call int10_post_handler
+
+		pop gs
+		pop fs
+		pop es
+		pop ds
+		popa
+
+		add sp, 4 ; Discard the function number and the pre handler result
+		iret
+	}
+}
+
 static LPTSRDATA int33_get_tsr_data(void);
 #pragma aux int33_get_tsr_data = \
 	"xor ax, ax" \
@@ -1477,4 +3058,13 @@ LPTSRDATA __far get_tsr_data(bool installed)
 	}
 }
 
+unsigned __far get_resident_size(void)
+{
+#if USE_VIRTUALBOX
+	return FP_OFF(resident_vbox_code_end);
+#else
+	return FP_OFF(&resident_end);
+#endif
+}
+
 int resident_end;
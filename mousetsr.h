@@ -25,6 +25,7 @@
 
 #include "int2fwin.h"
 #include "int10vga.h"
+#include "int33.h"
 
 // User customizable defines
 
@@ -36,6 +37,16 @@
 #define USE_WIN386 1
 /** Enable the wheel. */
 #define USE_WHEEL 1
+/** Keep statistics of merged events and of the VMware absolute pointer queue */
+#define USE_STATS 1
+/** Draw the cursor in VESA BIOS extensions (SVGA) modes */
+#define USE_VBE 1
+/** Allow reading the PS/2 mouse directly from IRQ12 instead of through the BIOS */
+#define USE_PS2_DIRECT 1
+/** Answer the int33 calls programs use for polling (3, 5, 6, 0Bh) directly from assembly */
+#define USE_INT33_FASTPATH 1
+/** Let the host draw the cursor through the VMware SVGA II cursor registers */
+#define USE_VMWSVGA 1
 /** Trace events verbosily */
 #define TRACE_EVENTS 0
 
@@ -47,15 +58,66 @@
 
 #define USE_INTEGRATION (USE_VIRTUALBOX || USE_VMWARE)
 
+#if USE_VMWARE && USE_STATS
+/** Number of buckets in the VMware queue depth histogram:
+ *  1, 2, 3-4, 5-8, 9-16 and more than 16 packets. */
+#define VMW_QUEUE_HIST_SIZE 6
+#endif
+
 /** Max size of PS/2 packet that we support. */
 #define MAX_PS2_PACKET_SIZE 4
 
 /** Maximum number of 55ms ticks that may pass between two bytes of the same PS/2 packet */
 #define MAX_PS2_PACKET_DELAY 2
 
+/** Number of consecutive IRQ12s without mouse data in the keyboard controller
+ *  after which we stop reading it directly and go back to the BIOS. */
+#define MAX_PS2_DIRECT_BAD_IRQS 8
+
+/** Number of events that can be queued for deferred delivery or INT33_GET_QUEUED_EVENTS.
+ *  Must be a power of 2. */
+#define EVENT_QUEUE_SIZE 16
+
+/** With framecap, minimum time (in PIT clocks) between two cursor redraws
+ *  caused by mouse events. One frame at 70Hz, but not synchronized with the retrace. */
+#define FRAME_CAP_TIME (PIT_FREQUENCY / 70)
+
 /** Number of buttons reported back to user programs. */
 #define NUM_BUTTONS 3
 
+/** Offsets of the TSRDATA fields used from assembly (int10_isr, int15_isr and the int33 fast path),
+ *  since the inline assembler cannot access structure members.
+ *  They come right after the other previous interrupt handler pointers. */
+#if USE_WIN386
+#define TSRDATA_PREV_INT10_OFFSET     12
+#else
+#define TSRDATA_PREV_INT10_OFFSET     8
+#endif
+#if USE_PS2_DIRECT
+#define TSRDATA_PREV_INT15_OFFSET     (TSRDATA_PREV_INT10_OFFSET + 4)
+#define TSRDATA_HANDLERS_END_OFFSET   (TSRDATA_PREV_INT15_OFFSET + 4)
+#else
+#define TSRDATA_HANDLERS_END_OFFSET   (TSRDATA_PREV_INT10_OFFSET + 4)
+#endif
+#if USE_VBE
+#define TSRDATA_VBE_APP_WINDOW_OFFSET TSRDATA_HANDLERS_END_OFFSET
+#define TSRDATA_DEFER_OFFSET          (TSRDATA_VBE_APP_WINDOW_OFFSET + 2)
+#else
+#define TSRDATA_DEFER_OFFSET          TSRDATA_HANDLERS_END_OFFSET
+#endif
+#define TSRDATA_HASWHEEL_OFFSET       (TSRDATA_DEFER_OFFSET + 1)
+#define TSRDATA_POS_OFFSET            (TSRDATA_DEFER_OFFSET + 2)
+#define TSRDATA_DELTA_OFFSET          (TSRDATA_POS_OFFSET + 4)
+#define TSRDATA_GRANULARITY_OFFSET    (TSRDATA_POS_OFFSET + 8)
+#define TSRDATA_BUTTONS_OFFSET        (TSRDATA_POS_OFFSET + 12)
+#define TSRDATA_WHEEL_DELTA_OFFSET    (TSRDATA_POS_OFFSET + 14)
+#define TSRDATA_BUTTON_OFFSET         (TSRDATA_POS_OFFSET + 16)
+/** Size of each entry of the button array: pressed and released counters. */
+#define TSRDATA_BUTTON_SIZE           12
+
+/** Value of vbe_app_window when we do not know where the program left the window. */
+#define VBE_WINDOW_UNKNOWN 0xFFFFU
+
 /** Size of int33 graphic cursor shape definitions. */
 #define GRAPHIC_CURSOR_WIDTH 16
 #define GRAPHIC_CURSOR_HEIGHT 16
@@ -63,12 +125,40 @@
 #define GRAPHIC_CURSOR_MASK_LEN (GRAPHIC_CURSOR_HEIGHT * GRAPHIC_CURSOR_SCANLINE_LEN)
 #define GRAPHIC_CURSOR_DATA_LEN (2 * GRAPHIC_CURSOR_MASK_LEN)
 
+/** Size of the per-VM buffer where we save the contents below the cursor.
+ *  Worst case is 8bpp; planar modes need 4 planes of 3 bytes per scanline. */
+#define GRAPHIC_CURSOR_PREV_LEN (GRAPHIC_CURSOR_WIDTH * GRAPHIC_CURSOR_HEIGHT)
+
+#if USE_VBE
+/** Size of each of the pre-shifted graphic cursor masks.
+ *  Worst case is 32bpp: 4 bytes per pixel, a single alignment. */
+#define GRAPHIC_CURSOR_SHIFTED_MASK_LEN (GRAPHIC_CURSOR_WIDTH * GRAPHIC_CURSOR_HEIGHT * 4)
+/** Size of the shared buffer where we save the contents below the cursor
+ *  in VBE modes with more than 8bpp (worst case 32bpp). */
+#define GRAPHIC_CURSOR_PREV_VBE_LEN (GRAPHIC_CURSOR_WIDTH * GRAPHIC_CURSOR_HEIGHT * 4)
+#else
+/** Size of each of the pre-shifted graphic cursor masks.
+ *  Worst case is 1bpp: 8 sub-byte alignments of 3 bytes per scanline. */
+#define GRAPHIC_CURSOR_SHIFTED_MASK_LEN (8 * GRAPHIC_CURSOR_HEIGHT * 3)
+#endif
+
 #if USE_VIRTUALBOX
 #include "vbox.h"
 
 /** Size of the VBox buffer. The maximum message length that may be sent.
  *  Enough to fit a set_pointer_shape message with a 16x16 cursor.  */
 #define VBOX_BUFFER_SIZE (1024 + 32 + 24 + 20)
+
+/** Size of the VBox buffer used from the VMMDev interrupt handler.
+ *  Enough to fit an acknowledge events message. */
+#define VBOX_IRQ_BUFFER_SIZE (24 + 4)
+
+/** VMMDev events we want to be interrupted for. */
+#define VBOX_IRQ_EVENTS (VMMDEV_EVENT_MOUSE_POSITION_CHANGED | VMMDEV_EVENT_MOUSE_CAPABILITIES_CHANGED)
+#endif
+
+#if USE_VMWSVGA
+#include "vmwsvga.h"
 #endif
 
 struct point {
@@ -82,44 +172,55 @@ typedef struct tsrdata {
 #if USE_WIN386
 	void (__interrupt __far *prev_int2f_handler)();
 #endif
-	// Settings configured via the command line
-#if USE_WHEEL
-	/** Whether to enable & use wheel mouse. */
-	bool usewheel;
-	/** Key (scancode) to generate on wheel scroll up/down, or 0 for none. */
-	uint16_t wheel_up_key, wheel_down_key;
+	/** Previous int1c (timer tick) ISR. */
+	void (__interrupt __far *prev_int1c_handler)();
+	/** Previous int10 (video BIOS) ISR, called by int10_isr. */
+	void (__interrupt __far *prev_int10_handler)();
+#if USE_PS2_DIRECT
+	/** Previous int15 (system BIOS) ISR, called by int15_isr; only hooked along with IRQ12. */
+	void (__interrupt __far *prev_int15_handler)();
+#endif
+#if USE_VBE
+	/** Position of VBE window A as last set through int10 (recorded by int10_isr),
+	 *  or VBE_WINDOW_UNKNOWN, e.g. after a mode change. */
+	uint16_t vbe_app_window;
 #endif
 
-	// Video settings
-	/** Information of the current video mode. */
-	struct modeinfo video_mode;
-	/** Max (virtual) coordinates of full screen in the current mode.
-	 *  Used for rendering graphic cursor, mapping absolute coordinates,
-	 *  and initializing the default min/max window. */
-	struct point screen_max;
-	/** In some modes, the virtual coordinates are larger than the
-	 *  physical screen coordinates.
-	 *  real coordinates = virtual coordinates * screen_scale. */
-	struct point screen_scale;
+	// Settings read by the int33 fast path, shared by all VMs;
+	// see the TSRDATA_*_OFFSET defines.
+	/** Whether to call the event handler and redraw the cursor from the timer tick
+	 *  (or the next int33 call) rather than from the PS/2 interrupt. */
+	bool defer;
+	/** Whether the current mouse has a wheel (and support is enabled).
+	 *  Always present (but false without USE_WHEEL) to keep the offsets fixed. */
+	bool haswheel;
+
+	// Per-VM instance data.
+	// Under Windows 386, each VM gets its own copy of everything from here
+	// until the shared settings below (see TSRDATA_INSTANCE_SIZE);
+	// Windows copies it on every VM switch, so keep it small.
+	// It starts with the state visible to applications, which is also what
+	// int33 functions 15h-17h save and restore (see TSRDATA_APP_STATE_SIZE).
+
+	// Fields read by the int33 fast path in int33_isr.
+	// Keep them in this order, right after haswheel; see the TSRDATA_*_OFFSET defines.
+	/** Current cursor position (in pixels). */
+	struct point pos;
+	/** Current delta movement (in mickeys) since the last report. */
+	struct point delta;
 	/** In text modes, we want to snap the cursor position to the cell grid.
 	 *  This stores the desired grid granularity. */
 	struct point screen_granularity;
-
-	// Detected mouse hardware & status
-#if USE_WHEEL
-	/** Whether the current mouse has a wheel (and support is enabled). */
-	bool haswheel;
-#endif
-	/** Packet size that the BIOS is currently using. Either 1 (streaming) or 3 (plain). */
-	uint8_t bios_packet_size;
-	/** Packet size that we are currently expecting internally. Usually 3 (plain) or 4 (with wheel). */
-	uint8_t packet_size;
-	/** For streaming mode: number of bytes received so far (< packet_size). */
-	uint8_t cur_packet_bytes;
-	/** Stores the bytes received so far (cur_bytes). */
-	uint8_t ps2_packet[MAX_PS2_PACKET_SIZE];
-	/** Number of ticks at the point when we started to receive this packet. */
-	uint16_t cur_packet_ticks;
+	/** Current status of buttons (as bitfield). */
+	uint16_t buttons;
+	/** Total delta movement of the wheel since the last wheel report. */
+	int16_t wheel_delta;
+	struct {
+		struct buttoncounter {
+			struct point last;
+			uint16_t count;
+		} pressed, released;
+	} button[NUM_BUTTONS];
 
 	// Current mouse settings
 	/** Mouse sensitivity/speed. */
@@ -132,6 +233,11 @@ typedef struct tsrdata {
 	struct point max;
 	/** Current cursor visible counter. If >= 0, cursor should be shown. */
 	int16_t visible_count;
+	/** Whether the exclusion area is active, in which case the cursor is hidden
+	 *  while over it (until the next show cursor call). */
+	bool exclusion;
+	/** Exclusion area (in virtual coordinates, inclusive). */
+	struct point exclusion_min, exclusion_max;
 	/** For text cursor, whether this is a software or hardware cursor. */
 	uint8_t cursor_text_type;
 	/** Masks for the text cursor. */
@@ -140,6 +246,14 @@ typedef struct tsrdata {
 	struct point cursor_hotspot;
 	/** Masks for the graphic cursor. */
 	uint16_t cursor_graphic[GRAPHIC_CURSOR_DATA_LEN/sizeof(uint16_t)];
+#if USE_VIRTUALBOX
+	/** The VirtualBox host already has this graphic cursor shape. */
+	bool vbshapeloaded;
+#endif
+#if USE_VMWSVGA
+	/** The VMware SVGA host already has this graphic cursor shape. */
+	bool vmwsvgashapeloaded;
+#endif
 #if USE_WHEEL
 	/** Whether someone asked for the int33 wheel API, in which case we
 	 *  should send them wheel movement rather than fake keypresses. */
@@ -147,13 +261,9 @@ typedef struct tsrdata {
 #endif
 
 	// Current mouse status
-	/** Current cursor position (in pixels). */
-	struct point pos;
 	/** Current remainder of movement that does not yet translate to an entire pixel
 	 *  (8ths of pixel). */
 	struct point pos_frac;
-	/** Current delta movement (in mickeys) since the last report. */
-	struct point delta;
 	/** Current remainder of delta movement that does not yet translate to an entire mickey
 	 *  Usually only when mickeysPerLine is not a multiple of 8. */
 	struct point delta_frac;
@@ -163,19 +273,29 @@ typedef struct tsrdata {
 	uint16_t total_motion;
 	/** Ticks when the above value was last reset. */
 	uint16_t last_motion_ticks;
-	/** Current status of buttons (as bitfield). */
-	uint16_t buttons;
-	struct {
-		struct buttoncounter {
-			struct point last;
-			uint16_t count;
-		} pressed, released;
-	} button[NUM_BUTTONS];
-	/** Total delta movement of the wheel since the last wheel report. */
-	int16_t wheel_delta;
 	/** Last position where the wheel was moved. */
 	struct point wheel_last;
 
+	// Current handlers
+	/** Address of the event handler. */
+	void (__far *event_handler)();
+	/** Events for which we should call the event handler. */
+	uint16_t event_mask;
+
+	// Per-VM state not visible to applications
+
+	// Video settings
+	/** Information of the current video mode. */
+	struct modeinfo video_mode;
+	/** Max (virtual) coordinates of full screen in the current mode.
+	 *  Used for rendering graphic cursor, mapping absolute coordinates,
+	 *  and initializing the default min/max window. */
+	struct point screen_max;
+	/** In some modes, the virtual coordinates are larger than the
+	 *  physical screen coordinates.
+	 *  real coordinates = virtual coordinates * screen_scale. */
+	struct point screen_scale;
+
 	// Cursor information
 	/** Whether the cursor is currently displayed or not. */
 	bool cursor_visible;
@@ -184,14 +304,141 @@ typedef struct tsrdata {
 	/** For text mode cursor, the character data that was displayed below the cursor. */
 	uint16_t cursor_prev_char;
 	/** For graphical mode cursor, contents of the screen that were displayed below
-	 *  the cursor before the cursor was drawn. */
-	uint8_t cursor_prev_graphic[GRAPHIC_CURSOR_WIDTH * GRAPHIC_CURSOR_HEIGHT];
+	 *  the cursor before the cursor was drawn. Modes above 8bpp use cursor_prev_graphic_vbe. */
+	uint8_t cursor_prev_graphic[GRAPHIC_CURSOR_PREV_LEN];
+#if USE_VBE
+	/** Identifies what this VM saved in cursor_prev_graphic_vbe, or 0 if nothing.
+	 *  Assigned from cursor_shape_serial, like cursor_shape_id. */
+	uint16_t cursor_prev_vbe_id;
+#endif
+	/** Identifies the current graphic cursor shape and video mode depth
+	 *  among those of all VMs, to know if the shared shifted masks are ours.
+	 *  Assigned from cursor_shape_serial, and never 0. */
+	uint16_t cursor_shape_id;
+	/** In planar modes, whether to save the contents below the cursor to
+	 *  off-screen video memory using the VGA latches (instead of cursor_prev_graphic),
+	 *  and draw the cursor on all planes at once using the VGA ALU. */
+	bool cursor_latches;
+#if USE_VBE
+	/** In VBE modes, current position of the window while drawing the cursor. */
+	uint16_t vbe_window;
+#endif
 
-	// Current handlers
-	/** Address of the event handler. */
-	void (__far *event_handler)();
-	/** Events for which we should call the event handler. */
-	uint16_t event_mask;
+	// Event handler state
+	/** Motion events not yet reported to the event handler due to the rate limit. */
+	uint16_t pending_events;
+	/** Time (in PIT clocks) of the last event handler call. */
+	uint32_t last_handler_time;
+	/** Whether we are currently calling the event handler. */
+	bool in_event_handler;
+	/** Whether we are in the middle of processing a mouse event,
+	 *  in which case the mouse state may be half updated. */
+	bool in_mouse_event;
+	/** Address of the raw event handler (see INT33_SET_RAW_EVENT_HANDLER), or NULL. */
+	void (__far *raw_handler)();
+	/** Host cursor status last given to the raw event handler. */
+	uint16_t raw_host_cursor_status;
+
+	// Event queue
+	/** Whether a program is reading events using INT33_GET_QUEUED_EVENTS,
+	 *  in which case the queue is left for it instead of being delivered to the event handler. */
+	bool queue_pull;
+	/** Whether the cursor position changed but the cursor has not been redrawn yet. */
+	bool cursor_dirty;
+	/** Whether we are currently redrawing the cursor. */
+	bool in_refresh;
+	/** Time (in PIT clocks) the cursor was last redrawn, for framecap. */
+	uint32_t last_refresh_time;
+	/** Whether a deferred delivery is in progress. */
+	bool in_deferred;
+	/** Index of the oldest event in the queue, and number of events in it. */
+	uint8_t queue_head, queue_count;
+	/** Number of events dropped since the last INT33_GET_QUEUED_EVENTS call. */
+	uint16_t queue_lost;
+	struct int33_queued_event queue[EVENT_QUEUE_SIZE];
+
+	// Shared by all VMs from here on.
+
+	// Settings configured via the command line.
+	// rate_window must stay first; it marks the end of the instance data.
+	/** Minimum time (in PIT clocks) between two event handler calls
+	 *  that only report motion, or 0 for no limit. */
+	uint32_t rate_window;
+	/** Whether to redraw the cursor after a mouse event at most once per
+	 *  FRAME_CAP_TIME (leaving the rest for the timer tick), instead of immediately. */
+	bool frame_cap;
+#if USE_WHEEL
+	/** Whether to enable & use wheel mouse. */
+	bool usewheel;
+	/** Key (scancode) to generate on wheel scroll up/down, or 0 for none. */
+	uint16_t wheel_up_key, wheel_down_key;
+#endif
+#if USE_PS2_DIRECT
+	/** Whether to read the mouse bytes from the keyboard controller in our own IRQ12 handler,
+	 *  instead of waiting for the BIOS to call us for each one. */
+	bool ps2direct;
+#endif
+
+	// Detected mouse hardware & status
+	/** Whether the mouse hardware was successfully initialized and is still in a known state,
+	 *  so that int33 resets do not need to initialize it again. */
+	bool hw_ok;
+	/** Device ID the mouse reported once initialized, used to check
+	 *  on every reset whether someone else reinitialized it since. */
+	uint8_t device_id;
+	/** Packet size that the BIOS is currently using. Either 1 (streaming) or 3 (plain). */
+	uint8_t bios_packet_size;
+	/** Packet size that we are currently expecting internally. Usually 3 (plain) or 4 (with wheel). */
+	uint8_t packet_size;
+	/** For streaming mode: number of bytes received so far (< packet_size). */
+	uint8_t cur_packet_bytes;
+	/** Stores the bytes received so far (cur_bytes). */
+	uint8_t ps2_packet[MAX_PS2_PACKET_SIZE];
+	/** Number of ticks at the point when we started to receive this packet. */
+	uint16_t cur_packet_ticks;
+#if USE_PS2_DIRECT
+	/** Whether our IRQ12 handler is currently reading the mouse bytes,
+	 *  or just passing the interrupt to the BIOS. */
+	bool ps2directactive;
+	/** Number of consecutive IRQ12s that found no mouse byte in the keyboard controller. */
+	uint8_t ps2directbad;
+	/** Previous IRQ12 handler (usually the BIOS), or NULL if not hooked. */
+	void (__interrupt __far *prev_int74_handler)();
+#endif
+
+	// Graphic cursor drawing cache
+	/** Last cursor_shape_id (or cursor_prev_vbe_id) assigned to any VM. */
+	uint16_t cursor_shape_serial;
+	/** cursor_shape_id of the VM the shifted masks below were built for,
+	 *  or 0 if they are stale (e.g. borrowed as scratch space). */
+	uint16_t cursor_shifted_id;
+	/** Graphic cursor masks expanded to the current bits per pixel,
+	 *  one copy for each possible sub-byte alignment of the cursor.
+	 *  Only one VM draws at a time, so they are shared and rebuilt when another VM draws. */
+	uint8_t cursor_shifted_and_mask[GRAPHIC_CURSOR_SHIFTED_MASK_LEN];
+	uint8_t cursor_shifted_xor_mask[GRAPHIC_CURSOR_SHIFTED_MASK_LEN];
+#if USE_VBE
+	/** cursor_prev_vbe_id of the VM whose screen contents are in cursor_prev_graphic_vbe. */
+	uint16_t cursor_prev_vbe_owner;
+	/** Contents below the cursor in VBE modes above 8bpp. Too large to copy on every
+	 *  VM switch, and such modes are rarely used by more than one VM at once,
+	 *  so it is shared; a VM whose contents were overwritten cannot restore them. */
+	uint8_t cursor_prev_graphic_vbe[GRAPHIC_CURSOR_PREV_VBE_LEN];
+#endif
+
+#if USE_STATS
+	/** Number of motion events merged into a later event handler call. */
+	uint32_t merged_events;
+	/** Calls to the event handler and to the raw event handler,
+	 *  and the PIT clocks spent inside them, so that the time it takes
+	 *  to deliver an event each way can be compared. */
+	struct handlerstats {
+		uint32_t calls;
+		uint32_t clocks;
+	} handler_stats, raw_handler_stats;
+#endif
+	/** How much of this struct was kept resident, see the end of it. */
+	uint16_t resident_data_size;
 
 #if USE_WIN386
 	/** Information that we pass to Windows 386 on startup. */
@@ -211,16 +458,83 @@ typedef struct tsrdata {
 	bool vbwantcursor : 1;
 	/** Have VirtualBox absolute coordinates. */
 	bool vbhaveabs : 1;
-	struct vboxcomm vb;
-	char vbbuf[VBOX_BUFFER_SIZE];
+	/** Whether the host is interrupting us when the mouse moves,
+	 *  so that we only need to ask for the position when vbdirty is set. */
+	bool vbirq : 1;
+	/** Whether we unmasked the VMMDev IRQ at the PIC, to restore it on uninstall. */
+	bool vbirqunmasked : 1;
+	/** Set by the VMMDev IRQ handler when the host position or capabilities changed.
+	 *  Not a bitfield since it is written from the interrupt handler. */
+	bool vbdirty;
+	/** Set while the main VirtualBox buffer (vb) is being used,
+	 *  so that the timer tick does not use it at the same time. */
+	bool vbbusy;
+	/** The visibility of the host cursor may need to be updated;
+	 *  done at most once per timer tick or mouse event. */
+	bool vbcursorpending;
+	/** Last absolute position received from VirtualBox (0...0xFFFF). */
+	uint16_t vbx, vby;
+	/** Previous handler of the VMMDev IRQ vector, or NULL if not hooked. */
+	void (__interrupt __far *prev_vbirq_handler)();
 #endif
 
 #if USE_VMWARE
 	/** VMware is available. */
 	bool vmwavail;
 #endif
+
+#if USE_VMWSVGA
+	/** VMware SVGA II device with cursor support is available. */
+	bool vmwsvgaavail : 1;
+	/** Want to use the SVGA II "host" cursor. */
+	bool vmwsvgawantcursor : 1;
+	/** The host is drawing the cursor in the current video mode. */
+	bool vmwsvgacursor : 1;
+	struct vmwsvga vmwsvga;
+#endif
+
+	// Data only needed by some integrations, which is discarded
+	// at install time if they were not detected.
+	// Keep it at the end, ordered from least to most likely to be discarded:
+	// everything from the first discarded field on is left out of the resident image.
+#if USE_VMWARE && USE_STATS
+	/** Statistics of the VMware absolute pointer queue. */
+	struct vmwstats {
+		/** Number of times the queue was drained (i.e. PS/2 packets with VMware data). */
+		uint32_t drains;
+		/** Number of VMware packets read. */
+		uint32_t packets;
+		/** Number of motion packets merged into the next one. */
+		uint32_t merged;
+		/** Depth of the queue (in packets) the last time it was drained. */
+		uint16_t last_depth;
+		/** Largest depth of the queue so far. */
+		uint16_t max_depth;
+		/** How many times the queue had a given depth, see VMW_QUEUE_HIST_SIZE. */
+		uint32_t depth_hist[VMW_QUEUE_HIST_SIZE];
+	} vmwstats;
+#endif
+#if USE_VIRTUALBOX
+	struct vboxcomm vb;
+	char vbbuf[VBOX_BUFFER_SIZE];
+	/** Separate buffer for the interrupt handler,
+	 *  as it may interrupt a request being built in the main one. */
+	struct vboxcomm vbirqcomm;
+	char vbirqbuf[VBOX_IRQ_BUFFER_SIZE];
+#endif
 } TSRDATA;
 
+/** The per-VM instance data that Windows 386 keeps a copy of for each VM:
+ *  from pos until the shared settings. */
+#define TSRDATA_INSTANCE_OFFSET       TSRDATA_POS_OFFSET
+#define TSRDATA_INSTANCE_SIZE         (offsetof(TSRDATA, rate_window) - TSRDATA_INSTANCE_OFFSET)
+/** The part of the instance data visible to applications,
+ *  saved and restored by int33 functions 15h-17h. */
+#define TSRDATA_APP_STATE_SIZE        (offsetof(TSRDATA, video_mode) - TSRDATA_INSTANCE_OFFSET)
+
+/** Whether a field from the discardable end of TSRDATA was kept resident. */
+#define TSRDATA_IS_RESIDENT(data, field) (offsetof(TSRDATA, field) < (data)->resident_data_size)
+
 typedef TSRDATA * PTSRDATA;
 typedef TSRDATA __far * LPTSRDATA;
 
@@ -228,15 +542,35 @@ extern void __declspec(naked) __far int33_isr(void);
 
 extern void __declspec(naked) __far int2f_isr(void);
 
+extern void __declspec(naked) __far int1c_isr(void);
+
+extern void __declspec(naked) __far int10_isr(void);
+
+#if USE_PS2_DIRECT
+extern void __declspec(naked) __far ps2_irq_isr(void);
+
+extern void __declspec(naked) __far int15_isr(void);
+#endif
+
+#if USE_VIRTUALBOX
+extern void __declspec(naked) __far vbox_irq_isr(void);
+#endif
+
 extern LPTSRDATA __far get_tsr_data(bool installed);
 
-/** This symbol is always at the end of the TSR segment */
+/** This symbol is always at the end of the TSR data,
+ *  right after data (so that the end of TSRDATA can be discarded).
+ *  Only the VirtualBox code comes after it (see vbmouse.lnk),
+ *  which is discarded along with the end of TSRDATA. */
 extern int resident_end;
 
-/** This is not just data, but the entire segment. */
-static inline unsigned get_resident_size(void)
-{
-	return FP_OFF(&resident_end);
-}
+#if USE_VIRTUALBOX
+/** This symbol is always at the end of the VirtualBox code (mousvbox.c),
+ *  and therefore of the entire resident image. */
+extern void resident_vbox_code_end(void);
+#endif
+
+/** This is not just data, but the entire resident image. */
+extern unsigned __far get_resident_size(void);
 
 #endif /* MOUSETSR_H */
@@ -25,15 +25,20 @@
 #include "int33.h"
 #include "int21dos.h"
 #include "int2fwin.h"
+#include "int31dpm.h"
 #include "mousew16.h"
 
 /** Whether to enable wheel mouse handling. */
 #define USE_WHEEL 1
+/** Whether to let the host draw the cursor instead of the display driver. */
+#define USE_HOST_CURSOR 1
 /** Verbosely log events as they happen. */
 #define TRACE_EVENTS 0
 
 #define MOUSE_NUM_BUTTONS 2
 
+/** Our module instance, as given to LibMain. */
+static HINSTANCE hInstance;
 /** The routine Windows gave us which we should use to report events. */
 static LPFN_MOUSEEVENT eventproc;
 /** Current status of the driver. */
@@ -47,6 +52,13 @@ static struct {
 } flags;
 /** Previous deltaX, deltaY from the int33 mouse callback (for relative motion) */
 static short prev_delta_x, prev_delta_y;
+/** Real mode address of the DPMI callback that VBMOUSE.EXE calls with raw events,
+ *  or NULL if we are using a regular int33 event handler. */
+static void __far *raw_callback;
+/** Registers of the real mode caller of raw_callback. */
+static dpmi_rm_regs raw_callback_regs;
+/** Previous buttons from the raw event handler (to find out button transitions). */
+static uint16_t prev_raw_buttons;
 /** Maximum X and Y coordinates expected from the int33 driver. */
 static unsigned short max_x, max_y;
 #if USE_WHEEL
@@ -60,7 +72,80 @@ static struct {
 	LONG WINAPI (*GetWindowLong)( HWND, int );
 	BOOL WINAPI (*EnumChildWindows)( HWND, WNDENUMPROC, LPARAM );
 	BOOL WINAPI (*PostMessage)( HWND, UINT, WPARAM, LPARAM );
+	BOOL WINAPI (*IsWindow)( HWND );
+	HHOOK WINAPI (*SetWindowsHook)( int, HOOKPROC );
+	BOOL WINAPI (*UnhookWindowsHook)( int, HOOKPROC );
+	LRESULT WINAPI (*DefHookProc)( int, WPARAM, LPARAM, HHOOK FAR * );
+	ATOM WINAPI (*RegisterClass)( const WNDCLASS FAR * );
+	BOOL WINAPI (*UnregisterClass)( LPCSTR, HINSTANCE );
+	HWND WINAPI (*CreateWindow)( LPCSTR, LPCSTR, DWORD, int, int, int, int, HWND, HMENU, HINSTANCE, void FAR * );
+	BOOL WINAPI (*DestroyWindow)( HWND );
+	LRESULT WINAPI (*DefWindowProc)( HWND, UINT, WPARAM, LPARAM );
 } userapi;
+/** Class name of our hidden wake-up window. */
+#define WHEEL_WINDOW_CLASS "VBMouseWheel"
+/** Message posted to the wake-up window when there is wheel movement pending. */
+#define WM_WHEEL_PENDING WM_USER
+/** Wheel notches pending at once that are sent as a page instead of a line. */
+#define WHEEL_NOTCHES_PER_PAGE 8
+/** Wheel movement waiting to be sent, and where we sent the last one. */
+static struct {
+	/** Notches of wheel movement received since the last dispatch.
+	 *  Written from the mouse callback, read from the message hook. */
+	volatile int16_t pending;
+	/** Previous WH_GETMESSAGE hook, or NULL if ours is not installed. */
+	HHOOK prev_hook;
+	/** Hidden window we post to from the mouse callback to get into task context,
+	 *  or NULL if it could not be created. */
+	HWND wakeup;
+	/** The window that was below the cursor the last time... */
+	HWND last_window;
+	/** ...and the window we sent the scroll messages to, with the message. */
+	HWND target;
+	UINT msg;
+} wheel;
+#endif
+#if USE_HOST_CURSOR
+/** Width and height of the int33 graphic cursor. */
+#define INT33_CURSOR_SIZE 16
+/** Largest display driver cursor shape we keep a copy of (32x32). */
+#define SAVED_CURSOR_SIZE (sizeof(CURSORSHAPE) + 2 * 32 * (32 / 8))
+/** A display driver entry point that we overwrite with a far jump to our own. */
+typedef struct {
+	/** The original entry point. */
+	FARPROC proc;
+	/** Handle of its code segment, which we keep fixed while patched. */
+	HGLOBAL hcode;
+	/** Writable alias of the same address. */
+	uint8_t __far *code;
+	/** Original first bytes of the entry point, overwritten by the jump. */
+	uint8_t saved[5];
+	/** The jump to our replacement. */
+	uint8_t jump[5];
+} DISPLAYPATCH;
+/** State of the host cursor. */
+static struct {
+	DISPLAYPATCH set_cursor, move_cursor, check_cursor;
+	/** Whether the display driver entry points are patched. */
+	bool hooked : 1;
+	/** Whether the host is drawing the cursor instead of the display driver. */
+	bool host : 1;
+	/** Whether we asked the int33 driver to show its cursor. */
+	bool visible : 1;
+	/** Whether shape contains the current cursor shape. */
+	bool saved : 1;
+	/** Last position given to MoveCursor. */
+	unsigned short x, y;
+	/** INT33_HOST_CURSOR_STATUS bits, as last given to raw_mouse_handler,
+	 *  so that MoveCursor does not have to ask VBMOUSE.EXE every time. */
+	volatile uint16_t status;
+	/** Copy of the current cursor shape, to give it back to the display driver
+	 *  if the host stops drawing the cursor. */
+	uint8_t shape[SAVED_CURSOR_SIZE];
+	/** Conventional memory buffer for the int33 cursor masks,
+	 *  as a protected mode selector and as a real mode segment. */
+	uint16_t dos_sel, dos_seg;
+} cursor;
 #endif
 
 /* This is how events are delivered to Windows */
@@ -95,35 +180,20 @@ static BOOL CALLBACK __loadds find_scrollbar(HWND hWnd, LPARAM lParam)
 	return TRUE;
 }
 
-static void send_wheel_movement(int8_t z)
+/** Finds the window that should get the scroll messages for the given window,
+ *  and which message (WM_VSCROLL or WM_HSCROLL) to send it.
+ *  @return NULL if there is no scrollable window. */
+static HWND find_scroll_target(HWND hWnd, UINT FAR *msg)
 {
-	POINT point;
-	HWND hWnd;
-	WPARAM wParam;
-
-#if TRACE_EVENTS
-	dprintf("w16mouse: wheel=%d\n", z);
-#endif
-
-	// TODO It's highly unlikely that we can call this many functions from
-	// an interrupt handler without causing a re-entrancy issue somewhere.
-	// Likely it would be better to just move all of this into a hook .DLL
-
-	userapi.GetCursorPos(&point);
-
-	hWnd = userapi.WindowFromPoint(point);
-
 	while (hWnd) {
 		LONG style = userapi.GetWindowLong(hWnd, GWL_STYLE);
 
 		if (style & WS_VSCROLL) {
-			wParam = z < 0 ? SB_LINEUP : SB_LINEDOWN;
-			userapi.PostMessage(hWnd, WM_VSCROLL, wParam, 0);
-			break;
+			*msg = WM_VSCROLL;
+			return hWnd;
 		} else if (style & WS_HSCROLL) {
-			wParam = z < 0 ? SB_LINELEFT : SB_LINERIGHT;
-			userapi.PostMessage(hWnd, WM_HSCROLL, wParam, 0);
-			break;
+			*msg = WM_HSCROLL;
+			return hWnd;
 		} else {
 			FINDSCROLLBARDATA data = {0};
 
@@ -131,9 +201,8 @@ static void send_wheel_movement(int8_t z)
 			userapi.EnumChildWindows(hWnd, find_scrollbar, (LONG) (LPVOID) &data);
 			if (data.scrollbar) {
 				// Assume vertical scrolling
-				wParam = z < 0 ? SB_LINEUP : SB_LINEDOWN;
-				userapi.PostMessage(hWnd, WM_VSCROLL, wParam, 0);
-				break;
+				*msg = WM_VSCROLL;
+				return hWnd;
 			}
 
 			if (style & WS_CHILD) {
@@ -145,6 +214,137 @@ static void send_wheel_movement(int8_t z)
 			}
 		}
 	}
+
+	return NULL;
+}
+
+/** Whether target is hWnd itself or one of the parents find_scroll_target() would try. */
+static bool is_scroll_target_of(HWND target, HWND hWnd)
+{
+	while (hWnd) {
+		if (hWnd == target) {
+			return true;
+		} else if (userapi.GetWindowLong(hWnd, GWL_STYLE) & WS_CHILD) {
+			hWnd = userapi.GetParent(hWnd);
+		} else {
+			break;
+		}
+	}
+
+	return false;
+}
+
+/** Sends the pending wheel movement to the window below the cursor.
+ *  Only called from the message hook or the wake-up window, i.e. never at interrupt time. */
+static void dispatch_wheel_movement(void)
+{
+	POINT point;
+	HWND hWnd;
+	WPARAM wParam;
+	int16_t z, step;
+
+	_disable();
+	z = wheel.pending;
+	wheel.pending = 0;
+	_enable();
+
+	if (!z) {
+		return;
+	}
+
+	userapi.GetCursorPos(&point);
+	hWnd = userapi.WindowFromPoint(point);
+
+	// Walking the window tree (EnumChildWindows in particular) is slow,
+	// so reuse the previous target as long as the cursor is still over the same window.
+	// The window we last scrolled may have been destroyed since then,
+	// and its handle reused by another window, so check that the target
+	// is still the window itself or one of its parents.
+	if (hWnd != wheel.last_window
+	        || (wheel.target && !is_scroll_target_of(wheel.target, hWnd))) {
+		wheel.last_window = hWnd;
+		wheel.target = find_scroll_target(hWnd, &wheel.msg);
+	}
+
+#if TRACE_EVENTS
+	dprintf("w16mouse: dispatch wheel=%d target=0x%x\n", z, wheel.target);
+#endif
+
+	if (!wheel.target) {
+		return;
+	}
+
+	// Post a single message for all of the notches we can merge into it:
+	// a page if there are enough of them, otherwise a line.
+	// The rest are left pending for the hook, which runs again when the target
+	// retrieves this message; so there is at most one of ours in its queue,
+	// which in Windows 3.x only has room for 8 messages by default.
+	step = (z < 0 ? -z : z) >= WHEEL_NOTCHES_PER_PAGE ? WHEEL_NOTCHES_PER_PAGE : 1;
+
+	if (wheel.msg == WM_VSCROLL) {
+		if (step > 1) {
+			wParam = z < 0 ? SB_PAGEUP : SB_PAGEDOWN;
+		} else {
+			wParam = z < 0 ? SB_LINEUP : SB_LINEDOWN;
+		}
+	} else {
+		if (step > 1) {
+			wParam = z < 0 ? SB_PAGELEFT : SB_PAGERIGHT;
+		} else {
+			wParam = z < 0 ? SB_LINELEFT : SB_LINERIGHT;
+		}
+	}
+
+	if (!userapi.PostMessage(wheel.target, wheel.msg, wParam, 0)) {
+		return; // The queue is full; drop this movement
+	}
+
+	z += z < 0 ? step : -step;
+	if (z) {
+		_disable();
+		wheel.pending += z;
+		_enable();
+	}
+}
+
+/** WH_GETMESSAGE hook, called whenever any task retrieves a message,
+ *  which is where we can safely look for the window to scroll. */
+static LRESULT CALLBACK __loadds wheel_hook_proc(int code, WPARAM wParam, LPARAM lParam)
+{
+	if (code >= 0 && wheel.pending) {
+		dispatch_wheel_movement();
+	}
+
+	return userapi.DefHookProc(code, wParam, lParam, &wheel.prev_hook);
+}
+
+/** Window procedure of the hidden wake-up window. */
+static LRESULT CALLBACK __loadds wheel_wnd_proc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
+{
+	if (msg == WM_WHEEL_PENDING) {
+		// Usually the hook will already have dispatched it by now
+		dispatch_wheel_movement();
+		return 0;
+	}
+
+	return userapi.DefWindowProc(hWnd, msg, wParam, lParam);
+}
+
+/** Queues wheel movement, to be sent from the message hook.
+ *  Called from the mouse callback, i.e. at interrupt time. */
+static void send_wheel_movement(int8_t z)
+{
+#if TRACE_EVENTS
+	dprintf("w16mouse: wheel=%d\n", z);
+#endif
+
+	// Wake up our own window's task, so that the hook runs soon.
+	// PostMessage is one of the few functions that can be called at interrupt time.
+	if (!wheel.pending && wheel.wakeup) {
+		userapi.PostMessage(wheel.wakeup, WM_WHEEL_PENDING, 0, 0);
+	}
+
+	wheel.pending += z;
 }
 #endif /* USE_WHEEL */
 
@@ -212,21 +412,526 @@ static void FAR int33_mouse_callback(uint16_t events, uint16_t buttons, int16_t
 	send_event(status, x, y, MOUSE_NUM_BUTTONS, 0, 0);
 }
 
+/** Called by VBMOUSE.EXE (through raw_dpmi_callback) with every mouse event,
+ *  already in the units Windows wants, see INT33_SET_RAW_EVENT_HANDLER. */
+static void raw_mouse_handler(uint16_t events, uint16_t buttons, uint16_t x, uint16_t y,
+                              uint16_t host_cursor_status)
+#pragma aux raw_mouse_handler "*" loadds parm [ax] [bx] [cx] [dx] [si] modify [ax bx cx dx si di es]
+{
+	uint16_t changed = (buttons ^ prev_raw_buttons) & 0xFF;
+	int status = 0;
+
+#if TRACE_EVENTS
+	dprintf("w16mouse: raw events=0x%x buttons=0x%x x=%u y=%u\n",
+	        events, buttons, x, y);
+#endif
+
+#if USE_HOST_CURSOR
+	cursor.status = host_cursor_status;
+#else
+	(void) host_cursor_status;
+#endif
+
+	if (changed & INT33_BUTTON_MASK_LEFT) {
+		status |= buttons & INT33_BUTTON_MASK_LEFT ? SF_B1_DOWN : SF_B1_UP;
+	}
+	if (changed & INT33_BUTTON_MASK_RIGHT) {
+		status |= buttons & INT33_BUTTON_MASK_RIGHT ? SF_B2_DOWN : SF_B2_UP;
+	}
+	prev_raw_buttons = buttons;
+
+	if (events & INT33_EVENT_MASK_MOVEMENT) {
+		status |= SF_MOVEMENT;
+	}
+
+#if USE_WHEEL
+	if (flags.wheel && (events & INT33_EVENT_MASK_WHEEL_MOVEMENT)) {
+		int8_t z = (buttons & 0xFF00) >> 8;
+		if (z) {
+			send_wheel_movement(z);
+		}
+	}
+#endif
+
+	if (events & INT33_EVENT_MASK_ABSOLUTE) {
+		// Already from 0 to 0xFFFF, which is what Windows wants
+		status |= SF_ABSOLUTE;
+	}
+
+	if (status) {
+		send_event(status, x, y, MOUSE_NUM_BUTTONS, 0, 0);
+	}
+}
+
+/** Entry point of the DPMI real mode callback, called by VBMOUSE.EXE
+ *  as a far real mode routine with the raw_mouse_handler parameters. */
+static void __declspec(naked) __far raw_dpmi_callback(void)
+{
+	__asm {
+		; ds:si points to the real mode stack, es:di to raw_callback_regs.
+		; Return to the real mode caller as a far ret would.
+		cld
+		lodsw
+		mov es:[di + DPMI_RM_REGS_IP_OFFSET], ax
+		lodsw
+		mov es:[di + DPMI_RM_REGS_CS_OFFSET], ax
+		add word ptr es:[di + DPMI_RM_REGS_SP_OFFSET], 4
+
+		push es
+		push di
+		mov ax, es:[di + DPMI_RM_REGS_EAX_OFFSET]
+		mov bx, es:[di + DPMI_RM_REGS_EBX_OFFSET]
+		mov cx, es:[di + DPMI_RM_REGS_ECX_OFFSET]
+		mov dx, es:[di + DPMI_RM_REGS_EDX_OFFSET]
+		mov si, es:[di + DPMI_RM_REGS_ESI_OFFSET]
+		call raw_mouse_handler
+		pop di
+		pop es
+
+		iret
+	}
+}
+
+#if USE_HOST_CURSOR
+static inline void display_patch(DISPLAYPATCH *p)
+{
+	_fmemcpy(p->code, p->jump, sizeof(p->jump));
+}
+
+static inline void display_unpatch(DISPLAYPATCH *p)
+{
+	_fmemcpy(p->code, p->saved, sizeof(p->saved));
+}
+
+/* To call the original display driver entry points, we temporarily restore them.
+ * Interrupts stay disabled meanwhile, since MoveCursor is called at interrupt time
+ * and must not find its entry point (or SetCursor's) half restored.
+ * This does not add much to the interrupt latency: besides copying the 5 bytes
+ * of the jump twice, it is only as long as the display driver routine itself.
+ * MoveCursor and CheckCursor are already called at interrupt time anyway, and
+ * SetCursor only copies one cursor shape, usually 32x32.
+ * Nothing that may take longer, like asking VBMOUSE.EXE for the host cursor
+ * status or uploading the shape to the host, is done with interrupts disabled. */
+
+static void call_display_set_cursor(LPCURSORSHAPE shape)
+{
+	uint16_t flags = save_flags_cli();
+	display_unpatch(&cursor.set_cursor);
+	((LPFN_SETCURSOR) cursor.set_cursor.proc)(shape);
+	display_patch(&cursor.set_cursor);
+	restore_flags(flags);
+}
+
+static void call_display_move_cursor(unsigned short x, unsigned short y)
+{
+	uint16_t flags = save_flags_cli();
+	display_unpatch(&cursor.move_cursor);
+	((LPFN_MOVECURSOR) cursor.move_cursor.proc)(x, y);
+	display_patch(&cursor.move_cursor);
+	restore_flags(flags);
+}
+
+static void call_display_check_cursor(void)
+{
+	uint16_t flags = save_flags_cli();
+	display_unpatch(&cursor.check_cursor);
+	((LPFN_CHECKCURSOR) cursor.check_cursor.proc)();
+	display_patch(&cursor.check_cursor);
+	restore_flags(flags);
+}
+
+/** @return INT33_HOST_CURSOR_STATUS bits from VBMOUSE.EXE.
+ *  Far, since it is also called from outside this segment. */
+static uint16_t FAR get_host_cursor_status(void)
+{
+	dpmi_rm_regs regs;
+
+	_fmemset(&regs, 0, sizeof(regs));
+	regs.eax = INT33_GET_HOST_CURSOR_STATUS;
+
+	if (!dpmi_simulate_real_mode_interrupt(0x33, &regs)
+	        || (uint16_t) regs.eax != INT33_RAW_API_MAGIC) {
+		return 0;
+	}
+
+	return regs.ebx;
+}
+
+static inline bool cursor_mask_bit(const uint8_t __far *mask, int width_bytes, int x, int y)
+{
+	return (mask[y * width_bytes + x / 8] >> (7 - x % 8)) & 1;
+}
+
+/** Converts a display driver cursor shape into an int33 graphic cursor
+ *  and passes it to the int33 driver, which uploads it to the host.
+ *  int33 cursors are only 16x16, so we keep the 16x16 area starting at
+ *  the top left visible pixel, moved if necessary to contain the hotspot.
+ *  @return false if the int33 driver could not be called. */
+static bool load_host_cursor(LPCURSORSHAPE shape)
+{
+	const uint8_t __far *and_mask = (const uint8_t __far *) (shape + 1);
+	const uint8_t __far *xor_mask = and_mask + shape->csHeight * shape->csWidthBytes;
+	uint16_t __far *masks = MK_FP(cursor.dos_sel, 0);
+	int left = shape->csWidth, top = shape->csHeight;
+	int x, y;
+	dpmi_rm_regs regs;
+
+	for (y = 0; y < shape->csHeight; y++) {
+		for (x = 0; x < left; x++) {
+			if (!cursor_mask_bit(and_mask, shape->csWidthBytes, x, y)
+			        || cursor_mask_bit(xor_mask, shape->csWidthBytes, x, y)) {
+				left = x;
+				if (y < top) top = y;
+				break;
+			}
+		}
+	}
+
+	left = MAX(MIN(left, shape->csHotX), shape->csHotX - (INT33_CURSOR_SIZE - 1));
+	top = MAX(MIN(top, shape->csHotY), shape->csHotY - (INT33_CURSOR_SIZE - 1));
+
+	for (y = 0; y < INT33_CURSOR_SIZE; y++) {
+		// Pixels outside the shape are transparent (AND 1, XOR 0)
+		uint16_t and_line = 0xFFFFU, xor_line = 0;
+
+		for (x = 0; x < INT33_CURSOR_SIZE; x++) {
+			int sx = left + x, sy = top + y;
+
+			if (sx < 0 || sy < 0 || sx >= shape->csWidth || sy >= shape->csHeight) {
+				continue;
+			}
+			if (!cursor_mask_bit(and_mask, shape->csWidthBytes, sx, sy)) {
+				and_line &= ~(0x8000U >> x);
+			}
+			if (cursor_mask_bit(xor_mask, shape->csWidthBytes, sx, sy)) {
+				xor_line |= 0x8000U >> x;
+			}
+		}
+
+		masks[y] = and_line;
+		masks[INT33_CURSOR_SIZE + y] = xor_line;
+	}
+
+	// The int33 driver expects a real mode address for the masks
+	_fmemset(&regs, 0, sizeof(regs));
+	regs.eax = INT33_SET_GRAPHICS_CURSOR;
+	regs.ebx = shape->csHotX - left;
+	regs.ecx = shape->csHotY - top;
+	regs.es = cursor.dos_seg;
+	regs.edx = 0;
+
+	return dpmi_simulate_real_mode_interrupt(0x33, &regs);
+}
+
+/** Keeps a copy of the given cursor shape in cursor.shape, if it fits.
+ *  @return false if there is no shape or it does not fit. */
+static bool save_cursor_shape(LPCURSORSHAPE shape)
+{
+	unsigned size;
+
+	if (!shape || shape->csWidthBytes <= 0 || shape->csHeight <= 0) {
+		return false;
+	}
+
+	size = sizeof(CURSORSHAPE) + 2 * shape->csHeight * shape->csWidthBytes;
+	if (size > sizeof(cursor.shape)) {
+		return false;
+	}
+
+	_fmemcpy(cursor.shape, shape, size);
+	return true;
+}
+
+/** Stops letting the host draw the cursor, and gives the display driver the shape instead. */
+static void stop_host_cursor(LPCURSORSHAPE shape)
+{
+	bool was_host = cursor.host;
+
+	if (cursor.visible) {
+		int33_hide_cursor();
+		cursor.visible = false;
+	}
+	cursor.host = false;
+
+	call_display_set_cursor(shape);
+
+	if (was_host) {
+		// The display driver has not seen the cursor move meanwhile
+		call_display_move_cursor(cursor.x, cursor.y);
+	}
+}
+
+/** Falls back to the display driver if the host is no longer drawing the cursor,
+ *  e.g. after a video mode change or if VirtualBox stops sending absolute positions.
+ *  Uses the status VBMOUSE.EXE last gave us, which it updates at most a timer tick
+ *  after it changes; calling into it from every MoveCursor would be too slow. */
+static void check_host_cursor(void)
+{
+	if (cursor.host && !(cursor.status & INT33_HOST_CURSOR_ACTIVE)) {
+		stop_host_cursor(cursor.saved ? (LPCURSORSHAPE) cursor.shape : NULL);
+	}
+}
+
+/** Replaces the display driver's SetCursor.
+ *  If the host can draw the cursor in the current video mode,
+ *  hides the display driver's cursor and gives the shape to the host. */
+static VOID FAR PASCAL __loadds hook_set_cursor(LPCURSORSHAPE shape)
+{
+	// Only let the host draw shapes we can give back to the display driver later on
+	cursor.saved = save_cursor_shape(shape);
+
+	// SetCursor is rare enough to ask VBMOUSE.EXE for the current status
+	cursor.status = get_host_cursor_status();
+
+	if (cursor.saved && (cursor.status & INT33_HOST_CURSOR_ACTIVE)
+	        && load_host_cursor(shape)) {
+		if (!cursor.host) {
+			call_display_set_cursor(NULL);
+			cursor.host = true;
+		}
+		if (!cursor.visible) {
+			int33_show_cursor();
+			cursor.visible = true;
+		}
+		return;
+	}
+
+	stop_host_cursor(shape);
+}
+
+/** Replaces the display driver's MoveCursor.
+ *  The host already knows where the cursor is, as long as it is still drawing it. */
+static VOID FAR PASCAL __loadds hook_move_cursor(unsigned short x, unsigned short y)
+{
+	cursor.x = x;
+	cursor.y = y;
+
+	check_host_cursor();
+
+	if (!cursor.host) {
+		call_display_move_cursor(x, y);
+	}
+}
+
+/** Replaces the display driver's CheckCursor.
+ *  Nothing to redraw if the host draws the cursor. */
+static VOID FAR PASCAL __loadds hook_check_cursor(VOID)
+{
+	check_host_cursor();
+
+	if (!cursor.host) {
+		call_display_check_cursor();
+	}
+}
+#endif /* USE_HOST_CURSOR */
+
 #pragma code_seg ()
 
+/** Asks VBMOUSE.EXE to send us the raw events directly, through a DPMI callback,
+ *  instead of using a regular int33 event handler.
+ *  @return false if not running in protected mode, or the int33 driver
+ *          is not a (compatible) VBMOUSE.EXE. */
+static bool set_raw_event_handler(void)
+{
+	dpmi_rm_regs regs;
+
+	if (!(GetWinFlags() & WF_PMODE)) {
+		return false;
+	}
+
+	raw_callback = dpmi_allocate_callback(raw_dpmi_callback, &raw_callback_regs);
+	if (!raw_callback) {
+		return false;
+	}
+
+	// Need to call the int33 driver directly, as it expects a real mode address
+	_fmemset(&regs, 0, sizeof(regs));
+	regs.eax = INT33_SET_RAW_EVENT_HANDLER;
+	regs.ebx = INT33_RAW_API_VERSION;
+	regs.es = FP_SEG(raw_callback);
+	regs.edx = FP_OFF(raw_callback);
+
+	if (!dpmi_simulate_real_mode_interrupt(0x33, &regs)
+	        || (uint16_t) regs.eax != INT33_RAW_API_MAGIC
+	        || (uint16_t) regs.ebx != INT33_RAW_API_VERSION) {
+		dpmi_free_callback(raw_callback);
+		raw_callback = NULL;
+		return false;
+	}
+
+	prev_raw_buttons = 0;
+
+	return true;
+}
+
+#if USE_HOST_CURSOR
+static bool init_display_patch(DISPLAYPATCH *p, HMODULE hDisplay, int ordinal, FARPROC hook)
+{
+	UINT alias;
+
+	p->proc = GetProcAddress(hDisplay, MAKEINTRESOURCE(ordinal));
+	if (!p->proc) {
+		return false;
+	}
+
+	// The patch would be lost if the segment were discarded and reloaded,
+	// and the alias would be left pointing to the old place if it moved.
+	p->hcode = (HGLOBAL) LOWORD(GlobalHandle(FP_SEG(p->proc)));
+	if (!p->hcode || !LockSegment(FP_SEG(p->proc))) {
+		p->proc = NULL;
+		return false;
+	}
+	GlobalFix(p->hcode);
+
+	// Code segments are not writable, so we need a data alias of it
+	alias = AllocCSToDSAlias(FP_SEG(p->proc));
+	if (!alias) {
+		GlobalUnfix(p->hcode);
+		UnlockSegment(FP_SEG(p->proc));
+		p->proc = NULL;
+		return false;
+	}
+	p->code = MK_FP(alias, FP_OFF(p->proc));
+
+	_fmemcpy(p->saved, p->code, sizeof(p->saved));
+
+	p->jump[0] = 0xEA; // jmp far
+	p->jump[1] = FP_OFF(hook) & 0xFF;
+	p->jump[2] = FP_OFF(hook) >> 8;
+	p->jump[3] = FP_SEG(hook) & 0xFF;
+	p->jump[4] = FP_SEG(hook) >> 8;
+
+	return true;
+}
+
+static void free_display_patch(DISPLAYPATCH *p)
+{
+	if (p->proc) {
+		FreeSelector(FP_SEG(p->code));
+		GlobalUnfix(p->hcode);
+		UnlockSegment(FP_SEG(p->proc));
+		p->proc = NULL;
+	}
+}
+
+/** Restores the display driver entry points, and hides the host cursor. */
+static void unhook_display_cursor(void)
+{
+	if (cursor.hooked) {
+		_disable();
+		_fmemcpy(cursor.set_cursor.code, cursor.set_cursor.saved, sizeof(cursor.set_cursor.saved));
+		_fmemcpy(cursor.move_cursor.code, cursor.move_cursor.saved, sizeof(cursor.move_cursor.saved));
+		_fmemcpy(cursor.check_cursor.code, cursor.check_cursor.saved, sizeof(cursor.check_cursor.saved));
+		_enable();
+		cursor.hooked = false;
+	}
+
+	if (cursor.visible) {
+		int33_hide_cursor();
+		cursor.visible = false;
+	}
+	cursor.host = false;
+
+	free_display_patch(&cursor.set_cursor);
+	free_display_patch(&cursor.move_cursor);
+	free_display_patch(&cursor.check_cursor);
+
+	if (cursor.dos_sel) {
+		GlobalDOSFree(cursor.dos_sel);
+		cursor.dos_sel = 0;
+	}
+}
+
+/** If VBMOUSE.EXE can use a host cursor, patches the display driver's
+ *  cursor entry points so that we can pass the cursor shape to the host. */
+static void hook_display_cursor(void)
+{
+	HMODULE hDisplay;
+	DWORD dosmem;
+
+	cursor.status = get_host_cursor_status();
+	if (!(cursor.status & INT33_HOST_CURSOR_AVAILABLE)) {
+		return;
+	}
+
+	hDisplay = GetModuleHandle("DISPLAY");
+	if (!hDisplay) {
+		return;
+	}
+
+	dosmem = GlobalDOSAlloc(2 * INT33_CURSOR_SIZE * sizeof(uint16_t));
+	if (!dosmem) {
+		return;
+	}
+	cursor.dos_seg = HIWORD(dosmem);
+	cursor.dos_sel = LOWORD(dosmem);
+
+	if (!init_display_patch(&cursor.set_cursor, hDisplay, DISPLAY_ORD_SET_CURSOR, (FARPROC) hook_set_cursor)
+	        || !init_display_patch(&cursor.move_cursor, hDisplay, DISPLAY_ORD_MOVE_CURSOR, (FARPROC) hook_move_cursor)
+	        || !init_display_patch(&cursor.check_cursor, hDisplay, DISPLAY_ORD_CHECK_CURSOR, (FARPROC) hook_check_cursor)) {
+		unhook_display_cursor();
+		return;
+	}
+
+	cursor.host = false;
+	cursor.visible = false;
+	cursor.saved = false;
+	cursor.x = 0;
+	cursor.y = 0;
+
+	_disable();
+	_fmemcpy(cursor.set_cursor.code, cursor.set_cursor.jump, sizeof(cursor.set_cursor.jump));
+	_fmemcpy(cursor.move_cursor.code, cursor.move_cursor.jump, sizeof(cursor.move_cursor.jump));
+	_fmemcpy(cursor.check_cursor.code, cursor.check_cursor.jump, sizeof(cursor.check_cursor.jump));
+	_enable();
+
+	cursor.hooked = true;
+}
+#endif /* USE_HOST_CURSOR */
+
 /* Driver exported functions. */
 
+#if USE_WHEEL
+/** Creates the hidden window that the mouse callback posts to when there is wheel movement.
+ *  @return the window, or NULL if it could not be created. */
+static HWND create_wheel_window(void)
+{
+	WNDCLASS wc;
+	HWND hWnd;
+
+	memset(&wc, 0, sizeof(wc));
+	wc.lpfnWndProc = wheel_wnd_proc;
+	wc.hInstance = hInstance;
+	wc.lpszClassName = WHEEL_WINDOW_CLASS;
+
+	if (!userapi.RegisterClass(&wc)) {
+		return NULL;
+	}
+
+	// Never shown; not even given a size.
+	hWnd = userapi.CreateWindow(WHEEL_WINDOW_CLASS, NULL, WS_OVERLAPPED, 0, 0, 0, 0,
+	                            NULL, NULL, hInstance, NULL);
+	if (!hWnd) {
+		userapi.UnregisterClass(WHEEL_WINDOW_CLASS, hInstance);
+	}
+
+	return hWnd;
+}
+#endif
+
 /** DLL entry point (or driver initialization routine).
  * The initialization routine should check whether a mouse exists.
  * @return nonzero value indicates a mouse exists.
  */
 #pragma off (unreferenced)
-BOOL FAR PASCAL LibMain(HINSTANCE hInstance, WORD wDataSegment,
+BOOL FAR PASCAL LibMain(HINSTANCE hInst, WORD wDataSegment,
                         WORD wHeapSize, LPSTR lpszCmdLine)
 #pragma pop (unreferenced)
 {
 	uint16_t version = int33_get_driver_version();
 
+	hInstance = hInst;
+
 	// For now we just check for the presence of any int33 driver version
 	if (version == 0) {
 		// No one responded to our request, we can assume no driver
@@ -274,9 +979,34 @@ VOID FAR PASCAL Enable(LPFN_MOUSEEVENT lpEventProc)
 			userapi.GetWindowLong = (LPVOID) GetProcAddress(userapi.hUser, "GetWindowLong");
 			userapi.EnumChildWindows = (LPVOID) GetProcAddress(userapi.hUser, "EnumChildWindows");
 			userapi.PostMessage = (LPVOID) GetProcAddress(userapi.hUser, "PostMessage");
+			userapi.IsWindow = (LPVOID) GetProcAddress(userapi.hUser, "IsWindow");
+			userapi.SetWindowsHook = (LPVOID) GetProcAddress(userapi.hUser, "SetWindowsHook");
+			userapi.UnhookWindowsHook = (LPVOID) GetProcAddress(userapi.hUser, "UnhookWindowsHook");
+			userapi.DefHookProc = (LPVOID) GetProcAddress(userapi.hUser, "DefHookProc");
+			userapi.RegisterClass = (LPVOID) GetProcAddress(userapi.hUser, "RegisterClass");
+			userapi.UnregisterClass = (LPVOID) GetProcAddress(userapi.hUser, "UnregisterClass");
+			userapi.CreateWindow = (LPVOID) GetProcAddress(userapi.hUser, "CreateWindow");
+			userapi.DestroyWindow = (LPVOID) GetProcAddress(userapi.hUser, "DestroyWindow");
+			userapi.DefWindowProc = (LPVOID) GetProcAddress(userapi.hUser, "DefWindowProc");
+
+			wheel.pending = 0;
+			wheel.last_window = NULL;
+			wheel.target = NULL;
+			wheel.wakeup = create_wheel_window();
+			wheel.prev_hook = userapi.SetWindowsHook(WH_GETMESSAGE, wheel_hook_proc);
 		}
 #endif
 
+		if (set_raw_event_handler()) {
+			// VBMOUSE.EXE will send us coordinates in the range Windows wants,
+			// so there is nothing else to set up.
+#if USE_HOST_CURSOR
+			hook_display_cursor();
+#endif
+			flags.enabled = true;
+			return;
+		}
+
 		// Set the speed to 1,1 to enlarge dosemu coordinate range by 8x16 times.
 		// In other absolute drivers, this doesn't change coordinates nor actual speed (which is inherited from host)
 		// In normal relative drivers, we'll use the raw mickeys anyways, so speed should also have no effect.
@@ -306,7 +1036,25 @@ VOID FAR PASCAL Enable(LPFN_MOUSEEVENT lpEventProc)
 VOID FAR PASCAL Disable(VOID)
 {
 	if (flags.enabled) {
+#if USE_HOST_CURSOR
+		unhook_display_cursor();
+#endif
 		int33_reset(); // This removes our handler and all other settings
+#if USE_WHEEL
+		if (flags.wheel) {
+			userapi.UnhookWindowsHook(WH_GETMESSAGE, wheel_hook_proc);
+			wheel.prev_hook = NULL;
+			if (wheel.wakeup) {
+				userapi.DestroyWindow(wheel.wakeup);
+				wheel.wakeup = NULL;
+				userapi.UnregisterClass(WHEEL_WINDOW_CLASS, hInstance);
+			}
+		}
+#endif
+		if (raw_callback) {
+			dpmi_free_callback(raw_callback);
+			raw_callback = NULL;
+		}
 		flags.enabled = false;
 	}
 }
@@ -40,6 +40,36 @@ typedef MOUSEINFO __far *LPMOUSEINFO;
 /** Event coordinates are absolute instead of relative. */
 #define SF_ABSOLUTE 0x8000
 
+/* Display driver's cursor interface. */
+
+/** Ordinals of the display driver's cursor entry points. */
+enum display_ordinals {
+	/** VOID FAR PASCAL SetCursor(LPCURSORSHAPE lpCursorShape), NULL to hide it. */
+	DISPLAY_ORD_SET_CURSOR   = 102,
+	/** VOID FAR PASCAL MoveCursor(WORD absX, WORD absY), in screen pixels. */
+	DISPLAY_ORD_MOVE_CURSOR  = 103,
+	/** VOID FAR PASCAL CheckCursor(VOID), called on every timer tick. */
+	DISPLAY_ORD_CHECK_CURSOR = 104,
+};
+
+/** Cursor shape passed to the display driver,
+ *  followed by the AND mask and then the XOR mask (1bpp, MSB first). */
+typedef _Packed struct CURSORSHAPE
+{
+	short   csHotX;
+	short   csHotY;
+	short   csWidth;
+	short   csHeight;
+	/** Bytes per scanline in each mask. */
+	short   csWidthBytes;
+	short   csColor;
+} CURSORSHAPE;
+typedef CURSORSHAPE __far *LPCURSORSHAPE;
+
+typedef void (__far __pascal *LPFN_SETCURSOR)(LPCURSORSHAPE lpCursorShape);
+typedef void (__far __pascal *LPFN_MOVECURSOR)(unsigned short absX, unsigned short absY);
+typedef void (__far __pascal *LPFN_CHECKCURSOR)(void);
+
 /** Driver should call this callback when there are new mouse events to report.
  *  @param Status What happened. Combination of SF_MOVEMENT, SF_ABSOLUTE, etc.
  *  @param deltaX either number of mickeys moved or absolute coordinate if SB_ABSOLUTE.
@@ -17,6 +17,7 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -25,11 +26,14 @@
 #include "kitten.h"
 #include "version.h"
 #include "dlog.h"
+#include "int08pit.h"
 #include "int33.h"
 #include "int21dos.h"
 #include "int15ps2.h"
+#include "pic8259.h"
 #include "vbox.h"
 #include "vmware.h"
+#include "vmwsvga.h"
 #include "dostsr.h"
 #include "mousetsr.h"
 
@@ -49,6 +53,7 @@ static int set_wheel(LPTSRDATA data, bool enable)
 {
 	printf(_(1, 1, "Setting wheel support to %s\n"), enable ? kittengets(1, 2, "enabled") : kittengets(1, 3, "disabled"));
 	data->usewheel = enable;
+	data->hw_ok = false; // Reinitialize the mouse on the next reset
 
 	if (data->usewheel) {
 		detect_wheel(data);
@@ -91,11 +96,95 @@ static int set_wheel_key(LPTSRDATA data, const char *keyname)
 #endif /* USE_WHEEL */
 
 #if USE_VIRTUALBOX
+/** Asks VirtualBox to raise the VMMDev interrupt when the mouse changes,
+ *  so that the TSR no longer has to ask for the position on every PS/2 packet.
+ *  Requires the interrupt handler to be already installed. */
+static void enable_virtualbox_irq(LPTSRDATA data)
+{
+	int err;
+
+	data->vbirqcomm.iobase = data->vb.iobase;
+	data->vbirqcomm.irq = data->vb.irq;
+	err = vbox_init_buffer(&data->vbirqcomm, VBOX_IRQ_BUFFER_SIZE);
+	if (err) {
+		return; // Keep asking VirtualBox on every packet
+	}
+
+	err = vbox_set_filter_mask(&data->vb, VBOX_IRQ_EVENTS, 0);
+	if (err) {
+		vbox_release_buffer(&data->vbirqcomm);
+		return;
+	}
+
+	data->vbdirty = true;
+	data->vbirq = true;
+}
+
+static void disable_virtualbox_irq(LPTSRDATA data)
+{
+	if (data->vbirq) {
+		data->vbirq = false;
+		vbox_set_filter_mask(&data->vb, 0, VBOX_IRQ_EVENTS);
+		vbox_release_buffer(&data->vbirqcomm);
+	}
+}
+
+/** Hooks the VMMDev interrupt vector. Call with interrupts disabled. */
+static void install_virtualbox_irq(LPTSRDATA data)
+{
+	uint8_t irq = data->vb.irq;
+	uint8_t vector;
+
+	if (!data->vbavail || irq == 0xFF) {
+		return;
+	}
+
+	vector = pic_irq_to_vector(irq);
+	data->prev_vbirq_handler = _dos_getvect(vector);
+	_dos_setvect(vector, data:>vbox_irq_isr);
+
+	// The BIOS usually leaves IRQs without a driver masked
+	data->vbirqunmasked = pic_is_masked(irq);
+	if (data->vbirqunmasked) {
+		pic_set_masked(irq, false);
+	}
+
+	enable_virtualbox_irq(data);
+
+	if (data->vbirq) {
+		printf(_(1, 22, "Using VirtualBox interrupt %u\n"), irq);
+	}
+}
+
+static void uninstall_virtualbox_irq(LPTSRDATA data)
+{
+	uint8_t irq = data->vb.irq;
+
+	if (!data->prev_vbirq_handler) {
+		return;
+	}
+
+	disable_virtualbox_irq(data);
+
+	if (data->vbirqunmasked) {
+		pic_set_masked(irq, true);
+	}
+
+	_dos_setvect(pic_irq_to_vector(irq), data->prev_vbirq_handler);
+	data->prev_vbirq_handler = NULL;
+}
+
 static int set_virtualbox_integration(LPTSRDATA data, bool enable)
 {
 	if (enable) {
 		int err;
 
+		if (!TSRDATA_IS_RESIDENT(data, vb)) {
+			fprintf(stderr, _(3, 18, "%s support was discarded when installing the driver\n"), "VirtualBox");
+			return -1;
+		}
+
+		disable_virtualbox_irq(data);
 		data->vbavail = false; // Reinitialize it even if already enabled
 
 		err = vbox_init_device(&data->vb);
@@ -119,8 +208,16 @@ static int set_virtualbox_integration(LPTSRDATA data, bool enable)
 		printf(_(1, 7, "VirtualBox integration enabled\n"));
 		data->vbavail = true;
 		data->vbhaveabs = true;
+		data->vbshapeloaded = false;
+
+		if (data->prev_vbirq_handler) {
+			// Driver is already installed and hooking the interrupt
+			enable_virtualbox_irq(data);
+		}
 	} else {
 		if (data->vbavail) {
+			disable_virtualbox_irq(data);
+
 			vbox_set_mouse(&data->vb, false, false);
 
 			vbox_release_buffer(&data->vb);
@@ -140,6 +237,7 @@ static int set_virtualbox_host_cursor(LPTSRDATA data, bool enable)
 {
 	printf(_(1, 10, "Setting host cursor to %s\n"), enable ? kittengets(1, 2, "enabled") : kittengets(1, 3, "disabled"));
 	data->vbwantcursor = enable;
+	data->vbshapeloaded = false;
 
 	return 0;
 }
@@ -155,6 +253,13 @@ static int set_vmware_integration(LPTSRDATA data, bool enable)
 
 		data->vmwavail = false;
 
+#if USE_STATS
+		if (!TSRDATA_IS_RESIDENT(data, vmwstats)) {
+			fprintf(stderr, _(3, 18, "%s support was discarded when installing the driver\n"), "VMware");
+			return -1;
+		}
+#endif
+
 		version = vmware_get_version();
 		if (version < 0) {
 			fprintf(stderr, _(3, 6, "Could not detect VMware, err=%ld\n"), version);
@@ -195,8 +300,138 @@ static int set_vmware_integration(LPTSRDATA data, bool enable)
 }
 #endif
 
+static int set_rate(LPTSRDATA data, unsigned rate)
+{
+	if (rate) {
+		printf(_(1, 27, "Limiting motion events to %u per second\n"), rate);
+		data->rate_window = PIT_FREQUENCY / rate;
+	} else {
+		printf(_(1, 28, "Not limiting motion events\n"));
+		data->rate_window = 0;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static int set_frame_cap(LPTSRDATA data, bool enable)
+{
+	printf(_(1, 31, "Setting cursor redraw rate cap to %s\n"), enable ? kittengets(1, 2, "enabled") : kittengets(1, 3, "disabled"));
+
+	_disable();
+	data->frame_cap = enable;
+	_enable();
+
+	return EXIT_SUCCESS;
+}
+
+static int set_defer(LPTSRDATA data, bool enable)
+{
+	printf(_(1, 30, "Setting deferred event delivery to %s\n"), enable ? kittengets(1, 2, "enabled") : kittengets(1, 3, "disabled"));
+
+	_disable();
+	data->defer = enable;
+	data->queue_head = 0;
+	data->queue_count = 0;
+	_enable();
+
+	return EXIT_SUCCESS;
+}
+
+#if USE_STATS
+/** Prints how many times a handler was called and how long each call took. */
+static void print_handler_stats(const char *format, const struct handlerstats __far *stats)
+{
+	unsigned long avg_us = 0;
+
+	if (stats->calls) {
+		avg_us = stats->clocks / stats->calls * 1000UL / (PIT_FREQUENCY / 1000UL);
+	}
+
+	printf(format, stats->calls, avg_us);
+}
+
+static int print_stats(LPTSRDATA data)
+{
+	printf(_(1, 29, "Motion events merged: %lu\n"), data->merged_events);
+	print_handler_stats(_(1, 35, "Event handler calls: %lu, %lu us each on average\n"),
+	                    &data->handler_stats);
+	print_handler_stats(_(1, 36, "Raw event handler calls: %lu, %lu us each on average\n"),
+	                    &data->raw_handler_stats);
+
+#if USE_VMWARE
+	if (data->vmwavail) {
+		static const char * const hist_labels[VMW_QUEUE_HIST_SIZE] = {
+			"1", "2", "3-4", "5-8", "9-16", ">16"
+		};
+		unsigned i;
+
+		printf(_(1, 23, "VMware packets: %lu read, %lu merged, in %lu queue reads\n"),
+		       data->vmwstats.packets, data->vmwstats.merged, data->vmwstats.drains);
+		printf(_(1, 24, "Queue depth: last %u, max %u\n"),
+		       data->vmwstats.last_depth, data->vmwstats.max_depth);
+		printf(_(1, 25, "Depth     Times\n"));
+		for (i = 0; i < VMW_QUEUE_HIST_SIZE; i++) {
+			printf("%-5s %9lu\n", hist_labels[i], data->vmwstats.depth_hist[i]);
+		}
+	}
+#endif
+
+	return EXIT_SUCCESS;
+}
+
+static int reset_stats(LPTSRDATA data)
+{
+	data->merged_events = 0;
+	_fmemset(&data->handler_stats, 0, sizeof(data->handler_stats));
+	_fmemset(&data->raw_handler_stats, 0, sizeof(data->raw_handler_stats));
+#if USE_VMWARE
+	if (TSRDATA_IS_RESIDENT(data, vmwstats)) {
+		_fmemset(&data->vmwstats, 0, sizeof(data->vmwstats));
+	}
+#endif
+
+	printf(_(1, 26, "Statistics cleared\n"));
+
+	return EXIT_SUCCESS;
+}
+#endif
+
+#if USE_VMWSVGA
+static void detect_vmwsvga(LPTSRDATA data)
+{
+	data->vmwsvgaavail = false;
+
+#if USE_VIRTUALBOX
+	if (data->vbavail) {
+		// VirtualBox's VMSVGA adapter also looks like a SVGA II,
+		// but there we already have the VirtualBox host cursor.
+		return;
+	}
+#endif
+
+	if (vmwsvga_init_device(&data->vmwsvga) == 0) {
+		printf(_(1, 33, "Found VMware SVGA II, host cursor available in SVGA modes\n"));
+		data->vmwsvgaavail = true;
+	}
+}
+
+static int set_vmwsvga_host_cursor(LPTSRDATA data, bool enable)
+{
+	printf(_(1, 10, "Setting host cursor to %s\n"), enable ? kittengets(1, 2, "enabled") : kittengets(1, 3, "disabled"));
+	data->vmwsvgawantcursor = enable;
+	data->vmwsvgashapeloaded = false;
+
+	// Let the driver decide again whether the host draws the cursor in the current mode
+	int33_reset();
+
+	return 0;
+}
+#endif
+
 static int set_integration(LPTSRDATA data, bool enable)
 {
+	data->hw_ok = false; // Reinitialize the mouse on the next reset
+
 	if (enable) {
 		int err = -1;
 
@@ -237,7 +472,12 @@ static int set_host_cursor(LPTSRDATA data, bool enable)
 		return set_virtualbox_host_cursor(data, enable);
 	}
 #endif
-	printf(_(1, 16, "VirtualBox integration not available\n"));
+#if USE_VMWSVGA
+	if (data->vmwsvgaavail) {
+		return set_vmwsvga_host_cursor(data, enable);
+	}
+#endif
+	printf(_(1, 16, "Host cursor not available\n"));
 	return -1;
 }
 
@@ -248,6 +488,9 @@ static int configure_driver(LPTSRDATA data)
 	// Configure the debug logging port
 	dlog_init();
 
+	// Nothing discarded yet
+	data->resident_data_size = sizeof(TSRDATA);
+
 	// Check for PS/2 mouse BIOS availability
 	if ((err = ps2m_init(PS2M_PACKET_SIZE_PLAIN))) {
 		fprintf(stderr, _(3, 8, "Cannot init PS/2 mouse BIOS, err=%d\n"), err);
@@ -273,6 +516,11 @@ static int configure_driver(LPTSRDATA data)
 	data->vbwantcursor = data->vbavail;
 #endif
 
+#if USE_VMWSVGA
+	detect_vmwsvga(data);
+	data->vmwsvgawantcursor = data->vmwsvgaavail;
+#endif
+
 	return 0;
 }
 
@@ -290,9 +538,48 @@ static int move_driver_to_umb(LPTSRDATA __far * data)
 	}
 }
 
+/** Leaves the data (and code) of the integrations that were not detected
+ *  out of the resident image; see the end of TSRDATA.
+ *  Only the VirtualBox code can be left out; the VMware, SVGA II and
+ *  PS/2 code stays resident, since it is interleaved with the rest.
+ *  @returns the size of the resident part (without the PSP). */
+static unsigned trim_resident_data(LPTSRDATA data)
+{
+	unsigned data_end = FP_OFF(data) + sizeof(TSRDATA);
+	unsigned size = sizeof(TSRDATA);
+
+	if (data_end > FP_OFF(&resident_end) || FP_OFF(&resident_end) - data_end >= 16) {
+		// Something else was placed after data, so we cannot cut it
+		return get_resident_size();
+	}
+
+	// From the end of TSRDATA backwards, until the first integration we need
+	do {
+#if USE_VIRTUALBOX
+		if (data->vbavail) break;
+		size = offsetof(TSRDATA, vb);
+#endif
+#if USE_VMWARE && USE_STATS
+		if (data->vmwavail) break;
+		size = offsetof(TSRDATA, vmwstats);
+#endif
+	} while (0);
+
+	data->resident_data_size = size;
+
+	if (size == sizeof(TSRDATA)) {
+		return get_resident_size(); // Including the VirtualBox code after data
+	}
+
+	printf(_(1, 34, "Discarded %u bytes of unused integration data and code\n"),
+	       get_resident_size() - (FP_OFF(data) + size));
+
+	return FP_OFF(data) + size;
+}
+
 static __declspec(aborts) int install_driver(LPTSRDATA data, bool high)
 {
-	const unsigned int resident_size = DOS_PSP_SIZE + get_resident_size();
+	const unsigned int resident_size = DOS_PSP_SIZE + trim_resident_data(data);
 
 	// No more interruptions from now on and until we TSR.
 	// Inserting ourselves in the interrupt chain should be atomic.
@@ -306,6 +593,28 @@ static __declspec(aborts) int install_driver(LPTSRDATA data, bool high)
 	_dos_setvect(0x2f, data:>int2f_isr);
 #endif
 
+	data->prev_int1c_handler = _dos_getvect(0x1c);
+	_dos_setvect(0x1c, data:>int1c_isr);
+
+	data->prev_int10_handler = _dos_getvect(0x10);
+	_dos_setvect(0x10, data:>int10_isr);
+
+#if USE_PS2_DIRECT
+	if (data->ps2direct) {
+		// Will start reading the mouse bytes on the next reset
+		data->prev_int74_handler = _dos_getvect(PS2_MOUSE_INT_VECTOR);
+		_dos_setvect(PS2_MOUSE_INT_VECTOR, data:>ps2_irq_isr);
+		// To stop reading it directly while others use the BIOS to talk to the mouse
+		data->prev_int15_handler = _dos_getvect(0x15);
+		_dos_setvect(0x15, data:>int15_isr);
+		printf(_(1, 32, "Reading the PS/2 mouse directly\n"));
+	}
+#endif
+
+#if USE_VIRTUALBOX
+	install_virtualbox_irq(data);
+#endif
+
 	printf(_(1, 17, "Driver installed\n"));
 
 	// If we reallocated ourselves to UMB,
@@ -343,6 +652,54 @@ static bool check_if_driver_uninstallable(LPTSRDATA data)
 	}
 #endif
 
+	{
+		void (__interrupt __far *cur_int1c_handler)() = _dos_getvect(0x1c);
+
+		if (FP_SEG(cur_int1c_handler) != FP_SEG(data)) {
+			fprintf(stderr, _(3, 15, "INT1C has been hooked by someone else, cannot safely remove\n"));
+			return false;
+		}
+	}
+
+	{
+		void (__interrupt __far *cur_int10_handler)() = _dos_getvect(0x10);
+
+		if (FP_SEG(cur_int10_handler) != FP_SEG(data)) {
+			fprintf(stderr, _(3, 17, "INT10 has been hooked by someone else, cannot safely remove\n"));
+			return false;
+		}
+	}
+
+#if USE_PS2_DIRECT
+	if (data->prev_int74_handler) {
+		void (__interrupt __far *cur_int74_handler)() = _dos_getvect(PS2_MOUSE_INT_VECTOR);
+
+		if (FP_SEG(cur_int74_handler) != FP_SEG(data)) {
+			fprintf(stderr, _(3, 16, "INT74 has been hooked by someone else, cannot safely remove\n"));
+			return false;
+		}
+	}
+	if (data->prev_int15_handler) {
+		void (__interrupt __far *cur_int15_handler)() = _dos_getvect(0x15);
+
+		if (FP_SEG(cur_int15_handler) != FP_SEG(data)) {
+			fprintf(stderr, _(3, 19, "INT15 has been hooked by someone else, cannot safely remove\n"));
+			return false;
+		}
+	}
+#endif
+
+#if USE_VIRTUALBOX
+	if (data->prev_vbirq_handler) {
+		void (__interrupt __far *cur_vbirq_handler)() = _dos_getvect(pic_irq_to_vector(data->vb.irq));
+
+		if (FP_SEG(cur_vbirq_handler) != FP_SEG(data)) {
+			fprintf(stderr, _(3, 14, "VirtualBox IRQ has been hooked by someone else, cannot safely remove\n"));
+			return false;
+		}
+	}
+#endif
+
 	return true;
 }
 
@@ -352,6 +709,17 @@ static int unconfigure_driver(LPTSRDATA data)
 	set_integration(data, false);
 #endif
 
+#if USE_PS2_DIRECT
+	data->ps2directactive = false;
+#endif
+
+#if USE_VMWSVGA
+	if (data->vmwsvgacursor) {
+		vmwsvga_set_cursor_visible(&data->vmwsvga, false);
+		data->vmwsvgacursor = false;
+	}
+#endif
+
 	ps2m_enable(false);
 	ps2m_set_callback(0);
 
@@ -360,8 +728,27 @@ static int unconfigure_driver(LPTSRDATA data)
 
 static int uninstall_driver(LPTSRDATA data)
 {
+#if USE_VIRTUALBOX
+	_disable();
+	uninstall_virtualbox_irq(data);
+	_enable();
+#endif
+
 	_dos_setvect(0x33, data->prev_int33_handler);
 
+	_dos_setvect(0x1c, data->prev_int1c_handler);
+
+	_dos_setvect(0x10, data->prev_int10_handler);
+
+#if USE_PS2_DIRECT
+	if (data->prev_int74_handler) {
+		_dos_setvect(PS2_MOUSE_INT_VECTOR, data->prev_int74_handler);
+	}
+	if (data->prev_int15_handler) {
+		_dos_setvect(0x15, data->prev_int15_handler);
+	}
+#endif
+
 #if USE_WIN386
 	_dos_setvect(0x2f, data->prev_int2f_handler);
 #endif
@@ -375,9 +762,13 @@ static int uninstall_driver(LPTSRDATA data)
 	return 0;
 }
 
-static int driver_reset(void)
+static int driver_reset(LPTSRDATA data)
 {
 	printf(_(1, 19, "Reset mouse driver\n"));
+	if (data) {
+		// Force a full reinitialization of the mouse
+		data->hw_ok = false;
+	}
 	return int33_reset() == 0xFFFF;
 }
 
@@ -395,6 +786,9 @@ static void print_help(void)
 	puts(_(0, 2,  "Supported actions:"));
 	puts(_(0, 3,  "    install            install the driver (default)"));
 	puts(_(0, 4,  "        low                install in conventional memory (otherwise UMB)"));
+#if USE_PS2_DIRECT
+	puts(_(0, 16, "        direct             read PS/2 mouse from IRQ12 instead of through the BIOS"));
+#endif
 	puts(_(0, 5,  "    uninstall          uninstall the driver from memory"));
 #if USE_WHEEL
 	puts(_(0, 6,  "    wheel <ON|OFF>     enable/disable wheel API support"));
@@ -406,6 +800,12 @@ static void print_help(void)
 	puts(_(0, 10, "    hostcur <ON|OFF>   enable/disable mouse cursor rendering in host"));
 #endif
 	puts(_(0, 11, "    reset              reset mouse driver settings"));
+	puts(_(0, 12, "    rate <N|OFF>       limit motion-only event handler calls to N per second"));
+	puts(_(0, 14, "    defer <ON|OFF>     call event handler from timer tick instead of mouse IRQ"));
+	puts(_(0, 15, "    framecap <ON|OFF>  redraw cursor after mouse moves at most 70 times/sec"));
+#if USE_STATS
+	puts(_(0, 13, "    stats [reset]      show (or clear) event and VMware queue statistics"));
+#endif
 }
 
 static int invalid_arg(const char *s)
@@ -455,6 +855,7 @@ int main(int argc, const char *argv[])
 
 	if (argi >= argc || stricmp(argv[argi], "install") == 0) {
 		bool high = true;
+		bool direct = false;
 
 		argi++;
 		for (; argi < argc; argi++) {
@@ -462,6 +863,10 @@ int main(int argc, const char *argv[])
 				high = false;
 			} else if (stricmp(argv[argi], "high") == 0) {
 				high = true;
+#if USE_PS2_DIRECT
+			} else if (stricmp(argv[argi], "direct") == 0) {
+				direct = true;
+#endif
 			} else {
 				return invalid_arg(argv[argi]);
 			}
@@ -480,6 +885,11 @@ int main(int argc, const char *argv[])
 		} else {
 			deallocate_environment(_psp);
 		}
+#if USE_PS2_DIRECT
+		data->ps2direct = direct;
+#else
+		(void) direct;
+#endif
 		err = configure_driver(data);
 		if (err) {
 			if (high) cancel_reallocation(FP_SEG(data));
@@ -555,7 +965,57 @@ int main(int argc, const char *argv[])
 		return set_host_cursor(data, enable);
 #endif
 	} else if (stricmp(argv[argi], "reset") == 0) {
-		return driver_reset();
+		return driver_reset(data);
+	} else if (stricmp(argv[argi], "rate") == 0) {
+		unsigned rate = 0;
+
+		if (!data) return driver_not_found();
+
+		argi++;
+		if (argi >= argc) return arg_required("rate");
+		if (!is_false(argv[argi])) {
+			rate = atoi(argv[argi]);
+			if (rate < 1 || rate > 1000) return invalid_arg(argv[argi]);
+		}
+
+		return set_rate(data, rate);
+	} else if (stricmp(argv[argi], "defer") == 0) {
+		bool enable = true;
+
+		if (!data) return driver_not_found();
+
+		argi++;
+		if (argi < argc) {
+			if (is_false(argv[argi])) enable = false;
+		}
+
+		return set_defer(data, enable);
+	} else if (stricmp(argv[argi], "framecap") == 0) {
+		bool enable = true;
+
+		if (!data) return driver_not_found();
+
+		argi++;
+		if (argi < argc) {
+			if (is_false(argv[argi])) enable = false;
+		}
+
+		return set_frame_cap(data, enable);
+#if USE_STATS
+	} else if (stricmp(argv[argi], "stats") == 0) {
+		if (!data) return driver_not_found();
+
+		argi++;
+		if (argi < argc) {
+			if (stricmp(argv[argi], "reset") == 0) {
+				return reset_stats(data);
+			} else {
+				return invalid_arg(argv[argi]);
+			}
+		}
+
+		return print_stats(data);
+#endif
 	} else {
 		return invalid_arg(argv[argi]);
 	}
@@ -0,0 +1,260 @@
+/*
+ * VBMouse - DOS mouse driver resident part, VirtualBox support
+ * Copyright (C) 2022 Javier S. Pedro
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+// This file is compiled into its own code segment, RES_VBOX_TEXT (see makefile),
+// which is part of RES_GROUP like the rest of the resident code
+// but placed right after the resident data (see vbmouse.lnk),
+// so that it can be left out of the resident image together with the
+// VirtualBox buffers at the end of TSRDATA when VirtualBox is not detected.
+// It must not contribute any data after TSRDATA either; see the makefile.
+
+#include <stddef.h>
+#include <string.h>
+#include <i86.h>
+
+#include "dlog.h"
+#include "utils.h"
+#include "pic8259.h"
+#include "vbox.h"
+#include "mousetsr.h"
+#include "mousvbox.h"
+
+#if USE_VIRTUALBOX
+
+/** RGBA host cursor pixels for each possible pair of XOR mask bits, MSB first.
+ *  "White" is FFFFFF with zero alpha. */
+static const uint32_t xor_rgba_pairs[4][2] = {
+    { 0x00000000UL, 0x00000000UL },
+    { 0x00000000UL, 0x00FFFFFFUL },
+    { 0x00FFFFFFUL, 0x00000000UL },
+    { 0x00FFFFFFUL, 0x00FFFFFFUL },
+};
+
+int set_vbox_cursor_visible(bool visible)
+{
+	bool was_busy;
+	int err;
+
+	was_busy = data.vbbusy;
+	data.vbbusy = true;
+	err = vbox_set_pointer_visible(&data.vb, visible);
+	data.vbbusy = was_busy;
+
+	return err;
+}
+
+int set_vbox_absolute(bool enable)
+{
+	bool was_busy;
+	int err;
+
+	was_busy = data.vbbusy;
+	data.vbbusy = true;
+	err = vbox_set_mouse(&data.vb, enable, false);
+	data.vbbusy = was_busy;
+
+	return err;
+}
+
+void apply_host_cursor_visibility(void)
+{
+	bool should_show;
+
+	if (!data.vbcursorpending || data.vbbusy) {
+		return; // Nothing to do, or try again later
+	}
+
+	should_show = cursor_should_show();
+	if (should_show != data.cursor_visible) {
+		if (set_vbox_cursor_visible(should_show) != 0) {
+			return; // Try again on the next tick
+		}
+
+		data.cursor_visible = should_show;
+	}
+
+	data.vbcursorpending = false;
+}
+
+void load_vbox_cursor(void)
+{
+	VMMDevReqMousePointer *req = (VMMDevReqMousePointer *) data.vb.buf;
+	const unsigned width = GRAPHIC_CURSOR_WIDTH, height = GRAPHIC_CURSOR_HEIGHT;
+	uint8_t  *output = req->pointerData;
+	uint32_t *output_rgba;
+	unsigned int y, x;
+	bool was_busy;
+
+	was_busy = data.vbbusy;
+	data.vbbusy = true;
+
+	memset(req, 0, sizeof(VMMDevReqMousePointer));
+
+	req->header.size = vbox_req_mouse_pointer_size(width, height);
+	req->header.version = VMMDEV_REQUEST_HEADER_VERSION;
+	req->header.requestType = VMMDevReq_SetPointerShape;
+	req->header.rc = -1;
+
+	req->fFlags = VBOX_MOUSE_POINTER_SHAPE;
+	req->xHot = BOUND(data.cursor_hotspot.x, 0, width);
+	req->yHot = BOUND(data.cursor_hotspot.y, 0, height);
+	req->width = width;
+	req->height = height;
+
+	// AND mask
+	// int33 format is 1-bit per pixel packed into 16-bit LE values,
+	// while VirtualBox wants 1-bit per pixel packed into 8-bit.
+	// All we have to do is byteswap 16-bit values.
+	for (y = 0; y < height; ++y) {
+		uint16_t cursor_line = data.cursor_graphic[y];
+		output[0] = (cursor_line >> 8) & 0xFF;
+		output[1] = cursor_line & 0xFF;
+		output += GRAPHIC_CURSOR_SCANLINE_LEN;
+	}
+
+	// XOR mask
+	// int33 format is again 1-bit per pixel packed into 16-bit LE values,
+	// however VirtualBox wants 4-byte per pixel packed "RGBA".
+	// Convert two pixels at a time using a table.
+	output_rgba = (uint32_t *) output;
+	for (y = 0; y < height; ++y) {
+		uint16_t cursor_line = data.cursor_graphic[GRAPHIC_CURSOR_HEIGHT + y];
+
+		for (x = 0; x < width; x += 2) {
+			// Two MSBs of line are the current mask bits
+			const uint32_t *pair = xor_rgba_pairs[cursor_line >> 14];
+
+			output_rgba[0] = pair[0];
+			output_rgba[1] = pair[1];
+
+			cursor_line <<= 2;
+			output_rgba += 2;
+		}
+	}
+
+	dputs("Loading cursor to VBox");
+
+	vbox_send_request(data.vb.iobase, data.vb.dds.physicalAddress);
+
+	if (req->header.rc != 0) {
+		dputs("Could not send cursor to VirtualBox");
+		data.vbbusy = was_busy;
+		return;
+	}
+
+	// After we send this message, it looks like VirtualBox shows the cursor
+	// even if we didn't actually want it to be visible at this point.
+	vbox_set_pointer_visible(&data.vb, false);
+	data.vbbusy = was_busy;
+
+	data.vbshapeloaded = true;
+}
+
+bool vbox_update_position(void)
+{
+	bool abs, was_busy;
+	uint16_t x, y;
+	int err;
+
+	if (data.vbirq && !data.vbdirty
+#if USE_WIN386
+	        && !data.haswin386 // Windows may not be delivering the IRQ to us
+#endif
+	   ) {
+		return data.vbhaveabs;
+	}
+
+	if (data.vbbusy) {
+		// We interrupted a request being built in data.vb;
+		// keep using the last position, and ask again on the next packet.
+		return data.vbhaveabs;
+	}
+
+	// Clear before asking, so that a change during the request is not lost.
+	data.vbdirty = false;
+
+	was_busy = data.vbbusy;
+	data.vbbusy = true;
+	err = vbox_get_mouse(&data.vb, &abs, &x, &y);
+	data.vbbusy = was_busy;
+
+	if (err || !abs) {
+		return false;
+	}
+
+	data.vbx = x;
+	data.vby = y;
+
+	return true;
+}
+
+/** Handles the VMMDev interrupt. */
+static void vbox_irq_handler(void)
+#pragma aux vbox_irq_handler "*" modify [ax bx cx dx si di es fs gs]
+{
+	uint32_t events;
+
+	// This also lowers the interrupt line
+	if (!data.vbirq || vbox_ack_events(&data.vbirqcomm, &events) != 0 || !events) {
+		// Not ours; this interrupt line may be shared with other PCI devices.
+		data.prev_vbirq_handler();
+		return;
+	}
+
+#if TRACE_EVENTS
+	dprintf("vbox irq events=0x%lx\n", events);
+#endif
+
+	if (events & VBOX_IRQ_EVENTS) {
+		data.vbdirty = true;
+	}
+
+	pic_send_eoi(data.vb.irq);
+}
+
+void __declspec(naked) __far vbox_irq_isr(void)
+{
+	__asm {
+		pusha
+		push ds
+		push es
+		push fs
+		push gs
+
+		push cs
+		pop ds
+
+		call vbox_irq_handler
+
+		pop gs
+		pop fs
+		pop es
+		pop ds
+		popa
+
+		iret
+	}
+}
+
+/** This must be the last function in this file. */
+void __declspec(naked) resident_vbox_code_end(void)
+{
+}
+
+#endif /* USE_VIRTUALBOX */
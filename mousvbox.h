@@ -0,0 +1,63 @@
+/*
+ * VBMouse - DOS mouse driver resident part, VirtualBox support
+ * Copyright (C) 2022 Javier S. Pedro
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef MOUSVBOX_H
+#define MOUSVBOX_H
+
+#include <stdbool.h>
+
+#include "mousetsr.h"
+
+#if USE_VIRTUALBOX
+
+// Provided by mousetsr.c
+
+extern TSRDATA data;
+
+/** Whether the cursor should currently be visible. */
+extern bool cursor_should_show(void);
+
+// Provided by mousvbox.c, which is only kept resident when VirtualBox is detected.
+// Only call into it when data.vbavail is set.
+
+/** Shows or hides the VirtualBox host cursor right now.
+ *  @returns 0 on success. */
+extern int set_vbox_cursor_visible(bool visible);
+
+/** Tells VirtualBox whether we want absolute coordinates.
+ *  @returns 0 on success. */
+extern int set_vbox_absolute(bool enable);
+
+/** Updates the visibility of the VirtualBox host cursor if it was left pending.
+ *  Programs that hide and show the cursor around every screen update
+ *  would otherwise cause a host request for each call. */
+extern void apply_host_cursor_visibility(void);
+
+/** Uploads the current graphic cursor shape to the VirtualBox host. */
+extern void load_vbox_cursor(void);
+
+/** Updates data.vbx/vby with the current VirtualBox absolute position.
+ *  If the host interrupts us on mouse changes, only asks it when it told us
+ *  something changed; otherwise asks it every time.
+ *  @return true if VirtualBox is currently providing absolute coordinates. */
+extern bool vbox_update_position(void);
+
+#endif /* USE_VIRTUALBOX */
+
+#endif /* MOUSVBOX_H */
@@ -18,6 +18,11 @@
 0.9:    integ <ON|OFF>     habilita/deshabilita integracin con virtualbox
 0.10:    hostcur <ON|OFF>   habilita/deshabilita pintado del cursor en el anfitrin
 0.11:    reset              reinicia ajustes del controlador del ratn
+0.12:    rate <N|OFF>       limita a N por segundo las llamadas slo por movimiento
+0.13:    stats [reset]      muestra (o borra) estadsticas de eventos y de la cola VMware
+0.14:    defer <ON|OFF>     llama al manejador desde el temporizador y no la IRQ
+0.15:    framecap <ON|OFF>  redibuja el cursor como mucho 70 veces/seg
+0.16:        direct             lee el ratn PS/2 desde la IRQ12 y no a travs de la BIOS
 1.0:Rueda de ratn encontrada y activada\n
 1.1:Soporte para rueda %s\n
 1.2:habilitado
@@ -34,12 +39,27 @@
 1.13:Integracin con VMware deshabilitada\n
 1.14:Integracin con VMware ya deshabilitada o no disponible\n
 1.15:No estn disponibles las integraciones con VirtualBox ni VMware\n
-1.16:Integracin con VirtualBox no disponible\n
+1.16:Cursor en el anfitrin no disponible\n
 1.17:Controlador instalado\n
 1.18:Controlador desinstalado\n
 1.19:Reiniciados ajustes del controlador del ratn\n
 1.20:\nVBMouse %x.%x (como MSMOUSE %x.%x)\n
 1.21:VBMouse ya instalado\n
+1.22:Usando la interrupcin %u de VirtualBox\n
+1.23:Paquetes VMware: %lu ledos, %lu combinados, en %lu lecturas de la cola\n
+1.24:Profundidad de la cola: ltima %u, mxima %u\n
+1.25:Prof.     Veces\n
+1.26:Estadsticas borradas\n
+1.27:Limitando los eventos de movimiento a %u por segundo\n
+1.28:Sin lmite de eventos de movimiento\n
+1.29:Eventos de movimiento combinados: %lu\n
+1.30:Cambiando la entrega diferida de eventos a %s\n
+1.31:Cambiando el lmite de redibujado del cursor a %s\n
+1.32:Leyendo el ratn PS/2 directamente\n
+1.33:Encontrada VMware SVGA II, cursor en el anfitrin disponible en modos SVGA\n
+1.34:Descartados %u bytes de datos y cdigo de integracin sin usar\n
+1.35:Llamadas al manejador de eventos: %lu, %lu us cada una de media\n
+1.36:Llamadas al manejador de eventos en bruto: %lu, %lu us cada una de media\n
 3.0:No se pudo encontrar ratn PS/2 con rueda\n
 3.1:Rueda no detectada o soporte no habilitado\n
 3.2:Tecla desconocida '%s'\n
@@ -54,3 +74,9 @@
 3.11:No encuentro los datos del controlador (No est instalado?)\n
 3.12:Argumento no vlido '%s'\n
 3.13:Se requiere argumento para '%s'\n
+3.14:Alguien ms enganchado a la IRQ de VirtualBox, no puedo desinstalar de forma segura\n
+3.15:Alguien ms enganchado a INT1C, no puedo desinstalar de forma segura\n
+3.16:Alguien ms enganchado a INT74, no puedo desinstalar de forma segura\n
+3.17:Alguien ms enganchado a INT10, no puedo desinstalar de forma segura\n
+3.18:El soporte de %s se descart al instalar el controlador\n
+3.19:Alguien ms enganchado a INT15, no puedo desinstalar de forma segura\n
@@ -21,6 +21,11 @@
 0.12:    umount <X:>        desmonta la carpeta compartida de la unidad X:
 0.13:    rescan             desmonta todo y recrea los automounts
 0.14:                             usar '/cs' si el anfitrin distingue mays/mins
+0.15:    stats [reset]      muestra (o borra) las estadsticas de llamadas
+0.16:    trace start [<KB>] captura las llamadas al redirector (bfer de %d KiB por defecto)\n
+0.17:    trace mark         comienza una nueva fase en la captura
+0.18:    trace stop <FICH>  detiene la captura y la guarda en FICH
+0.19:    replay <FICH> <X:> repite las llamadas de una captura en la unidad X:
 1.0:Unidades montadas:\n
 1.1: %s en %c:\n
 1.2:Carpetas compartidas disponibles:\n
@@ -32,6 +37,13 @@
 1.8:Controlador desinstalado\n
 1.9:\nVBSharedFolders %x.%x\n
 1.10:VBSF ya instalado\n
+1.11:Funcin       Llamadas  Llamadas HGCM\n
+1.12:Bytes ledos: %lu, bytes escritos: %lu\n
+1.13:Estadsticas borradas\n
+1.14:Capturando llamadas al redirector en un bfer de %u KiB\n
+1.15:Guardados %u bytes de captura en '%s' (%u llamadas perdidas)\n
+1.16:Fase %u: %lu llamadas (%lu omitidas, %lu con otro resultado) en %lu ms\n
+1.17:  Llamadas HGCM: %lu (%lu al capturar), bytes ledos: %lu, escritos: %lu\n
 2.0:Aviso: Pgina de cdigos activa no encontrada
 2.1:Aviso: No se encuentra la tabla Unicode: %s
 2.2:Aviso: No se puede cargar la tabla Unicode: %s
@@ -60,3 +72,9 @@
 3.20:No encuentro los datos del controlador (No est instalado?)\n
 3.21:Argumento no vlido '%s'\n
 3.22:Se requiere argumento para '%s'\n
+3.23:Ya hay una captura en curso\n
+3.24:No hay memoria suficiente para un bfer de captura de %u KiB\n
+3.25:No hay ninguna captura en curso\n
+3.26:No puedo escribir la captura en '%s'\n
+3.27:No puedo leer la captura de '%s'\n
+3.28:'%s' no es un fichero de captura vlido\n
@@ -0,0 +1,98 @@
+/*
+ * VBMouse - 8259 programmable interrupt controller routines
+ * Copyright (C) 2022 Javier S. Pedro
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef PIC8259_H
+#define PIC8259_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <conio.h>
+
+enum pic_ports {
+	PIC1_PORT_COMMAND = 0x20,
+	PIC1_PORT_DATA    = 0x21,
+	PIC2_PORT_COMMAND = 0xA0,
+	PIC2_PORT_DATA    = 0xA1,
+};
+
+enum pic_commands {
+	PIC_COMMAND_EOI = 0x20,
+	/** OCW3: next read from the command port returns the interrupt request register. */
+	PIC_COMMAND_READ_IRR = 0x0A,
+};
+
+/** IRQ line of the master PIC where the slave PIC is cascaded. */
+#define PIC_CASCADE_IRQ 2
+
+/** Returns the interrupt vector the BIOS assigns to a given IRQ. */
+static inline uint8_t pic_irq_to_vector(uint8_t irq)
+{
+	return irq < 8 ? 0x08 + irq : 0x70 + (irq - 8);
+}
+
+/** Signals the end of the interrupt for a given IRQ. */
+static void pic_send_eoi(uint8_t irq)
+{
+	if (irq >= 8) {
+		outp(PIC2_PORT_COMMAND, PIC_COMMAND_EOI);
+	}
+	outp(PIC1_PORT_COMMAND, PIC_COMMAND_EOI);
+}
+
+/** @return whether a given IRQ has been raised but not yet acknowledged,
+ *  e.g. because interrupts are disabled. */
+static bool pic_is_pending(uint8_t irq)
+{
+	if (irq >= 8) {
+		outp(PIC2_PORT_COMMAND, PIC_COMMAND_READ_IRR);
+		return inp(PIC2_PORT_COMMAND) & (1 << (irq - 8));
+	} else {
+		outp(PIC1_PORT_COMMAND, PIC_COMMAND_READ_IRR);
+		return inp(PIC1_PORT_COMMAND) & (1 << irq);
+	}
+}
+
+static bool pic_is_masked(uint8_t irq)
+{
+	if (irq >= 8) {
+		return inp(PIC2_PORT_DATA) & (1 << (irq - 8));
+	} else {
+		return inp(PIC1_PORT_DATA) & (1 << irq);
+	}
+}
+
+/** Masks (disables) or unmasks (enables) a given IRQ.
+ *  Unmasking an IRQ of the slave PIC also unmasks the cascade IRQ.
+ *  Call with interrupts disabled. */
+static void pic_set_masked(uint8_t irq, bool masked)
+{
+	uint16_t port = irq >= 8 ? PIC2_PORT_DATA : PIC1_PORT_DATA;
+	uint8_t bit = 1 << (irq & 7);
+	uint8_t mask;
+
+	mask = inp(port);
+	if (masked) mask |= bit;
+	else        mask &= ~bit;
+	outp(port, mask);
+	if (irq >= 8 && !masked) {
+		outp(PIC1_PORT_DATA, inp(PIC1_PORT_DATA) & ~(1 << PIC_CASCADE_IRQ));
+	}
+}
+
+#endif // PIC8259_H
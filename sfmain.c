@@ -25,6 +25,8 @@
 #include <dos.h>
 #include <sys/stat.h>
 #include <ctype.h>
+#include <direct.h>
+#include <fcntl.h>
 
 #include "kitten.h"
 #include "version.h"
@@ -162,6 +164,7 @@ static int mount_shfl(LPTSRDATA data, int drive, const char *folder, bool ci)
 
 	data->drives[drive].root = root;
 	data->drives[drive].case_insensitive = ci;
+	data->drive_bitmap |= 1UL << drive;
 
 	return 0;
 }
@@ -180,6 +183,7 @@ static int unmount_shfl(LPTSRDATA data, int drive)
 	}
 
 	data->drives[drive].root = SHFL_ROOT_NIL;
+	data->drive_bitmap &= ~(1UL << drive);
 
 	return 0;
 }
@@ -349,6 +353,476 @@ static int rescan(LPTSRDATA data)
 	return 0;
 }
 
+#if USE_STATS
+static const char * get_fn_name(unsigned fn)
+{
+	switch (fn) {
+	case DOS_FN_RMDIR:         return "rmdir";
+	case DOS_FN_MKDIR:         return "mkdir";
+	case DOS_FN_CHDIR:         return "chdir";
+	case DOS_FN_CLOSE:         return "close";
+	case DOS_FN_COMMIT:        return "commit";
+	case DOS_FN_READ:          return "read";
+	case DOS_FN_WRITE:         return "write";
+	case DOS_FN_LOCK:          return "lock";
+	case DOS_FN_GET_DISK_FREE: return "diskfree";
+	case DOS_FN_SET_FILE_ATTR: return "setattr";
+	case DOS_FN_GET_FILE_ATTR: return "getattr";
+	case DOS_FN_RENAME:        return "rename";
+	case DOS_FN_DELETE:        return "delete";
+	case DOS_FN_OPEN:          return "open";
+	case DOS_FN_CREATE:        return "create";
+	case DOS_FN_FIND_FIRST:    return "findfirst";
+	case DOS_FN_FIND_NEXT:     return "findnext";
+	case DOS_FN_SEEK_END:      return "seekend";
+	case DOS_FN_OPEN_EX:       return "openex";
+	default:                   return "?";
+	}
+}
+
+static int print_stats(LPTSRDATA data)
+{
+	unsigned fn;
+
+	printf(_(1, 11, "Function      Calls   HGCM calls\n"));
+	for (fn = 0; fn < NUM_STATS_FN; fn++) {
+		if (!data->stats[fn].calls) continue;
+		printf("%02X %-9s %8lu %12lu\n", fn, get_fn_name(fn),
+		       data->stats[fn].calls, data->stats[fn].hgcm_calls);
+	}
+	printf(_(1, 12, "Bytes read: %lu, bytes written: %lu\n"),
+	       data->bytes_read, data->bytes_written);
+
+	return EXIT_SUCCESS;
+}
+
+static int reset_stats(LPTSRDATA data)
+{
+	_fmemset(data->stats, 0, sizeof(data->stats));
+	data->bytes_read = 0;
+	data->bytes_written = 0;
+
+	printf(_(1, 13, "Statistics cleared\n"));
+
+	return EXIT_SUCCESS;
+}
+#endif
+
+#if USE_TRACE
+/** Default and maximum size of the capture buffer, in KiB. */
+#define DEF_TRACE_KB 32
+#define MAX_TRACE_KB 63
+
+/** Maximum number of files that can be simultaneously open during a replay. */
+#define MAX_REPLAY_FILES 32
+
+static inline uint16_t get_bios_ticks(void)
+{
+	return *(volatile uint16_t __far *) MK_FP(0x40, 0x6C);
+}
+
+static int trace_start(LPTSRDATA data, unsigned kb)
+{
+	segment_t seg;
+
+	if (data->trace_seg) {
+		fprintf(stderr, _(3, 23, "A capture is already in progress\n"));
+		return EXIT_FAILURE;
+	}
+
+	// Make the buffer owned by the resident driver so that it survives us
+	seg = allocate_owned_block(kb * (1024 / 16), FP_SEG(data) - (DOS_PSP_SIZE/16));
+	if (!seg) {
+		fprintf(stderr, _(3, 24, "Not enough memory for a %u KiB capture buffer\n"), kb);
+		return EXIT_FAILURE;
+	}
+
+	data->trace_len = 0;
+	data->trace_lost = 0;
+	data->trace_size = kb * 1024U;
+	data->trace_seg = seg;
+	data->tracing = true;
+
+	printf(_(1, 14, "Capturing redirector calls into a %u KiB buffer\n"), kb);
+
+	return EXIT_SUCCESS;
+}
+
+static int trace_mark(LPTSRDATA data)
+{
+	SFTRACERECORD __far *rec;
+
+	if (!data->tracing) {
+		fprintf(stderr, _(3, 25, "No capture in progress\n"));
+		return EXIT_FAILURE;
+	}
+
+	if (data->trace_size - data->trace_len < sizeof(SFTRACERECORD)) {
+		data->trace_lost++;
+		return EXIT_SUCCESS;
+	}
+
+	rec = MK_FP(data->trace_seg, data->trace_len);
+	_fmemset(rec, 0, sizeof(SFTRACERECORD));
+	rec->fn = SFTRACE_FN_MARK;
+	rec->ticks = get_bios_ticks();
+	data->trace_len += sizeof(SFTRACERECORD);
+
+	return EXIT_SUCCESS;
+}
+
+static bool save_trace(LPTSRDATA data, const char *filename)
+{
+	SFTRACEHEADER hdr;
+	char buf[512];
+	unsigned pos, chunk;
+	FILE *f;
+
+	f = fopen(filename, "wb");
+	if (!f) return false;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SFTRACE_MAGIC, sizeof(hdr.magic));
+	hdr.version = SFTRACE_VERSION;
+	hdr.size = data->trace_len;
+	hdr.lost = data->trace_lost;
+
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1) {
+		fclose(f);
+		return false;
+	}
+
+	for (pos = 0; pos < data->trace_len; pos += chunk) {
+		chunk = MIN(sizeof(buf), data->trace_len - pos);
+		_fmemcpy(buf, MK_FP(data->trace_seg, pos), chunk);
+		if (fwrite(buf, 1, chunk, f) != chunk) {
+			fclose(f);
+			return false;
+		}
+	}
+
+	return fclose(f) == 0;
+}
+
+static int trace_stop(LPTSRDATA data, const char *filename)
+{
+	if (!data->trace_seg) {
+		fprintf(stderr, _(3, 25, "No capture in progress\n"));
+		return EXIT_FAILURE;
+	}
+
+	// Stop capturing, but keep the buffer around in case we cannot save it
+	data->tracing = false;
+
+	if (!save_trace(data, filename)) {
+		fprintf(stderr, _(3, 26, "Cannot write capture to '%s'\n"), filename);
+		return EXIT_FAILURE;
+	}
+
+	printf(_(1, 15, "Saved %u bytes of capture to '%s' (%u calls lost)\n"),
+	       data->trace_len, filename, data->trace_lost);
+
+	dos_free(data->trace_seg);
+	data->trace_seg = 0;
+
+	return EXIT_SUCCESS;
+}
+
+typedef struct {
+	/** Offset of the SFT in the capture, or 0 if this entry is free. */
+	uint16_t sft;
+	/** DOS handle for the same file during the replay. */
+	int handle;
+} REPLAYFILE;
+
+typedef struct {
+	unsigned long calls, skipped, differed;
+	unsigned long hgcm_calls, captured_hgcm_calls;
+	unsigned long bytes_read, bytes_written;
+	uint16_t start_ticks;
+} REPLAYPHASE;
+
+static REPLAYFILE replay_files[MAX_REPLAY_FILES];
+
+static REPLAYFILE * find_replay_file(uint16_t sft)
+{
+	unsigned i;
+	for (i = 0; i < MAX_REPLAY_FILES; i++) {
+		if (replay_files[i].sft == sft) {
+			return &replay_files[i];
+		}
+	}
+	return NULL;
+}
+
+static bool dos_seek(int handle, unsigned long pos, unsigned char whence)
+{
+	union REGS r;
+	r.h.ah = 0x42;
+	r.h.al = whence;
+	r.w.bx = handle;
+	r.w.cx = pos >> 16;
+	r.w.dx = pos & 0xFFFF;
+	intdos(&r, &r);
+	return !r.w.cflag;
+}
+
+static bool dos_open_ex(const char *filename, uint16_t action, uint16_t mode, int *handle)
+{
+	union REGS r;
+	r.w.ax = 0x6C00;
+	r.w.bx = mode;
+	r.w.cx = _A_NORMAL;
+	r.w.dx = action;
+	r.w.si = FP_OFF(filename);
+	intdos(&r, &r);
+	*handle = r.w.ax;
+	return !r.w.cflag;
+}
+
+/** Replays a single captured call.
+ *  @returns false if the result differs from the captured one,
+ *           i.e. if the call failed but succeeded when captured or vice versa,
+ *           or if a read or write transferred a different number of bytes. */
+static bool replay_call(const SFTRACERECORD __far *rec, const char *fn1, const char *fn2,
+                        char drive, uint8_t __far *iobuf, REPLAYPHASE *phase)
+{
+	static struct find_t find;
+	static bool find_valid = false;
+	bool captured_ok = !(rec->flags & SFTRACE_FLAG_ERROR);
+	struct diskfree_t df;
+	REPLAYFILE *file = NULL;
+	unsigned attr, bytes;
+	int handle;
+	bool ok;
+
+	switch (rec->fn) {
+	case DOS_FN_READ:
+	case DOS_FN_WRITE:
+	case DOS_FN_CLOSE:
+	case DOS_FN_COMMIT:
+	case DOS_FN_SEEK_END:
+		file = find_replay_file(rec->sft);
+		if (!file) {
+			// We did not manage to replay the open of this file
+			phase->skipped++;
+			return true;
+		}
+		break;
+	}
+
+	switch (rec->fn) {
+	case DOS_FN_CREATE:
+	case DOS_FN_OPEN:
+	case DOS_FN_OPEN_EX:
+		if (captured_ok) {
+			file = find_replay_file(0);
+			if (!file) {
+				phase->skipped++;
+				return true;
+			}
+		} else {
+			// Still replay it, but do not keep the result
+			file = NULL;
+		}
+
+		if (rec->fn == DOS_FN_CREATE) {
+			ok = _dos_creat(fn1, _A_NORMAL, &handle) == 0;
+		} else if (rec->fn == DOS_FN_OPEN) {
+			ok = _dos_open(fn1, rec->arg & 0xFF, &handle) == 0;
+		} else {
+			ok = dos_open_ex(fn1, rec->arg >> 8, rec->arg & 0xFF, &handle);
+		}
+
+		if (ok) {
+			if (file) {
+				file->sft = rec->sft;
+				file->handle = handle;
+			} else {
+				_dos_close(handle);
+			}
+		}
+		break;
+	case DOS_FN_CLOSE:
+		file->sft = 0;
+		ok = _dos_close(file->handle) == 0;
+		break;
+	case DOS_FN_READ:
+		ok = dos_seek(file->handle, rec->pos, SEEK_SET)
+		     && _dos_read(file->handle, iobuf, rec->arg, &bytes) == 0;
+		if (ok) {
+			phase->bytes_read += bytes;
+			if (captured_ok && bytes != rec->result) return false;
+		}
+		break;
+	case DOS_FN_WRITE:
+		ok = dos_seek(file->handle, rec->pos, SEEK_SET)
+		     && _dos_write(file->handle, iobuf, rec->arg, &bytes) == 0;
+		if (ok) {
+			phase->bytes_written += bytes;
+			if (captured_ok && bytes != rec->result) return false;
+		}
+		break;
+	case DOS_FN_COMMIT:
+		ok = _dos_commit(file->handle) == 0;
+		break;
+	case DOS_FN_SEEK_END:
+		ok = dos_seek(file->handle, 0, SEEK_END);
+		break;
+	case DOS_FN_GET_FILE_ATTR:
+		ok = _dos_getfileattr(fn1, &attr) == 0;
+		break;
+	case DOS_FN_DELETE:
+		ok = remove(fn1) == 0;
+		break;
+	case DOS_FN_RENAME:
+		ok = rename(fn1, fn2) == 0;
+		break;
+	case DOS_FN_MKDIR:
+		ok = mkdir(fn1) == 0;
+		break;
+	case DOS_FN_RMDIR:
+		ok = rmdir(fn1) == 0;
+		break;
+	case DOS_FN_CHDIR:
+		ok = chdir(fn1) == 0;
+		break;
+	case DOS_FN_FIND_FIRST:
+		find_valid = _dos_findfirst(fn1, rec->arg, &find) == 0;
+		ok = find_valid;
+		break;
+	case DOS_FN_FIND_NEXT:
+		if (!find_valid) {
+			phase->skipped++;
+			return true;
+		}
+		find_valid = _dos_findnext(&find) == 0;
+		ok = find_valid;
+		break;
+	case DOS_FN_GET_DISK_FREE:
+		ok = _dos_getdiskfree(drive_letter_to_index(drive) + 1, &df) == 0;
+		break;
+	default:
+		// Lock, set attributes, etc. are not captured with enough detail to replay them
+		phase->skipped++;
+		return true;
+	}
+
+	return ok == captured_ok;
+}
+
+static void print_replay_phase(unsigned num, const REPLAYPHASE *phase)
+{
+	uint16_t ticks = get_bios_ticks() - phase->start_ticks;
+
+	printf(_(1, 16, "Phase %u: %lu calls (%lu skipped, %lu with a different result) in %lu ms\n"),
+	       num, phase->calls, phase->skipped, phase->differed, ticks * 55UL);
+	printf(_(1, 17, "  HGCM calls: %lu (%lu when captured), bytes read: %lu, written: %lu\n"),
+	       phase->hgcm_calls, phase->captured_hgcm_calls,
+	       phase->bytes_read, phase->bytes_written);
+}
+
+/** Copies a filename from the capture, replacing its drive letter. */
+static const uint8_t __far * get_replay_name(char *dst, const uint8_t __far *src, char drive)
+{
+	unsigned len = src[0];
+
+	_fmemcpy(dst, src + 1, len);
+	dst[len] = '\0';
+	if (len > 0) dst[0] = drive;
+
+	return src + 1 + len;
+}
+
+static int replay(LPTSRDATA data, const char *filename, char drive)
+{
+	SFTRACEHEADER hdr;
+	segment_t trace_seg, io_seg;
+	const uint8_t __far *p;
+	char fn1[130], fn2[130];
+	REPLAYPHASE phase;
+	unsigned phase_num = 1, bytes;
+	uint32_t hgcm_calls;
+	int handle;
+	bool ok;
+
+	if (_dos_open(filename, O_RDONLY, &handle) != 0) {
+		fprintf(stderr, _(3, 27, "Cannot read capture from '%s'\n"), filename);
+		return EXIT_FAILURE;
+	}
+
+	if (_dos_read(handle, &hdr, sizeof(hdr), &bytes) != 0 || bytes != sizeof(hdr)
+	        || memcmp(hdr.magic, SFTRACE_MAGIC, sizeof(hdr.magic)) != 0
+	        || hdr.version != SFTRACE_VERSION) {
+		fprintf(stderr, _(3, 28, "'%s' is not a valid capture file\n"), filename);
+		_dos_close(handle);
+		return EXIT_FAILURE;
+	}
+
+	trace_seg = dos_alloc(get_paragraphs(hdr.size));
+	io_seg = dos_alloc(0x1000); // 64 KiB, the largest DOS read/write
+	if (!trace_seg || !io_seg) {
+		fprintf(stderr, _(3, 24, "Not enough memory for a %u KiB capture buffer\n"), hdr.size / 1024);
+		if (trace_seg) dos_free(trace_seg);
+		if (io_seg) dos_free(io_seg);
+		_dos_close(handle);
+		return EXIT_FAILURE;
+	}
+
+	if (_dos_read(handle, MK_FP(trace_seg, 0), hdr.size, &bytes) != 0 || bytes != hdr.size) {
+		fprintf(stderr, _(3, 28, "'%s' is not a valid capture file\n"), filename);
+		dos_free(trace_seg);
+		dos_free(io_seg);
+		_dos_close(handle);
+		return EXIT_FAILURE;
+	}
+	_dos_close(handle);
+	_fmemset(MK_FP(io_seg, 0), 0, 0xFFFF);
+
+	memset(replay_files, 0, sizeof(replay_files));
+	memset(&phase, 0, sizeof(phase));
+	phase.start_ticks = get_bios_ticks();
+
+	p = MK_FP(trace_seg, 0);
+	while (bytes - FP_OFF(p) >= sizeof(SFTRACERECORD)) {
+		const SFTRACERECORD __far *rec = (const SFTRACERECORD __far *) p;
+
+		p += sizeof(SFTRACERECORD);
+		fn1[0] = fn2[0] = '\0';
+		if (rec->flags & SFTRACE_FLAG_FN1) p = get_replay_name(fn1, p, drive);
+		if (rec->flags & SFTRACE_FLAG_FN2) p = get_replay_name(fn2, p, drive);
+		if (FP_OFF(p) > bytes) break; // Truncated capture
+
+		if (rec->fn == SFTRACE_FN_MARK) {
+			if (phase.calls) print_replay_phase(phase_num++, &phase);
+			memset(&phase, 0, sizeof(phase));
+			phase.start_ticks = get_bios_ticks();
+			continue;
+		}
+
+		hgcm_calls = data->vb.hgcm_calls;
+		ok = replay_call(rec, fn1, fn2, drive, MK_FP(io_seg, 0), &phase);
+
+		phase.calls++;
+		if (!ok) phase.differed++;
+		phase.hgcm_calls += data->vb.hgcm_calls - hgcm_calls;
+		phase.captured_hgcm_calls += rec->hgcm_calls;
+	}
+
+	if (phase.calls) print_replay_phase(phase_num, &phase);
+
+	// Close whatever the capture left open
+	for (bytes = 0; bytes < MAX_REPLAY_FILES; bytes++) {
+		if (replay_files[bytes].sft) _dos_close(replay_files[bytes].handle);
+	}
+
+	dos_free(io_seg);
+	dos_free(trace_seg);
+
+	return EXIT_SUCCESS;
+}
+#endif
+
 static int get_nls(uint8_t __far * __far *file_upper_case, FCHAR __far * __far *file_char)
 {
 	union REGS r;
@@ -469,6 +943,7 @@ static int configure_driver(LPTSRDATA data, bool short_fnames, uint8_t hash_char
 	for (i = 0; i < NUM_DRIVES; ++i) {
 		data->drives[i].root = SHFL_ROOT_NIL;
 	}
+	data->drive_bitmap = 0;
 	for (i = 0; i < NUM_FILES; ++i) {
 		data->files[i].root = SHFL_ROOT_NIL;
 		data->files[i].handle = SHFL_HANDLE_NIL;
@@ -603,6 +1078,14 @@ static int unconfigure_driver(LPTSRDATA data)
 
 	vbox_release_buffer(&data->vb);
 
+#if USE_TRACE
+	if (data->trace_seg) {
+		data->tracing = false;
+		dos_free(data->trace_seg);
+		data->trace_seg = 0;
+	}
+#endif
+
 	return 0;
 }
 
@@ -644,6 +1127,16 @@ static void print_help(void)
 	puts(_(0, 14,  "                             use '/cs' if host filesystem is case sensitive"));
 	puts(_(0, 12,  "    umount <X:>        unmount shared folder from drive X:"));
 	puts(_(0, 13,  "    rescan             unmount everything and recreate automounts"));
+#if USE_STATS
+	puts(_(0, 15,  "    stats [reset]      show (or clear) redirector call statistics"));
+#endif
+#if USE_TRACE
+	printf(_(0, 16, "    trace start [<KB>] start capturing redirector calls (%d KiB buffer default)\n"),
+	                                                         DEF_TRACE_KB);
+	puts(_(0, 17,  "    trace mark         start a new phase in the capture"));
+	puts(_(0, 18,  "    trace stop <FILE>  stop capturing and save the capture to FILE"));
+	puts(_(0, 19,  "    replay <FILE> <X:> repeat the calls from a saved capture on drive X:"));
+#endif
 }
 
 static int invalid_arg(const char *s)
@@ -787,6 +1280,59 @@ int main(int argc, const char *argv[])
 	} else if (stricmp(argv[argi], "rescan") == 0) {
 		if (!data) return driver_not_found();
 		return rescan(data);
+#if USE_STATS
+	} else if (stricmp(argv[argi], "stats") == 0) {
+		if (!data) return driver_not_found();
+
+		argi++;
+		if (argi < argc) {
+			if (stricmp(argv[argi], "reset") == 0) {
+				return reset_stats(data);
+			} else {
+				return invalid_arg(argv[argi]);
+			}
+		}
+
+		return print_stats(data);
+#endif
+#if USE_TRACE
+	} else if (stricmp(argv[argi], "trace") == 0) {
+		if (!data) return driver_not_found();
+
+		argi++;
+		if (argi >= argc) return arg_required("trace");
+		if (stricmp(argv[argi], "start") == 0) {
+			unsigned kb = DEF_TRACE_KB;
+			argi++;
+			if (argi < argc) {
+				kb = atoi(argv[argi]);
+				if (kb < 1 || kb > MAX_TRACE_KB) return invalid_arg(argv[argi]);
+			}
+			return trace_start(data, kb);
+		} else if (stricmp(argv[argi], "mark") == 0) {
+			return trace_mark(data);
+		} else if (stricmp(argv[argi], "stop") == 0) {
+			argi++;
+			if (argi >= argc) return arg_required("trace stop");
+			return trace_stop(data, argv[argi]);
+		} else {
+			return invalid_arg(argv[argi]);
+		}
+	} else if (stricmp(argv[argi], "replay") == 0) {
+		const char *filename;
+		char drive;
+		if (!data) return driver_not_found();
+
+		argi++;
+		if (argi >= argc) return arg_required("replay");
+		filename = argv[argi];
+		argi++;
+		if (argi >= argc) return arg_required("replay");
+		drive = get_drive_letter(argv[argi]);
+		if (!drive) return invalid_arg(argv[argi]);
+
+		return replay(data, filename, toupper(drive));
+#endif
 	} else {
 		return invalid_arg(argv[argi]);
 	}
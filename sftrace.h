@@ -0,0 +1,82 @@
+/*
+ * VBSF - Redirector call trace format
+ * Copyright (C) 2022 Javier S. Pedro
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef SFTRACE_H
+#define SFTRACE_H
+
+#include <stdint.h>
+
+/** Magic string at the start of every trace file. */
+#define SFTRACE_MAGIC "VBSFTRC"
+
+/** Version of the trace format. Increase on every incompatible change. */
+#define SFTRACE_VERSION 1
+
+/** Trace files start with this header, followed by the records. */
+typedef _Packed struct sftrace_header {
+	/** SFTRACE_MAGIC, including the terminating NUL. */
+	char magic[8];
+	/** SFTRACE_VERSION. */
+	uint16_t version;
+	/** Total size in bytes of the records following this header. */
+	uint16_t size;
+	/** Number of calls that did not fit in the capture buffer. */
+	uint16_t lost;
+	uint16_t reserved;
+} SFTRACEHEADER;
+
+enum sftrace_flags {
+	/** The call failed; result contains the DOS error code. */
+	SFTRACE_FLAG_ERROR = 1 << 0,
+	/** The record is followed by the SDA first filename (fn1). */
+	SFTRACE_FLAG_FN1   = 1 << 1,
+	/** The record is followed by the SDA second filename (fn2), after fn1. */
+	SFTRACE_FLAG_FN2   = 1 << 2,
+};
+
+/** Pseudo-function number used for the phase marks added by 'vbsf trace mark'. */
+#define SFTRACE_FN_MARK 0xFF
+
+/** One record per handled redirector call.
+ *  Filenames, if any, follow the record as a length byte plus the characters (no NUL). */
+typedef _Packed struct sftrace_record {
+	/** Redirector subfunction (DOS_FN_*), or SFTRACE_FN_MARK. */
+	uint8_t fn;
+	/** Combination of sftrace_flags. */
+	uint8_t flags;
+	/** Low word of the BIOS tick count when the call was made. */
+	uint16_t ticks;
+	/** Number of HGCM calls VBSF did to handle this call. */
+	uint16_t hgcm_calls;
+	/** Offset of the SFT the call refers to (identifies an open file), or 0. */
+	uint16_t sft;
+	/** File position in the SFT before the call, for SFT-based calls. */
+	uint32_t pos;
+	/** Function specific argument:
+	 *  requested bytes for read/write, open mode for open,
+	 *  action << 8 | mode for extended open, search attributes for find first. */
+	uint16_t arg;
+	/** DOS error code if the call failed; otherwise bytes transferred for read/write. */
+	uint16_t result;
+} SFTRACERECORD;
+
+/** Largest possible size of a record including its filenames. */
+#define SFTRACE_MAX_RECORD_SIZE (sizeof(SFTRACERECORD) + 2 * (1 + 128))
+
+#endif // SFTRACE_H
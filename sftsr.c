@@ -30,6 +30,7 @@ TSRDATA data = {
 	// TSR installation data
 	NULL, /** Previous int2f ISR, storing it for uninstall. */
 	NULL, /** Stored pointer for the DOS SDA. */
+	0,    /** Bitmap of mounted drives. */
 
 	// TSR configuration
 	0,          /** Offset (in seconds/2) of the current timezone. */
@@ -653,6 +654,10 @@ static void handle_read(union INTPACK __far *r)
 
 	dprintf("handle_read bytes_read=%u\n", bytes);
 
+#if USE_STATS
+	data.bytes_read += bytes;
+#endif
+
 	// Advance the file position
 	sft->f_pos += bytes;
 
@@ -707,6 +712,10 @@ static void handle_write(union INTPACK __far *r)
 
 	dprintf("handle_write bytes_written=%u\n", bytes);
 
+#if USE_STATS
+	data.bytes_written += bytes;
+#endif
+
 	// Advance the file position
 	sft->f_pos += bytes;
 
@@ -772,7 +781,7 @@ static void handle_seek_end(union INTPACK __far *r)
 	DOSSFT __far *sft = MK_FP(r->w.es, r->w.di);
 	unsigned openfile = get_sft_openfile_index(sft);
 	uint8_t __far *buffer = data.dossda->cur_dta;
-	long offset = ((uint32_t)(r->w.cx) << 16) | (uint32_t)(r->w.dx);
+	int32_t offset = ((uint32_t)(r->w.cx) << 16) | (uint32_t)(r->w.dx);
 	unsigned buf_size = sizeof(SHFLFSOBJINFO);
 	vboxerr err;
 
@@ -1098,7 +1107,7 @@ static vboxerr find_next_from_vbox(unsigned openfile, char __far *path)
 		hash = lfn_name_hash( shfldirinfo.dirinfo.name.ach, shfldirinfo.dirinfo.name.u16Length );
 
 		if (data.short_fnames && shfldirinfo.dirinfo.cucShortName != 0) {
-			valid = utf16_to_local( &data, &shfldirinfo.dirinfo.name.ach, &shfldirinfo.dirinfo.uszShortName, shfldirinfo.dirinfo.cucShortName);
+			valid = utf16_to_local( &data, (uint8_t *)shfldirinfo.dirinfo.name.ach, shfldirinfo.dirinfo.uszShortName, shfldirinfo.dirinfo.cucShortName);
  
 			if (!valid) {
 				// Should not happen as Windows short names are pure ascii
@@ -1407,98 +1416,339 @@ static void handle_get_disk_free(union INTPACK __far *r)
 	clear_dos_err(r);
 }
 
-static bool int2f_11_handler(union INTPACK r)
-#pragma aux int2f_11_handler "*" parm caller [] value [al] modify [ax bx cx dx si di es gs fs]
+/** Handles a redirector call for one of our drives.
+ *  @returns true if the call was handled. */
+static bool dispatch_call(union INTPACK __far *r)
 {
-	if (r.h.ah != 0x11) return false; // Only interested in network redirector functions
-	if (r.h.al == 0xff && r.w.bx == 0x5742 && r.w.cx == 0x5346) {
-		// These are the magic numbers to our private "Get TSR data" function
-		dputs("Get TSR data");
-		r.w.es = get_ds();
-		r.w.di = FP_OFF(&data);
-		r.w.bx = 0x5444;
-		r.w.cx = 1;
-		return true;
-	}
-
-#if TRACE_CALLS
-	dprintf("2f al=%hx\n", r.h.al);
-#endif
-
-	// Handle special functions that target all redirectors first
-	switch (r.h.al) {
-	case DOS_FN_CLOSE_ALL:
-		handle_close_all(&r);
-		return false; // Let others do the same
-	}
-
-	// Now handle normal functions if they refer to our mounted drives
-	if (!is_call_for_mounted_drive(&r)) {
-		return false;
-	}
-
-	switch (r.h.al) {
+	switch (r->h.al) {
 	case DOS_FN_CLOSE:
-		handle_close(&r);
+		handle_close(r);
 		return true;
 	case DOS_FN_CREATE:
 	case DOS_FN_OPEN:
 	case DOS_FN_OPEN_EX:
-		handle_create_open_ex(&r);
+		handle_create_open_ex(r);
 		return true;
 	case DOS_FN_READ:
-		handle_read(&r);
+		handle_read(r);
 		return true;
 	case DOS_FN_WRITE:
-		handle_write(&r);
+		handle_write(r);
 		return true;
 	case DOS_FN_COMMIT:
-		handle_commit(&r);
+		handle_commit(r);
 		return true;
 	case DOS_FN_LOCK:
-		handle_lock(&r);
+		handle_lock(r);
 		return true;
 	case DOS_FN_SEEK_END:
-		handle_seek_end(&r);
+		handle_seek_end(r);
 		return true;
 	case DOS_FN_DELETE:
-		handle_delete(&r);
+		handle_delete(r);
 		return true;
 	case DOS_FN_RENAME:
-		handle_rename(&r);
+		handle_rename(r);
 		return true;
 	case DOS_FN_GET_FILE_ATTR:
-		handle_getattr(&r);
+		handle_getattr(r);
 		return true;
 	case DOS_FN_SET_FILE_ATTR:
-		handle_setattr(&r);
+		handle_setattr(r);
 		return true;
 	case DOS_FN_FIND_FIRST:
-		handle_find_first(&r);
+		handle_find_first(r);
 		return true;
 	case DOS_FN_FIND_NEXT:
-		handle_find_next(&r);
+		handle_find_next(r);
 		return true;
 	case DOS_FN_CHDIR:
-		handle_chdir(&r);
+		handle_chdir(r);
 		return true;
 	case DOS_FN_MKDIR:
-		handle_mkdir(&r);
+		handle_mkdir(r);
 		return true;
 	case DOS_FN_RMDIR:
-		handle_rmdir(&r);
+		handle_rmdir(r);
 		return true;
 	case DOS_FN_GET_DISK_FREE:
-		handle_get_disk_free(&r);
+		handle_get_disk_free(r);
 		return true;
 	}
 
 	return false;
 }
 
+#if USE_TRACE
+/** Starts a new record in the capture buffer for the call about to be handled.
+ *  @returns NULL if there is no space left. */
+static SFTRACERECORD __far * trace_begin(union INTPACK __far *r)
+{
+	DOSSFT __far *sft = MK_FP(r->w.es, r->w.di);
+	SFTRACERECORD __far *rec;
+
+	if (data.trace_size - data.trace_len < SFTRACE_MAX_RECORD_SIZE) {
+		data.trace_lost++;
+		return NULL;
+	}
+
+	rec = MK_FP(data.trace_seg, data.trace_len);
+	rec->fn = r->h.al;
+	rec->flags = 0;
+	rec->ticks = *(volatile uint16_t __far *) MK_FP(0x40, 0x6C); // BDA tick count
+	rec->hgcm_calls = 0;
+	rec->sft = 0;
+	rec->pos = 0;
+	rec->arg = 0;
+	rec->result = 0;
+
+	switch (r->h.al) {
+	case DOS_FN_READ:
+	case DOS_FN_WRITE:
+		rec->arg = r->w.cx;
+		// Fallthrough
+	case DOS_FN_CLOSE:
+	case DOS_FN_COMMIT:
+	case DOS_FN_LOCK:
+	case DOS_FN_SEEK_END:
+		rec->sft = r->w.di;
+		rec->pos = sft->f_pos;
+		break;
+	case DOS_FN_OPEN:
+		rec->arg = data.dossda->open_mode;
+		break;
+	case DOS_FN_OPEN_EX:
+		rec->arg = (data.dossda->openex_act << 8) | (data.dossda->openex_mode & 0xFF);
+		break;
+	case DOS_FN_FIND_FIRST:
+		rec->arg = data.dossda->search_attr;
+		break;
+	}
+
+	return rec;
+}
+
+static uint8_t __far * trace_append_name(uint8_t __far *p, const char __far *name)
+{
+	const char __far *end = _fmemchr(name, '\0', sizeof(data.dossda->fn1));
+	unsigned len = end ? end - name : sizeof(data.dossda->fn1);
+
+	*p = len;
+	_fmemcpy(p + 1, name, len);
+
+	return p + 1 + len;
+}
+
+/** Completes the record with the results of the call and commits it. */
+static void trace_end(SFTRACERECORD __far *rec, union INTPACK __far *r, uint16_t hgcm_calls)
+{
+	uint8_t __far *p = (uint8_t __far *) (rec + 1);
+
+	rec->hgcm_calls = hgcm_calls;
+
+	if (r->w.flags & INTR_CF) {
+		rec->flags |= SFTRACE_FLAG_ERROR;
+		rec->result = r->w.ax;
+	} else if (rec->fn == DOS_FN_READ || rec->fn == DOS_FN_WRITE) {
+		rec->result = r->w.cx;
+	}
+
+	switch (rec->fn) {
+	case DOS_FN_CREATE:
+	case DOS_FN_OPEN:
+	case DOS_FN_OPEN_EX:
+		rec->sft = r->w.di; // This identifies the file in later calls
+		// Fallthrough
+	case DOS_FN_RMDIR:
+	case DOS_FN_MKDIR:
+	case DOS_FN_CHDIR:
+	case DOS_FN_SET_FILE_ATTR:
+	case DOS_FN_GET_FILE_ATTR:
+	case DOS_FN_DELETE:
+	case DOS_FN_FIND_FIRST:
+		rec->flags |= SFTRACE_FLAG_FN1;
+		p = trace_append_name(p, data.dossda->fn1);
+		break;
+	case DOS_FN_RENAME:
+		rec->flags |= SFTRACE_FLAG_FN1 | SFTRACE_FLAG_FN2;
+		p = trace_append_name(p, data.dossda->fn1);
+		p = trace_append_name(p, data.dossda->fn2);
+		break;
+	}
+
+	data.trace_len = FP_OFF(p);
+}
+#endif
+
+#if USE_STATS || USE_TRACE
+/** Like dispatch_call(), but also updates statistics and the capture buffer. */
+static bool dispatch_call_accounted(union INTPACK __far *r)
+{
+	uint8_t fn = r->h.al;
+	uint32_t hgcm_calls = data.vb.hgcm_calls;
+#if USE_TRACE
+	SFTRACERECORD __far *rec = data.tracing ? trace_begin(r) : NULL;
+#endif
+
+	if (!dispatch_call(r)) {
+		return false;
+	}
+
+	hgcm_calls = data.vb.hgcm_calls - hgcm_calls;
+
+#if USE_STATS
+	if (fn < NUM_STATS_FN) {
+		data.stats[fn].calls++;
+		data.stats[fn].hgcm_calls += hgcm_calls;
+	}
+#endif
+#if USE_TRACE
+	if (rec) {
+		trace_end(rec, r, hgcm_calls);
+	}
+#endif
+
+	return true;
+}
+#endif
+
+/** Handles an int 2Fh call, updating the registers in r.
+ *  @returns true if the call was handled and must not be chained. */
+static bool handle_redirector_call(union INTPACK __far *r)
+{
+	if (r->h.ah != 0x11) return false; // Only interested in network redirector functions
+	if (r->h.al == 0xff && r->w.bx == 0x5742 && r->w.cx == 0x5346) {
+		// These are the magic numbers to our private "Get TSR data" function
+		dputs("Get TSR data");
+		r->w.es = get_ds();
+		r->w.di = FP_OFF(&data);
+		r->w.bx = 0x5444;
+		r->w.cx = 1;
+		return true;
+	}
+
+#if TRACE_CALLS
+	dprintf("2f al=%hx\n", r->h.al);
+#endif
+
+	// Handle special functions that target all redirectors first
+	switch (r->h.al) {
+	case DOS_FN_CLOSE_ALL:
+		handle_close_all(r);
+		return false; // Let others do the same
+	}
+
+	// Now handle normal functions if they refer to our mounted drives
+	if (!is_call_for_mounted_drive(r)) {
+		return false;
+	}
+
+#if USE_STATS || USE_TRACE
+	return dispatch_call_accounted(r);
+#else
+	return dispatch_call(r);
+#endif
+}
+
+// The int2f_isr entry point is only built with Open Watcom;
+// the host test harness (see host/) calls handle_redirector_call() directly.
+#if defined(__WATCOMC__)
+
+static bool int2f_11_handler(union INTPACK r)
+#pragma aux int2f_11_handler "*" parm caller [] value [al] modify [ax bx cx dx si di es gs fs]
+{
+	return handle_redirector_call(&r);
+}
+
+// The assembly in int2f_isr uses fixed offsets into data.
+STATIC_ASSERT(offsetof(TSRDATA, prev_int2f_handler) == 0);
+STATIC_ASSERT(offsetof(TSRDATA, dossda) == 4);
+STATIC_ASSERT(offsetof(TSRDATA, drive_bitmap) == 8);
+STATIC_ASSERT(offsetof(DOSSFT, dev_info) == 5);
+STATIC_ASSERT(NUM_DRIVES <= 32);
+
+// Classes of redirector functions for the int2f_isr fast path.
+// These are macros since they are also used from the inline assembly.
+/** Not supported by us, always chained. */
+#define FN_CLASS_NONE 0
+/** Refers to an SFT in es:di, which contains the drive number. */
+#define FN_CLASS_SFT  1
+/** Refers to the filename in the SDA fn1 field, which starts with the drive letter. */
+#define FN_CLASS_FN1  2
+/** Must go through int2f_11_handler to decide. */
+#define FN_CLASS_SLOW 3
+
+#define NUM_FN_CLASSES 0x2F
+STATIC_ASSERT(NUM_FN_CLASSES == DOS_FN_OPEN_EX + 1);
+
+/** Class of each redirector function; must agree with get_op_drive_num(). */
+static const uint8_t fn_classes[NUM_FN_CLASSES] = {
+	/* 0x00 */ FN_CLASS_NONE, FN_CLASS_FN1,  FN_CLASS_NONE, FN_CLASS_FN1,
+	/* 0x04 */ FN_CLASS_NONE, FN_CLASS_FN1,  FN_CLASS_SFT,  FN_CLASS_SFT,
+	/* 0x08 */ FN_CLASS_SFT,  FN_CLASS_SFT,  FN_CLASS_SFT,  FN_CLASS_SFT,
+	/* 0x0C */ FN_CLASS_SLOW, FN_CLASS_NONE, FN_CLASS_FN1,  FN_CLASS_FN1,
+	/* 0x10 */ FN_CLASS_NONE, FN_CLASS_FN1,  FN_CLASS_NONE, FN_CLASS_FN1,
+	/* 0x14 */ FN_CLASS_NONE, FN_CLASS_NONE, FN_CLASS_FN1,  FN_CLASS_FN1,
+	/* 0x18 */ FN_CLASS_NONE, FN_CLASS_NONE, FN_CLASS_NONE, FN_CLASS_FN1,
+	/* 0x1C */ FN_CLASS_SLOW, FN_CLASS_SLOW, FN_CLASS_NONE, FN_CLASS_NONE,
+	/* 0x20 */ FN_CLASS_NONE, FN_CLASS_SFT,  FN_CLASS_NONE, FN_CLASS_NONE,
+	/* 0x24 */ FN_CLASS_NONE, FN_CLASS_NONE, FN_CLASS_NONE, FN_CLASS_NONE,
+	/* 0x28 */ FN_CLASS_NONE, FN_CLASS_NONE, FN_CLASS_NONE, FN_CLASS_NONE,
+	/* 0x2C */ FN_CLASS_NONE, FN_CLASS_NONE, FN_CLASS_FN1
+};
+
 void __declspec(naked) __far int2f_isr(void)
 {
 	__asm {
+		; Fast path: chain calls which are clearly not for us
+		; without saving the entire register frame.
+		cmp ah, 0x11
+		jne chain
+		cmp al, NUM_FN_CLASSES
+		jae slow ; e.g. our private "get TSR data" call
+
+		push bx
+		push ds
+
+		xor bh, bh
+		mov bl, al
+		mov bl, byte ptr cs:fn_classes[bx]
+		cmp bl, FN_CLASS_SFT
+		je sft_call
+		cmp bl, FN_CLASS_FN1
+		je fn1_call
+		test bl, bl
+		jz not_ours
+		jmp slow_pop
+
+	sft_call:
+		mov bl, es:[di + 5] ; sft->dev_info
+		and bx, 0x1F        ; DOS_SFT_DRIVE_MASK
+		jmp test_drive
+
+	fn1_call:
+		lds bx, cs:[data + 4] ; data.dossda
+		mov bl, [bx + 0x9E]   ; data.dossda->fn1[0], the drive letter
+		and bl, 0xDF          ; to uppercase
+		sub bl, 'A'
+		xor bh, bh
+		cmp bx, NUM_DRIVES
+		jae not_ours
+
+	test_drive:
+		bt word ptr cs:[data + 8], bx ; data.drive_bitmap
+		jc slow_pop
+
+	not_ours:
+		pop ds
+		pop bx
+		jmp chain
+
+	slow_pop:
+		pop ds
+		pop bx
+
+	slow:
 		pusha
 		push ds
 		push es
@@ -1519,8 +1769,9 @@ void __declspec(naked) __far int2f_isr(void)
 		pop ds
 		popa
 
+	chain:
 		; Jump to the next handler in the chain
-		jmp dword ptr cs:[data + 0] ; wasm doesn't support structs, this is data.prev_int2f_handler
+		jmp dword ptr cs:[data + 0] ; wasm does not support structs, this is data.prev_int2f_handler
 
 	handled:
 		pop gs
@@ -1532,24 +1783,7 @@ void __declspec(naked) __far int2f_isr(void)
 	}
 }
 
-static LPTSRDATA int2f_get_tsr_data(void);
-#pragma aux int2f_get_tsr_data = \
-	"mov ax, 0x11ff" \
-	"mov bx, 0x5742" /* Add magic numbers */ \
-	"mov cx, 0x5346" \
-	"int 0x2f"   \
-	"cmp bx, 0x5444" /* Test output magic number */ \
-	"jne fail" \
-	"cmp cx, 1" \
-	"jne fail" \
-	"jmp end" \
-	"fail:" \
-	"xor ax, ax" \
-	"mov es, ax" \
-	"mov di, ax" \
-	"end:" \
-	__value [es di] \
-	__modify [ax bx cx]
+#endif // __WATCOMC__
 
 LPTSRDATA __far get_tsr_data(bool installed)
 {
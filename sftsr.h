@@ -25,9 +25,14 @@
 
 #include "vbox.h"
 #include "int21dos.h"
+#include "sftrace.h"
 
 /** Trace all int2F calls into dlog */
 #define TRACE_CALLS   0
+/** Keep per-function counters of redirector calls and HGCM calls (see 'vbsf stats'). */
+#define USE_STATS     1
+/** Support capturing redirector calls into a trace buffer (see 'vbsf trace'). */
+#define USE_TRACE     1
 
 #define LASTDRIVE     'Z'
 #define NUM_DRIVES    ((LASTDRIVE - 'A') + 1)
@@ -47,6 +52,9 @@
 
 #define INVALID_OPENFILE (-1)
 
+/** Statistics are kept for redirector functions below this one. */
+#define NUM_STATS_FN  (DOS_FN_OPEN_EX + 1)
+
 typedef struct {
 	uint32_t root;
 	uint64_t handle;
@@ -56,12 +64,22 @@ typedef struct {
 // but we still waste a full uint64_t to store a value that is always < 4K.
 // Similarly, at most 64 roots are supported, but we waste a uint32_t.
 
+typedef struct {
+	/** Number of calls to this redirector function that we handled. */
+	uint32_t calls;
+	/** Number of HGCM calls done by VBSF while handling them. */
+	uint32_t hgcm_calls;
+} CALLSTATS;
+
 typedef struct {
 	// TSR installation data
 	/** Previous int2f ISR, storing it for uninstall. */
 	void (__interrupt __far *prev_int2f_handler)();
 	/** Stored pointer for the DOS SDA. */
 	DOSSDA __far *dossda;
+	/** Bit n is set if drive n is mounted; used by the int2f_isr fast path.
+	 *  The above fields and this one are accessed from assembly, keep their offsets. */
+	uint32_t drive_bitmap;
 
 	// TSR configuration
 	/** Offset (in seconds/2) of the current timezone.
@@ -92,6 +110,26 @@ typedef struct {
 	struct vboxcomm vb;
 	char vbbuf[VBOX_BUFFER_SIZE];
 	uint32_t hgcm_client_id;
+
+#if USE_STATS
+	// Statistics
+	/** Counters for each redirector function. */
+	CALLSTATS stats[NUM_STATS_FN];
+	/** Total number of bytes read and written. */
+	uint32_t bytes_read, bytes_written;
+#endif
+
+#if USE_TRACE
+	// Call capture
+	/** Whether calls are being appended to the capture buffer. */
+	bool tracing;
+	/** Segment of the capture buffer, or 0 if there is none. */
+	segment_t trace_seg;
+	/** Size of the capture buffer, and bytes of it used so far. */
+	uint16_t trace_size, trace_len;
+	/** Number of calls which did not fit in the buffer. */
+	uint16_t trace_lost;
+#endif
 } TSRDATA;
 
 typedef TSRDATA * PTSRDATA;
@@ -101,6 +139,27 @@ extern void __declspec(naked) __far int2f_isr(void);
 
 extern LPTSRDATA __far get_tsr_data(bool installed);
 
+/** Calls our private int2F "get TSR data" function,
+ *  returning NULL if VBSF is not installed. */
+static LPTSRDATA int2f_get_tsr_data(void);
+#pragma aux int2f_get_tsr_data = \
+	"mov ax, 0x11ff" \
+	"mov bx, 0x5742" /* Add magic numbers */ \
+	"mov cx, 0x5346" \
+	"int 0x2f"   \
+	"cmp bx, 0x5444" /* Test output magic number */ \
+	"jne fail" \
+	"cmp cx, 1" \
+	"jne fail" \
+	"jmp end" \
+	"fail:" \
+	"xor ax, ax" \
+	"mov es, ax" \
+	"mov di, ax" \
+	"end:" \
+	__value [es di] \
+	__modify [ax bx cx]
+
 /** This symbol is always at the end of the TSR segment */
 extern int resident_end;
 
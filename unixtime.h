@@ -70,6 +70,7 @@ static void timestampns_to_dos_time(uint16_t __far *dos_time, uint16_t __far *do
 	int per_year, per_month;
 	bool is_leap;
 
+#if defined(__WATCOMC__)
 	// Since we can only run on >= 386 anyway, let's do the initial
 	// 64-bit division and the rest of 32-bit divisions/modulos
 	// in asm using 386 32-bit instructions.
@@ -117,6 +118,18 @@ static void timestampns_to_dos_time(uint16_t __far *dos_time, uint16_t __far *do
 		pop ecx
 		pop eax
 	}
+#else
+	// Same as above, for the host test harness
+	{
+		int32_t seconds2_since_epoch = (int32_t)(timestampns / (2 * 1000000000LL)) - tzoffset;
+		unsigned seconds2_since_day = seconds2_since_epoch % ((24 * 60 * 60) / 2);
+
+		days_since_epoch = seconds2_since_epoch / ((24 * 60 * 60) / 2);
+		seconds2 = seconds2_since_day % (60 / 2);
+		minutes = (seconds2_since_day / (60 / 2)) % 60;
+		hours = (seconds2_since_day / (60 / 2)) / 60;
+	}
+#endif
 
 	year = UNIX_EPOCH_YEAR;
 	if (days_since_epoch > 0) {
@@ -179,6 +192,7 @@ static void timestampns_from_dos_time(int64_t *timestampns, uint16_t dos_time, u
 
 	seconds2_since_day = seconds2 + (minutes * 60U/2) + (hours * 3600U/2);
 
+#if defined(__WATCOMC__)
 	__asm {
 		push eax
 		push ecx
@@ -206,6 +220,11 @@ static void timestampns_from_dos_time(int64_t *timestampns, uint16_t dos_time, u
 		pop ecx
 		pop eax
 	}
+#else
+	*timestampns = (int64_t)(int32_t)(days_since_epoch * ((24 * 60 * 60) / 2)
+	                                  + seconds2_since_day + tzoffset)
+	               * (2 * 1000000000LL);
+#endif
 }
 
 #endif // UNIXTIME_H
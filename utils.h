@@ -23,7 +23,10 @@
 #include <stdint.h>
 #include <i86.h>
 
+// The host test harness (see host/) defines its own, as far pointers are larger there.
+#ifndef STATIC_ASSERT
 #define STATIC_ASSERT(expr)           typedef int STATIC_ASSERT_FAILED[(expr) ? 1 : -1]
+#endif
 
 #define MIN(a,b)  (((a) < (b)) ? (a) : (b))
 #define MAX(a,b)  (((a) > (b)) ? (a) : (b))
@@ -42,6 +45,13 @@ static inline __segment get_ds(void);
 static inline __segment get_ss(void);
 #pragma aux get_ss = "mov ax, ss" value [ax] modify exact [];
 
+/** Disables interrupts and returns the previous flags, for restore_flags(). */
+static inline uint16_t save_flags_cli(void);
+#pragma aux save_flags_cli = "pushf" "pop ax" "cli" value [ax] modify exact [ax];
+
+static inline void restore_flags(uint16_t flags);
+#pragma aux restore_flags = "push ax" "popf" parm [ax] modify exact [];
+
 /** Converts a far pointer into equivalent linear address.
  *  Note that under protected mode linear != physical (for that, need VDS). */
 static inline uint32_t linear_addr(const void __far * ptr)
@@ -49,6 +59,15 @@ static inline uint32_t linear_addr(const void __far * ptr)
 	return ((uint32_t)(FP_SEG(ptr)) << 4) + FP_OFF(ptr);
 }
 
+/** Multiplies two 16-bit unsigned numbers into a 32-bit result,
+ *  without calling into the runtime. */
+static uint32_t mulu32(unsigned a, unsigned b);
+#pragma aux mulu32 = \
+	"mul dx" /* dx:ax = a * b */ \
+	__parm [ax] [dx] \
+	__value [dx ax] \
+	__modify [ax dx]
+
 /** Map x linearly from range [0, srcmax] to [0, dstmax].
  *  Equivalent of (x * dstmax) / srcmax but with 32-bit unsigned precision. */
 static unsigned scaleu(unsigned x, unsigned srcmax, unsigned dstmax);
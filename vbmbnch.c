@@ -0,0 +1,216 @@
+/*
+ * VBMouse - Cursor rendering benchmark
+ * Copyright (C) 2022 Javier S. Pedro
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dos.h>
+
+#include "version.h"
+#include "utils.h"
+#include "int08pit.h"
+#include "int10vga.h"
+#include "int33.h"
+
+/** Number of cursor moves measured in each video mode. */
+#define NUM_MOVES 2000U
+
+/** Number of calls measured for each polling function. */
+#define NUM_POLLS 50000U
+
+/** Graphic video modes measured by default. */
+static const uint8_t default_modes[] = { 0x4, 0x6, 0xD, 0xE, 0xF, 0x10, 0x11, 0x12, 0x13 };
+
+/** int33 functions that programs call repeatedly to poll the mouse state. */
+static const uint8_t poll_functions[] = {
+	INT33_GET_MOUSE_POSITION,
+	INT33_GET_BUTTON_PRESSED_COUNTER,
+	INT33_GET_BUTTON_RELEASED_COUNTER,
+	INT33_GET_MOUSE_MOTION
+};
+
+static void int10_set_video_mode(uint8_t mode);
+#pragma aux int10_set_video_mode = \
+	"xor ah, ah" \
+	"int 0x10" \
+	__parm [al] \
+	__modify [ax bx cx dx si di]
+
+static void int10_set_vbe_mode(uint16_t mode);
+#pragma aux int10_set_vbe_mode = \
+	"mov ax, 0x4F02" \
+	"int 0x10" \
+	__parm [bx] \
+	__modify [ax bx cx dx si di]
+
+static void int33_set_position(int16_t x, int16_t y);
+#pragma aux int33_set_position = \
+	"mov ax, 0x4" \
+	"int 0x33" \
+	__parm [cx] [dx] \
+	__modify [ax]
+
+/** Calls a polling int33 function, asking for the left button counters if relevant. */
+static void int33_poll(uint16_t function);
+#pragma aux int33_poll = \
+	"xor bx, bx" \
+	"int 0x33" \
+	__parm [ax] \
+	__modify [ax bx cx dx]
+
+/** Moves the cursor NUM_MOVES times in the given video mode,
+ *  with the cursor shown, and returns the elapsed PIT clocks. */
+static uint32_t test_mode(uint16_t mode)
+{
+	uint32_t start_time, clocks;
+	unsigned i;
+
+	if (mode >= 0x100) {
+		int10_set_vbe_mode(mode);
+	} else {
+		int10_set_video_mode(mode);
+	}
+	int33_reset();
+	int33_show_cursor();
+
+	start_time = pit_get_timestamp();
+	for (i = 0; i < NUM_MOVES; i++) {
+		// Cover all sub-byte alignments and both CGA scanline banks,
+		// while staying inside the smallest (640x200 in int33 coordinates) screen.
+		int33_set_position(200 + (i % 32), 100 + (i % 16));
+	}
+	clocks = pit_get_timestamp() - start_time;
+
+	int33_hide_cursor();
+
+	return clocks;
+}
+
+/** Calls the given int33 function NUM_POLLS times in a tight loop
+ *  and returns the elapsed PIT clocks. */
+static uint32_t test_poll(uint8_t function)
+{
+	uint32_t start_time;
+	unsigned i;
+
+	start_time = pit_get_timestamp();
+	for (i = 0; i < NUM_POLLS; i++) {
+		int33_poll(function);
+	}
+	return pit_get_timestamp() - start_time;
+}
+
+static int benchmark_polling(void)
+{
+	uint32_t clocks[sizeof(poll_functions)];
+	unsigned i;
+
+	pit_start_timing();
+
+	for (i = 0; i < sizeof(poll_functions); i++) {
+		clocks[i] = test_poll(poll_functions[i]);
+	}
+
+	pit_stop_timing();
+
+	printf("# VBMBNCH %x.%x\n", VERSION_MAJOR, VERSION_MINOR);
+	puts("function,calls,usecs,calls_per_sec");
+	for (i = 0; i < sizeof(poll_functions); i++) {
+		// Avoid 32-bit overflow by dropping the two least significant digits
+		uint32_t hclocks = MAX(clocks[i] / 100, 1);
+		printf("%x,%u,%lu,%lu\n", poll_functions[i], NUM_POLLS,
+		       pit_clocks_to_usecs(clocks[i]),
+		       (NUM_POLLS * (PIT_FREQUENCY / 100)) / hclocks);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static void print_help(void)
+{
+	puts("\nUsage:\n"
+	     "    VBMBNCH [<MODE>..]\n"
+	     "    VBMBNCH POLL\n\n"
+	     "Measures how long the installed mouse driver takes to move the cursor\n"
+	     "in each of the given video modes (hex), by default 4 6 D E F 10 11 12 13.\n"
+	     "Modes 100 and above are set as VESA modes, e.g. 103 for 800x600x256.\n"
+	     "Output is CSV: mode,moves,usecs,clocks_per_move\n\n"
+	     "With POLL, measures how many times per second the driver can answer\n"
+	     "the int33 polling functions 3, 5, 6 and 0Bh.\n"
+	     "Output is CSV: function,calls,usecs,calls_per_sec");
+}
+
+int main(int argc, const char *argv[])
+{
+	uint16_t modes[16];
+	uint32_t clocks[16];
+	unsigned num_modes = 0;
+	uint8_t old_mode;
+	unsigned i;
+	int argi;
+
+	if (!int33_reset()) {
+		fputs("No mouse driver installed\n", stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (argc == 2 && stricmp(argv[1], "poll") == 0) {
+		return benchmark_polling();
+	}
+
+	for (argi = 1; argi < argc; argi++) {
+		char *end;
+		unsigned long mode = strtoul(argv[argi], &end, 16);
+		if (num_modes >= sizeof(modes) / sizeof(modes[0]) || *end != '\0'
+		        || (mode > 0x13 && mode < 0x100) || mode > 0x1FF) {
+			print_help();
+			return EXIT_FAILURE;
+		}
+		modes[num_modes++] = mode;
+	}
+	if (num_modes == 0) {
+		for (i = 0; i < sizeof(default_modes); i++) {
+			modes[i] = default_modes[i];
+		}
+		num_modes = sizeof(default_modes);
+	}
+
+	old_mode = bda_get_video_mode() & ~0x80;
+
+	pit_start_timing();
+
+	// Results are only printed at the end, since we keep changing video modes.
+	for (i = 0; i < num_modes; i++) {
+		clocks[i] = test_mode(modes[i]);
+	}
+
+	pit_stop_timing();
+
+	int10_set_video_mode(old_mode);
+	int33_reset();
+
+	printf("# VBMBNCH %x.%x\n", VERSION_MAJOR, VERSION_MINOR);
+	puts("mode,moves,usecs,clocks_per_move");
+	for (i = 0; i < num_modes; i++) {
+		printf("%x,%u,%lu,%lu\n", modes[i], NUM_MOVES,
+		       pit_clocks_to_usecs(clocks[i]), clocks[i] / NUM_MOVES);
+	}
+
+	return EXIT_SUCCESS;
+}
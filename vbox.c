@@ -45,6 +45,7 @@ int vbox_init_device(LPVBOXCOMM vb)
 	pcisel pcidev;
 	uint16_t command;
 	uint32_t bar;
+	uint8_t irq;
 
 	if ((err = pci_init_bios())) {
 		return err;
@@ -74,6 +75,13 @@ int vbox_init_device(LPVBOXCOMM vb)
 
 	vb->iobase = bar & 0xFFFC;
 
+	if (pci_read_config_byte(pcidev, CFG_INTERRUPT, &irq) || irq == 0 || irq >= 16) {
+		// No interrupt line; users will have to poll
+		irq = 0xFF;
+	}
+
+	vb->irq = irq;
+
 	return 0;
 }
 
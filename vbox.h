@@ -35,11 +35,15 @@
 typedef struct vboxcomm {
 	/** The IO port of the VirtualBox pci device, found by vbox_init_device(). */
 	uint16_t iobase;
+	/** The interrupt line (IRQ) of the VirtualBox pci device, or 0xFF if none. */
+	uint8_t irq;
 	/** Whether we are using VDS or not. */
 	bool vds;
 	/** The VDS (Virtual DMA service) descriptor corresponding to the buffer that we will use.
 	 *  Initialized by vbox_init_buffer(), even if we don't use VDS. */
 	VDSDDS dds;
+	/** Number of HGCM calls sent so far, for statistics. */
+	uint32_t hgcm_calls;
 	/** We assume the actual buffer comes in memory after this struct. */
 	char buf[];
 } vboxcomm_t;
@@ -112,6 +116,35 @@ static vboxerr vbox_set_mouse(LPVBOXCOMM vb, bool absolute, bool pointer)
 	return req->header.rc;
 }
 
+/** Adds/removes events to the set of events that will raise the VMMDev interrupt. */
+static vboxerr vbox_set_filter_mask(LPVBOXCOMM vb, uint32_t add, uint32_t remove)
+{
+	VMMDevCtlGuestFilterMask __far *req = (void __far *) vb->buf;
+
+	vbox_init_req(&req->header, VMMDevReq_CtlGuestFilterMask, sizeof(VMMDevCtlGuestFilterMask));
+	req->u32OrMask = add;
+	req->u32NotMask = remove;
+
+	vbox_send_request(vb->iobase, vb->dds.physicalAddress);
+
+	return req->header.rc;
+}
+
+/** Gets and acknowledges the pending events, which also lowers the VMMDev interrupt.
+  * @param events set to the events which were pending, 0 if none. */
+static vboxerr vbox_ack_events(LPVBOXCOMM vb, uint32_t __far *events)
+{
+	VMMDevEvents __far *req = (void __far *) vb->buf;
+
+	vbox_init_req(&req->header, VMMDevReq_AcknowledgeEvents, sizeof(VMMDevEvents));
+
+	vbox_send_request(vb->iobase, vb->dds.physicalAddress);
+
+	*events = req->events;
+
+	return req->header.rc;
+}
+
 /** Gets the current absolute mouse position from VirtualBox.
   * @param abs false if user has disabled mouse integration in VirtualBox,
   *  in which case we should fallback to PS/2 relative events. */
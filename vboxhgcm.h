@@ -85,6 +85,8 @@ static void vbox_hgcm_init_call(VMMDevHGCMCall __far *req, hgcm_client_id_t clie
 
 static vboxerr vbox_hgcm_do_call_sync(LPVBOXCOMM vb, VMMDevHGCMCall __far *req)
 {
+	vb->hgcm_calls++;
+
 	vbox_send_request(vb->iobase, vb->dds.physicalAddress);
 
 	if (req->header.header.rc < 0) {
@@ -118,7 +120,7 @@ static inline uint64_t vbox_hgcm_get_parameter_uint64(VMMDevHGCMCall __far *req,
 	return req->aParms[arg].u.value64;
 }
 
-static void vbox_hgcm_set_parameter_pointer(VMMDevHGCMCall __far *req, unsigned arg, unsigned size, void __far *ptr)
+static void vbox_hgcm_set_parameter_pointer(VMMDevHGCMCall __far *req, unsigned arg, unsigned size, const void __far *ptr)
 {
 	req->aParms[arg].type = VMMDevHGCMParmType_LinAddr;
 	req->aParms[arg].u.LinAddr.cb = size;
@@ -0,0 +1,468 @@
+/*
+ * VBSF - Shared folders benchmark
+ * Copyright (C) 2022 Javier S. Pedro
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <direct.h>
+#include <fcntl.h>
+#include <dos.h>
+
+#include "version.h"
+#include "int08pit.h"
+#include "int21dos.h"
+#include "sftsr.h"
+
+/** Name of the scratch directory created in the drive being measured. */
+#define WORK_DIR "VBSFBNCH.TMP"
+
+/** Size of the file used for the sequential and random tests. */
+#define TEST_FILE_SIZE (1024UL * 1024UL)
+
+/** Number of files in the generated directory for the find tests. */
+#define NUM_FIND_FILES 100
+
+/** Number of iterations for the open/close, getattr and random read tests. */
+#define NUM_ITERATIONS 200
+
+/** Number of calls for the int 2Fh dispatch test. */
+#define NUM_INT2F_CALLS 10000U
+
+/** DOS buffer sizes for the sequential tests. 65535 is the largest a DOS call accepts. */
+static const unsigned seq_sizes[] = { 1, 16, 128, 512, 4096, 16384, 32768, 65535 };
+
+static char work_dir[80];
+static uint8_t __far *iobuf;
+
+/** Installed VBSF, if any; used to count HGCM calls. */
+static LPTSRDATA vbsf;
+
+/** State of the measurement in progress. */
+static uint32_t start_time, start_hgcm_calls;
+
+static void begin_measure(void)
+{
+	start_hgcm_calls = vbsf ? vbsf->vb.hgcm_calls : 0;
+	start_time = pit_get_timestamp();
+}
+
+/** Prints the result of a measurement as a CSV line. */
+static void end_measure(const char *test, unsigned long param, unsigned long ops, unsigned long bytes)
+{
+	uint32_t usecs = pit_clocks_to_usecs(pit_get_timestamp() - start_time);
+	uint32_t hgcm_calls = vbsf ? vbsf->vb.hgcm_calls - start_hgcm_calls : 0;
+
+	printf("%s,%lu,%lu,%lu,%lu,%lu\n", test, param, ops, bytes, usecs, hgcm_calls);
+}
+
+static void fail(const char *what, const char *filename)
+{
+	fprintf(stderr, "Error during %s on %s\n", what, filename);
+}
+
+static void make_path(char *dst, const char *name)
+{
+	sprintf(dst, "%s\\%s", work_dir, name);
+}
+
+static bool dos_seek(int handle, unsigned long pos)
+{
+	union REGS r;
+	r.w.ax = 0x4200;
+	r.w.bx = handle;
+	r.w.cx = pos >> 16;
+	r.w.dx = pos & 0xFFFF;
+	intdos(&r, &r);
+	return !r.w.cflag;
+}
+
+static bool create_empty_file(const char *filename)
+{
+	int handle;
+	if (_dos_creat(filename, _A_NORMAL, &handle) != 0) return false;
+	_dos_close(handle);
+	return true;
+}
+
+static bool test_seq_write(const char *filename, unsigned size)
+{
+	unsigned long total = 0, ops = 0;
+	unsigned long limit = MIN(TEST_FILE_SIZE, size * 4096UL);
+	unsigned bytes;
+	int handle;
+
+	if (_dos_creat(filename, _A_NORMAL, &handle) != 0) {
+		fail("create", filename);
+		return false;
+	}
+
+	begin_measure();
+	while (total < limit) {
+		if (_dos_write(handle, iobuf, size, &bytes) != 0 || bytes != size) {
+			fail("write", filename);
+			_dos_close(handle);
+			return false;
+		}
+		total += bytes;
+		ops++;
+	}
+	end_measure("seqwrite", size, ops, total);
+
+	_dos_close(handle);
+	return true;
+}
+
+static bool test_seq_read(const char *filename, unsigned size)
+{
+	unsigned long total = 0, ops = 0;
+	unsigned bytes;
+	int handle;
+
+	if (_dos_open(filename, O_RDONLY, &handle) != 0) {
+		fail("open", filename);
+		return false;
+	}
+
+	begin_measure();
+	do {
+		if (_dos_read(handle, iobuf, size, &bytes) != 0) {
+			fail("read", filename);
+			_dos_close(handle);
+			return false;
+		}
+		total += bytes;
+		ops++;
+	} while (bytes == size);
+	end_measure("seqread", size, ops, total);
+
+	_dos_close(handle);
+	return true;
+}
+
+static bool test_sequential(void)
+{
+	char filename[100];
+	unsigned i;
+
+	make_path(filename, "SEQ.DAT");
+
+	for (i = 0; i < sizeof(seq_sizes) / sizeof(seq_sizes[0]); i++) {
+		if (!test_seq_write(filename, seq_sizes[i])) return false;
+		if (!test_seq_read(filename, seq_sizes[i])) return false;
+	}
+
+	remove(filename);
+	return true;
+}
+
+static bool test_random_read(void)
+{
+	const unsigned size = 512;
+	const unsigned long num_blocks = TEST_FILE_SIZE / size;
+	char filename[100];
+	unsigned long total = 0;
+	unsigned i, bytes;
+	int handle;
+
+	make_path(filename, "RANDOM.DAT");
+
+	if (_dos_creat(filename, _A_NORMAL, &handle) != 0) {
+		fail("create", filename);
+		return false;
+	}
+	for (i = 0; i < TEST_FILE_SIZE / 32768U; i++) {
+		if (_dos_write(handle, iobuf, 32768U, &bytes) != 0 || bytes != 32768U) {
+			fail("write", filename);
+			_dos_close(handle);
+			return false;
+		}
+	}
+	_dos_close(handle);
+
+	if (_dos_open(filename, O_RDONLY, &handle) != 0) {
+		fail("open", filename);
+		return false;
+	}
+
+	srand(1);
+	begin_measure();
+	for (i = 0; i < NUM_ITERATIONS; i++) {
+		unsigned long block = ((unsigned long)rand() * num_blocks) / ((unsigned long)RAND_MAX + 1);
+		if (!dos_seek(handle, block * size)
+		        || _dos_read(handle, iobuf, size, &bytes) != 0) {
+			fail("read", filename);
+			_dos_close(handle);
+			return false;
+		}
+		total += bytes;
+	}
+	end_measure("randread", size, NUM_ITERATIONS, total);
+
+	_dos_close(handle);
+	remove(filename);
+	return true;
+}
+
+static bool test_open_close(void)
+{
+	char filename[100];
+	unsigned i;
+	int handle;
+
+	make_path(filename, "OPEN.DAT");
+	if (!create_empty_file(filename)) {
+		fail("create", filename);
+		return false;
+	}
+
+	begin_measure();
+	for (i = 0; i < NUM_ITERATIONS; i++) {
+		if (_dos_open(filename, O_RDONLY, &handle) != 0) {
+			fail("open", filename);
+			return false;
+		}
+		_dos_close(handle);
+	}
+	end_measure("openclose", 0, NUM_ITERATIONS, 0);
+
+	remove(filename);
+	return true;
+}
+
+static bool test_getattr(void)
+{
+	char filename[100];
+	unsigned i, attr;
+
+	make_path(filename, "ATTR.DAT");
+	if (!create_empty_file(filename)) {
+		fail("create", filename);
+		return false;
+	}
+
+	begin_measure();
+	for (i = 0; i < NUM_ITERATIONS; i++) {
+		if (_dos_getfileattr(filename, &attr) != 0) {
+			fail("getattr", filename);
+			return false;
+		}
+	}
+	end_measure("getattr", 0, NUM_ITERATIONS, 0);
+
+	remove(filename);
+	return true;
+}
+
+static void int2f_call(uint16_t ax);
+#pragma aux int2f_call = \
+	"int 0x2F" \
+	__parm [ax] \
+	__modify [ax bx cx dx si di es]
+
+/** Measures the overhead that every installed int 2Fh handler adds to
+ *  calls which are not for it; this is paid by DOS on every file operation. */
+static bool test_int2f(void)
+{
+	// Multiplex ids we use: an (hopefully) unused one,
+	// and the redirector installation check, which VBSF also sees but does not handle.
+	static const uint16_t ids[] = { 0xC000, 0x1100 };
+	unsigned i, j;
+
+	for (i = 0; i < sizeof(ids) / sizeof(ids[0]); i++) {
+		begin_measure();
+		for (j = 0; j < NUM_INT2F_CALLS; j++) {
+			int2f_call(ids[i]);
+		}
+		end_measure("int2f", ids[i], NUM_INT2F_CALLS, 0);
+	}
+
+	return true;
+}
+
+/** Counts the entries matching pattern, returns 0 on error. */
+static unsigned long find_all(const char *pattern)
+{
+	struct find_t find;
+	unsigned long entries = 0;
+
+	if (_dos_findfirst(pattern, _A_NORMAL | _A_SUBDIR, &find) != 0) {
+		return 0;
+	}
+	do {
+		entries++;
+	} while (_dos_findnext(&find) == 0);
+
+	return entries;
+}
+
+static bool test_find(void)
+{
+	char dirname[100], filename[120], pattern[120];
+	unsigned long entries;
+	unsigned i;
+
+	make_path(dirname, "FIND");
+	if (mkdir(dirname) != 0) {
+		fail("mkdir", dirname);
+		return false;
+	}
+
+	for (i = 0; i < NUM_FIND_FILES; i++) {
+		sprintf(filename, "%s\\F%07u.DAT", dirname, i);
+		if (!create_empty_file(filename)) {
+			fail("create", filename);
+			return false;
+		}
+	}
+
+	sprintf(pattern, "%s\\*.*", dirname);
+
+	begin_measure();
+	entries = find_all(pattern);
+	end_measure("find", NUM_FIND_FILES, entries, 0);
+
+	for (i = 0; i < NUM_FIND_FILES; i++) {
+		sprintf(filename, "%s\\F%07u.DAT", dirname, i);
+		remove(filename);
+	}
+	rmdir(dirname);
+
+	return entries > 0;
+}
+
+/** Opens every mangled (i.e. containing '~') file name in an existing
+ *  directory, which is supposed to contain files with long names on the host. */
+static bool test_mangled(const char *dirname)
+{
+	char pattern[100], filename[120];
+	struct find_t find;
+	unsigned long ops = 0;
+	int handle;
+
+	sprintf(pattern, "%s\\*.*", dirname);
+
+	begin_measure();
+	if (_dos_findfirst(pattern, _A_NORMAL, &find) == 0) {
+		do {
+			if (!strchr(find.name, '~')) continue;
+			sprintf(filename, "%s\\%s", dirname, find.name);
+			if (_dos_open(filename, O_RDONLY, &handle) != 0) {
+				fail("open", filename);
+				return false;
+			}
+			_dos_close(handle);
+			ops++;
+		} while (_dos_findnext(&find) == 0);
+	}
+	end_measure("mangled", 0, ops, 0);
+
+	return true;
+}
+
+static void print_help(void)
+{
+	puts("\nUsage:\n"
+	     "    VBSFBNCH <X:> [<TEST>..]\n\n"
+	     "Measures the performance of redirected drive X:.\n"
+	     "Supported tests (all except mangled by default):\n"
+	     "    seq                sequential read & write with different buffer sizes\n"
+	     "    random             random 512 byte reads\n"
+	     "    open               open/close rate\n"
+	     "    getattr            get attributes rate\n"
+	     "    find               FindFirst/FindNext on a generated directory\n"
+	     "    int2f              int 2Fh dispatch overhead for calls not for VBSF\n"
+	     "    mangled <DIR>      open all files with mangled names in DIR\n\n"
+	     "Output is CSV: test,param,ops,bytes,usecs,hgcm_calls");
+}
+
+int main(int argc, const char *argv[])
+{
+	bool all = true, do_seq = false, do_random = false, do_open = false, do_getattr = false, do_find = false;
+	bool do_int2f = false;
+	const char *mangled_dir = NULL;
+	segment_t io_seg;
+	bool ok = true;
+	int argi;
+
+	if (argc < 2 || strlen(argv[1]) > 2 || (argv[1][1] != ':' && argv[1][1] != '\0')
+	        || !isalpha(argv[1][0])) {
+		print_help();
+		return EXIT_FAILURE;
+	}
+
+	for (argi = 2; argi < argc; argi++) {
+		all = false;
+		if (stricmp(argv[argi], "seq") == 0) {
+			do_seq = true;
+		} else if (stricmp(argv[argi], "random") == 0) {
+			do_random = true;
+		} else if (stricmp(argv[argi], "open") == 0) {
+			do_open = true;
+		} else if (stricmp(argv[argi], "getattr") == 0) {
+			do_getattr = true;
+		} else if (stricmp(argv[argi], "find") == 0) {
+			do_find = true;
+		} else if (stricmp(argv[argi], "int2f") == 0) {
+			do_int2f = true;
+		} else if (stricmp(argv[argi], "mangled") == 0 && argi + 1 < argc) {
+			mangled_dir = argv[++argi];
+		} else {
+			print_help();
+			return EXIT_FAILURE;
+		}
+	}
+
+	io_seg = dos_alloc(0x1000); // 64 KiB
+	if (!io_seg) {
+		fputs("Not enough memory\n", stderr);
+		return EXIT_FAILURE;
+	}
+	iobuf = MK_FP(io_seg, 0);
+	_fmemset(iobuf, 'X', 0xFFFF);
+
+	sprintf(work_dir, "%c:\\%s", toupper(argv[1][0]), WORK_DIR);
+	if (mkdir(work_dir) != 0) {
+		fail("mkdir", work_dir);
+		dos_free(io_seg);
+		return EXIT_FAILURE;
+	}
+
+	vbsf = int2f_get_tsr_data();
+
+	printf("# VBSFBNCH %x.%x %s\n", VERSION_MAJOR, VERSION_MINOR, work_dir);
+	puts("test,param,ops,bytes,usecs,hgcm_calls");
+
+	pit_start_timing();
+
+	if (ok && (all || do_seq)) ok = test_sequential();
+	if (ok && (all || do_random)) ok = test_random_read();
+	if (ok && (all || do_open)) ok = test_open_close();
+	if (ok && (all || do_getattr)) ok = test_getattr();
+	if (ok && (all || do_find)) ok = test_find();
+	if (ok && (all || do_int2f)) ok = test_int2f();
+	if (ok && mangled_dir) ok = test_mangled(mangled_dir);
+
+	pit_stop_timing();
+
+	rmdir(work_dir);
+	dos_free(io_seg);
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,85 @@
+/*
+ * VBMouse - VMware SVGA II device routines
+ * Copyright (C) 2022 Javier S. Pedro
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdint.h>
+#include <i86.h>
+
+#include "dlog.h"
+#include "int1Apci.h"
+#include "vmwsvga.h"
+
+// Classic PCI defines
+enum {
+	CFG_COMMAND         = 0x04, /* Word  */
+	CFG_BAR0            = 0x10, /* DWord */
+};
+
+int vmwsvga_init_device(LPVMWSVGA svga)
+{
+	const uint32_t needed_caps = VMWSVGA_CAP_CURSOR | VMWSVGA_CAP_CURSOR_BYPASS;
+	int err;
+	pcisel pcidev;
+	uint16_t command;
+	uint32_t bar;
+
+	if ((err = pci_init_bios())) {
+		return err;
+	}
+
+	if ((err = pci_find_device(&pcidev, VMWSVGA_PCI_VEND_ID, VMWSVGA_PCI_PROD_ID, 0))) {
+		return err;
+	}
+
+	if ((err = pci_read_config_word(pcidev, CFG_COMMAND, &command))) {
+		return err;
+	}
+
+	if (!(command & 1)) {
+		// The card is not configured
+		return -1;
+	}
+
+	if ((err = pci_read_config_dword(pcidev, CFG_BAR0, &bar))) {
+		return err;
+	}
+
+	if (!(bar & 1)) {
+		// This is not an IO BAR
+		return -2;
+	}
+
+	svga->iobase = bar & 0xFFFC;
+
+	vmwsvga_write_reg(svga->iobase, VMWSVGA_REG_ID, VMWSVGA_ID_2);
+	if (vmwsvga_read_reg(svga->iobase, VMWSVGA_REG_ID) != VMWSVGA_ID_2) {
+		// Too old, no FIFO nor cursor
+		return -3;
+	}
+
+	if ((vmwsvga_read_reg(svga->iobase, VMWSVGA_REG_CAPABILITIES) & needed_caps) != needed_caps) {
+		return -4;
+	}
+
+	svga->fifo = vmwsvga_read_reg(svga->iobase, VMWSVGA_REG_MEM_START);
+	svga->fifo_size = vmwsvga_read_reg(svga->iobase, VMWSVGA_REG_MEM_SIZE);
+
+	dprintf("SVGA II iobase=0x%x fifo=0x%lx size=%lu\n", svga->iobase, svga->fifo, svga->fifo_size);
+
+	return 0;
+}
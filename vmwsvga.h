@@ -0,0 +1,269 @@
+/*
+ * VBMouse - VMware SVGA II device routines
+ * Copyright (C) 2022 Javier S. Pedro
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef VMWSVGA_H
+#define VMWSVGA_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "int15mem.h"
+#include "utils.h"
+
+/* Definitions from VMware's svga_reg.h, see also
+ * https://wiki.osdev.org/VMware_SVGA-II */
+
+#define VMWSVGA_PCI_VEND_ID 0x15AD
+#define VMWSVGA_PCI_PROD_ID 0x0405
+
+/** Value written to (and read back from) the ID register to negotiate version 2. */
+#define VMWSVGA_ID_2 0x90000002UL
+
+enum vmwsvga_ports {
+	VMWSVGA_PORT_INDEX = 0,
+	VMWSVGA_PORT_VALUE = 1,
+};
+
+enum vmwsvga_registers {
+	VMWSVGA_REG_ID           = 0,
+	VMWSVGA_REG_ENABLE       = 1,
+	VMWSVGA_REG_CAPABILITIES = 17,
+	VMWSVGA_REG_MEM_START    = 18,
+	VMWSVGA_REG_MEM_SIZE     = 19,
+	VMWSVGA_REG_CONFIG_DONE  = 20,
+	VMWSVGA_REG_SYNC         = 21,
+	VMWSVGA_REG_BUSY         = 22,
+	VMWSVGA_REG_CURSOR_ID    = 24,
+	VMWSVGA_REG_CURSOR_X     = 25,
+	VMWSVGA_REG_CURSOR_Y     = 26,
+	VMWSVGA_REG_CURSOR_ON    = 27,
+};
+
+enum vmwsvga_capabilities {
+	VMWSVGA_CAP_CURSOR        = 0x20,
+	VMWSVGA_CAP_CURSOR_BYPASS = 0x40,
+};
+
+enum vmwsvga_cursor_on {
+	VMWSVGA_CURSOR_ON_HIDE = 0,
+	VMWSVGA_CURSOR_ON_SHOW = 1,
+};
+
+/** The first dwords of the FIFO memory, in bytes from the FIFO start. */
+enum vmwsvga_fifo_registers {
+	VMWSVGA_FIFO_MIN      = 0,
+	VMWSVGA_FIFO_MAX      = 4,
+	VMWSVGA_FIFO_NEXT_CMD = 8,
+	VMWSVGA_FIFO_STOP     = 12,
+	/** Where commands start if we set up the FIFO ourselves. */
+	VMWSVGA_FIFO_LEGACY_MIN = 16,
+};
+
+enum vmwsvga_commands {
+	VMWSVGA_CMD_DEFINE_CURSOR = 19,
+};
+
+/** Cursor id we use for the int33 cursor. */
+#define VMWSVGA_CURSOR_ID 0
+
+/** Width of the cursor we define. Masks are padded to 32 bits per scanline
+ *  anyway, and some emulators (QEMU) do not honor the padding of narrower ones. */
+#define VMWSVGA_CURSOR_WIDTH 32
+
+/** Length in dwords of a DEFINE_CURSOR command with two 1bpp masks of the given height. */
+#define VMWSVGA_DEFINE_CURSOR_CMD_LEN(height) (8 + 2 * (height))
+
+/** Number of times we poll the busy register before giving up. */
+#define VMWSVGA_MAX_BUSY_POLLS 10000U
+
+/** Information needed to talk to the SVGA II device. */
+typedef struct vmwsvga {
+	/** The IO port base of the SVGA II PCI device. */
+	uint16_t iobase;
+	/** Physical address of the command FIFO. */
+	uint32_t fifo;
+	/** Size of the command FIFO in bytes. */
+	uint32_t fifo_size;
+} vmwsvga_t;
+typedef vmwsvga_t __far * LPVMWSVGA;
+
+/** Writes to a SVGA register.
+ *  The index and value ports are written with interrupts disabled
+ *  so that an interrupt handler cannot use the index port in between. */
+static void vmwsvga_write_reg(uint16_t iobase, uint8_t index, uint32_t value);
+#pragma aux vmwsvga_write_reg = \
+	"push eax"     /* Preserve 32-bit register, specifically the higher word. */ \
+	"pushf" \
+	"cli" \
+	"movzx eax, al" \
+	"out dx, eax" \
+	"inc dx" \
+	"push cx"      /* Combine cx:bx into single 32-bit eax */ \
+	"push bx" \
+	"pop eax" \
+	"out dx, eax" \
+	"popf" \
+	"pop eax" \
+	__parm [dx] [al] [cx bx] \
+	__modify [dx]
+
+/** Reads from a SVGA register. */
+static uint32_t vmwsvga_read_reg(uint16_t iobase, uint8_t index);
+#pragma aux vmwsvga_read_reg = \
+	"pushf" \
+	"cli" \
+	"movzx eax, al" \
+	"out dx, eax" \
+	"inc dx" \
+	"in eax, dx" \
+	"popf" \
+	"push eax"     /* Split eax into dx:ax */ \
+	"pop ax" \
+	"pop dx" \
+	__parm [dx] [al] \
+	__value [dx ax] \
+	__modify [ax dx]
+
+/** Finds the SVGA II PCI device and checks that it has cursor registers.
+  * @returns 0 if the device was found. */
+extern int vmwsvga_init_device(LPVMWSVGA svga);
+
+/** Whether the SVGA (rather than VGA compatible) mode is active,
+ *  which is the only one where the host draws the cursor. */
+static inline bool vmwsvga_is_enabled(LPVMWSVGA svga)
+{
+	return vmwsvga_read_reg(svga->iobase, VMWSVGA_REG_ENABLE) != 0;
+}
+
+/** Asks the host to process the FIFO and waits until it is done. */
+static void vmwsvga_sync(LPVMWSVGA svga)
+{
+	unsigned i;
+
+	vmwsvga_write_reg(svga->iobase, VMWSVGA_REG_SYNC, 1);
+	for (i = 0; i < VMWSVGA_MAX_BUSY_POLLS; i++) {
+		if (!vmwsvga_read_reg(svga->iobase, VMWSVGA_REG_BUSY)) {
+			break;
+		}
+	}
+}
+
+/** Sets up the command FIFO, unless someone (e.g. the BIOS) already did.
+ *  @param gdt scratch space for copying to the FIFO.
+ *  @returns true if the FIFO is ready. */
+static bool vmwsvga_init_fifo(LPVMWSVGA svga, struct int15_move_gdt __far *gdt)
+{
+	uint32_t regs[4];
+
+	if (vmwsvga_read_reg(svga->iobase, VMWSVGA_REG_CONFIG_DONE)) {
+		return true;
+	}
+
+	regs[0] = VMWSVGA_FIFO_LEGACY_MIN;                 // MIN
+	regs[1] = svga->fifo_size;                         // MAX
+	regs[2] = VMWSVGA_FIFO_LEGACY_MIN;                 // NEXT_CMD
+	regs[3] = VMWSVGA_FIFO_LEGACY_MIN;                 // STOP
+
+	if (!int15_move_block(gdt, svga->fifo, linear_addr(regs), sizeof(regs))) {
+		return false;
+	}
+
+	vmwsvga_write_reg(svga->iobase, VMWSVGA_REG_CONFIG_DONE, 1);
+
+	return true;
+}
+
+/** Copies a command into the FIFO and asks the host to process it.
+ *  Waits for the FIFO to be empty first, which is fine for the
+ *  rare commands we send, and means the command always fits.
+ *  @param cmd the command, in conventional memory.
+ *  @param len its length in dwords.
+ *  @param gdt scratch space for copying to the FIFO.
+ *  @returns true if the command was queued. */
+static bool vmwsvga_send_command(LPVMWSVGA svga, const uint32_t __far *cmd, unsigned len,
+                                 struct int15_move_gdt __far *gdt)
+{
+	uint32_t regs[4];
+	uint32_t next, contiguous;
+	uint32_t src = linear_addr(cmd);
+	uint16_t bytes = len * sizeof(uint32_t);
+
+	vmwsvga_sync(svga);
+
+	if (!int15_move_block(gdt, linear_addr(regs), svga->fifo, sizeof(regs))) {
+		return false;
+	}
+
+	next = regs[2];
+	if (next < regs[0] || next >= regs[1] || regs[1] - regs[0] <= bytes) {
+		// FIFO not configured as we expect
+		return false;
+	}
+	if (regs[3] != next) {
+		// Host did not catch up with the previous commands
+		return false;
+	}
+
+	// Commands can wrap around the end of the FIFO at any dword
+	contiguous = regs[1] - next;
+	if (contiguous > bytes) {
+		contiguous = bytes;
+	}
+	if (!int15_move_block(gdt, svga->fifo + next, src, (uint16_t) contiguous)) {
+		return false;
+	}
+	next += contiguous;
+	if (contiguous < bytes) {
+		if (!int15_move_block(gdt, svga->fifo + regs[0], src + contiguous,
+		                      (uint16_t) (bytes - contiguous))) {
+			return false;
+		}
+		next = regs[0] + (bytes - contiguous);
+	}
+	if (next >= regs[1]) {
+		next = regs[0];
+	}
+
+	regs[2] = next;
+	if (!int15_move_block(gdt, svga->fifo + VMWSVGA_FIFO_NEXT_CMD,
+	                      linear_addr(&regs[2]), sizeof(uint32_t))) {
+		return false;
+	}
+
+	vmwsvga_sync(svga);
+
+	return true;
+}
+
+/** Moves the host cursor hotspot to the given position (in pixels). */
+static inline void vmwsvga_set_cursor_pos(LPVMWSVGA svga, int16_t x, int16_t y)
+{
+	vmwsvga_write_reg(svga->iobase, VMWSVGA_REG_CURSOR_ID, VMWSVGA_CURSOR_ID);
+	vmwsvga_write_reg(svga->iobase, VMWSVGA_REG_CURSOR_X, x);
+	vmwsvga_write_reg(svga->iobase, VMWSVGA_REG_CURSOR_Y, y);
+}
+
+static inline void vmwsvga_set_cursor_visible(LPVMWSVGA svga, bool visible)
+{
+	vmwsvga_write_reg(svga->iobase, VMWSVGA_REG_CURSOR_ID, VMWSVGA_CURSOR_ID);
+	vmwsvga_write_reg(svga->iobase, VMWSVGA_REG_CURSOR_ON,
+	                  visible ? VMWSVGA_CURSOR_ON_SHOW : VMWSVGA_CURSOR_ON_HIDE);
+}
+
+#endif // VMWSVGA_H